@@ -0,0 +1,152 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "./allocator.h"
+
+static inline bool is_mapped(size_t size)
+{
+        return size >= ALLOCATOR_MMAP_THRESHOLD;
+}
+
+static size_t page_align(size_t size)
+{
+        static size_t page_size = 0;
+        if (page_size == 0) {
+                page_size = sysconf(_SC_PAGESIZE);
+        }
+        return (size + page_size - 1) & ~(page_size - 1);
+}
+
+/** Anonymous mappings are zeroed, so this is also the large `calloc()` */
+static void *map_new(size_t size)
+{
+        void *map = mmap(NULL, page_align(size), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return map == MAP_FAILED ? NULL : map;
+}
+
+static void *libc_alloc(struct allocator *self, size_t size)
+{
+        (void)self;
+        return is_mapped(size) ? map_new(size) : malloc(size);
+}
+
+static void *libc_calloc(struct allocator *self, size_t size)
+{
+        (void)self;
+        return is_mapped(size) ? map_new(size) : calloc(1, size);
+}
+
+static void *libc_realloc(struct allocator *self, void *ptr, size_t old_size, size_t size)
+{
+        (void)self;
+        if (ptr == NULL || old_size == 0) {
+                return libc_alloc(self, size);
+        }
+        if (is_mapped(old_size) && is_mapped(size)) {
+                void *map = mremap(ptr, page_align(old_size), page_align(size), MREMAP_MAYMOVE);
+                return map == MAP_FAILED ? NULL : map;
+        }
+        if (!is_mapped(old_size) && !is_mapped(size)) {
+                return realloc(ptr, size);
+        }
+        // Crossing the threshold: copy between the heap and a mapping
+        void *newptr = libc_alloc(self, size);
+        if (newptr == NULL) {
+                return NULL;
+        }
+        memcpy(newptr, ptr, old_size < size ? old_size : size);
+        if (is_mapped(old_size)) {
+                munmap(ptr, page_align(old_size));
+        } else {
+                free(ptr);
+        }
+        return newptr;
+}
+
+static void libc_free(struct allocator *self, void *ptr, size_t size)
+{
+        (void)self;
+        if (ptr == NULL) {
+                return;
+        }
+        if (is_mapped(size)) {
+                munmap(ptr, page_align(size));
+        } else {
+                free(ptr);
+        }
+}
+
+struct allocator allocator_libc = {
+        .alloc = libc_alloc,
+        .calloc = libc_calloc,
+        .realloc = libc_realloc,
+        .free = libc_free,
+};
+
+#define STAT_ADD(field, n) __atomic_add_fetch(&self->stats.field, n, __ATOMIC_RELAXED)
+#define STAT_SUB(field, n) __atomic_sub_fetch(&self->stats.field, n, __ATOMIC_RELAXED)
+
+static void allocator_grew(struct allocator *self, size_t size)
+{
+        size_t live = STAT_ADD(live, size);
+        size_t peak = __atomic_load_n(&self->stats.peak, __ATOMIC_RELAXED);
+        while (live > peak && !__atomic_compare_exchange_n(&self->stats.peak, &peak, live, true,
+                                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+}
+
+void *allocator_alloc(struct allocator *self, size_t size)
+{
+        void *ptr = self->alloc(self, size);
+        if (ptr != NULL) {
+                STAT_ADD(allocs, 1);
+                allocator_grew(self, size);
+        }
+        return ptr;
+}
+
+void *allocator_calloc(struct allocator *self, size_t size)
+{
+        void *ptr = self->calloc(self, size);
+        if (ptr != NULL) {
+                STAT_ADD(allocs, 1);
+                allocator_grew(self, size);
+        }
+        return ptr;
+}
+
+void *allocator_realloc(struct allocator *self, void *ptr, size_t old_size, size_t size)
+{
+        void *newptr = self->realloc(self, ptr, old_size, size);
+        if (newptr != NULL) {
+                STAT_ADD(reallocs, 1);
+                if (size >= old_size) {
+                        allocator_grew(self, size - old_size);
+                } else {
+                        STAT_SUB(live, old_size - size);
+                }
+        }
+        return newptr;
+}
+
+void allocator_free(struct allocator *self, void *ptr, size_t size)
+{
+        self->free(self, ptr, size);
+        STAT_ADD(frees, 1);
+        STAT_SUB(live, size);
+}
+
+struct allocator_stats allocator_stats(struct allocator *self)
+{
+        struct allocator_stats stats;
+        stats.live = __atomic_load_n(&self->stats.live, __ATOMIC_RELAXED);
+        stats.peak = __atomic_load_n(&self->stats.peak, __ATOMIC_RELAXED);
+        stats.allocs = __atomic_load_n(&self->stats.allocs, __ATOMIC_RELAXED);
+        stats.reallocs = __atomic_load_n(&self->stats.reallocs, __ATOMIC_RELAXED);
+        stats.frees = __atomic_load_n(&self->stats.frees, __ATOMIC_RELAXED);
+        return stats;
+}
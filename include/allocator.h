@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Running totals for an allocator. Updated with relaxed atomics, so an
+ * allocator may be shared between threads; a snapshot taken while other
+ * threads allocate is approximate.
+ */
+struct allocator_stats {
+        /** Bytes currently allocated */
+        size_t live;
+        /** High-water mark of `live` */
+        size_t peak;
+        size_t allocs;
+        size_t reallocs;
+        size_t frees;
+};
+
+/**
+ * Where a container gets its memory from. `dynarray` (and so `cstring`) and
+ * `jtable` store one of these and route every allocation through it, so they
+ * can be placed on the heap, in an arena, in a pool, etc.
+ *
+ * Containers always pass the size of the allocation back in, so
+ * implementations do not need to keep headers to know it, and every allocator
+ * gets byte-accurate accounting for free.
+ *
+ * Don't call the function pointers directly: use `allocator_alloc()` and
+ * friends, which do the accounting.
+ */
+struct allocator {
+        void *(*alloc)(struct allocator *self, size_t size);
+        /** Like `alloc`, but the memory must be zeroed */
+        void *(*calloc)(struct allocator *self, size_t size);
+        /** Contents up to `min(old_size, size)` must be preserved */
+        void *(*realloc)(struct allocator *self, void *ptr, size_t old_size, size_t size);
+        void (*free)(struct allocator *self, void *ptr, size_t size);
+        struct allocator_stats stats;
+};
+
+/**
+ * Allocations of at least this many bytes from `allocator_libc` are anonymous
+ * mappings of their own.
+ */
+#define ALLOCATOR_MMAP_THRESHOLD (1024 * 1024)
+
+/**
+ * The default allocator: `malloc()` and friends, for anything smaller than
+ * `ALLOCATOR_MMAP_THRESHOLD`. Bigger allocations are page-aligned anonymous
+ * mappings, which grow and shrink with `mremap()`. The kernel moves page table
+ * entries rather than copying, so growing a multi-megabyte buffer costs the
+ * same as growing a small one.
+ */
+extern struct allocator allocator_libc;
+
+/**
+ * Allocate `size` bytes. Returns `NULL` if the underlying allocator does.
+ */
+void *allocator_alloc(struct allocator *self, size_t size);
+
+/**
+ * Allocate `size` zeroed bytes. Returns `NULL` if the underlying allocator
+ * does.
+ */
+void *allocator_calloc(struct allocator *self, size_t size);
+
+/**
+ * Resize an allocation of `old_size` bytes to `size` bytes. Returns `NULL`,
+ * leaving `ptr` untouched, if the underlying allocator does.
+ */
+void *allocator_realloc(struct allocator *self, void *ptr, size_t old_size, size_t size);
+
+/**
+ * Release an allocation of `size` bytes.
+ */
+void allocator_free(struct allocator *self, void *ptr, size_t size);
+
+/**
+ * A snapshot of this allocator's accounting.
+ */
+struct allocator_stats allocator_stats(struct allocator *self);
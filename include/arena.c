@@ -0,0 +1,186 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "./arena.h"
+#include "./panic.h"
+
+#define ARENA_ALIGN _Alignof(max_align_t)
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static inline size_t align_up(size_t n, size_t align)
+{
+        return (n + align - 1) & ~(align - 1);
+}
+
+static void *arena_allocator_alloc(struct allocator *self, size_t size)
+{
+        return arena_alloc((struct arena *)self, size);
+}
+
+static void *arena_allocator_calloc(struct allocator *self, size_t size)
+{
+        return memset(arena_alloc((struct arena *)self, size), 0, size);
+}
+
+static void *arena_allocator_realloc(struct allocator *self, void *ptr, size_t old_size,
+                                     size_t size)
+{
+        return arena_realloc((struct arena *)self, ptr, old_size, size);
+}
+
+static void arena_allocator_free(struct allocator *self, void *ptr, size_t size)
+{
+        (void)self;
+        (void)ptr;
+        (void)size;
+}
+
+struct arena arena_new(size_t chunk_size, uint32_t flags)
+{
+        struct arena arena;
+        // `allocator` is the first member, so the vtable can cast back
+        arena.allocator = (struct allocator){
+                .alloc = arena_allocator_alloc,
+                .calloc = arena_allocator_calloc,
+                .realloc = arena_allocator_realloc,
+                .free = arena_allocator_free,
+        };
+        arena.chunks = NULL;
+        arena.spare = NULL;
+        arena.ptr = NULL;
+        arena.end = NULL;
+        arena.last = NULL;
+        arena.chunk_size = chunk_size;
+        arena.flags = flags;
+        return arena;
+}
+
+/** Allocate a chunk with at least `min` usable bytes */
+static struct arena_chunk *arena_chunk_new(struct arena *self, size_t min)
+{
+        size_t cap = min > self->chunk_size ? min : self->chunk_size;
+        size_t size = sizeof(struct arena_chunk) + cap;
+        struct arena_chunk *chunk;
+        if (self->flags & ARENA_HUGE_PAGES) {
+                size_t map_len = align_up(size, HUGE_PAGE_SIZE);
+                int prot = PROT_READ | PROT_WRITE;
+                void *map = mmap(NULL, map_len, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                                 -1, 0);
+                if (map == MAP_FAILED) {
+                        // No reserved huge pages, ask for transparent ones
+                        map = mmap(NULL, map_len, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                        if (map == MAP_FAILED) {
+                                PANIC("mmap() failed: %s", strerror(errno));
+                        }
+                        madvise(map, map_len, MADV_HUGEPAGE);
+                }
+                chunk = map;
+                chunk->map_len = map_len;
+                cap = map_len - sizeof(struct arena_chunk);
+        } else {
+                chunk = malloc(size);
+                if (chunk == NULL) {
+                        PANIC("malloc() returned NULL");
+                }
+                chunk->map_len = 0;
+        }
+        chunk->cap = cap;
+        chunk->next = NULL;
+        return chunk;
+}
+
+static void arena_chunk_free(struct arena_chunk *chunk)
+{
+        if (chunk->map_len) {
+                munmap(chunk, chunk->map_len);
+        } else {
+                free(chunk);
+        }
+}
+
+/** Make a chunk with at least `min` free bytes current, reusing a spare one if
+  * it is big enough
+  */
+static void arena_next_chunk(struct arena *self, size_t min)
+{
+        struct arena_chunk **it = &self->spare;
+        while (*it != NULL && (*it)->cap < min) {
+                it = &(*it)->next;
+        }
+        struct arena_chunk *chunk;
+        if (*it != NULL) {
+                chunk = *it;
+                *it = chunk->next;
+        } else {
+                chunk = arena_chunk_new(self, min);
+        }
+        chunk->next = self->chunks;
+        self->chunks = chunk;
+        self->ptr = chunk->data;
+        self->end = chunk->data + chunk->cap;
+}
+
+void *arena_alloc(struct arena *self, size_t size)
+{
+        // Keep `ptr` aligned, so that the next allocation is too
+        size = align_up(size ? size : 1, ARENA_ALIGN);
+        if ((size_t)(self->end - self->ptr) < size) {
+                arena_next_chunk(self, size);
+        }
+        uint8_t *p = self->ptr;
+        self->ptr += size;
+        self->last = p;
+        return p;
+}
+
+void *arena_realloc(struct arena *self, void *ptr, size_t used, size_t size)
+{
+        if (ptr != NULL && ptr == self->last) {
+                size_t aligned = align_up(size ? size : 1, ARENA_ALIGN);
+                if ((size_t)(self->end - self->last) >= aligned) {
+                        self->ptr = self->last + aligned;
+                        return ptr;
+                }
+        }
+        void *p = arena_alloc(self, size);
+        if (used) {
+                memcpy(p, ptr, used < size ? used : size);
+        }
+        return p;
+}
+
+struct arena_mark arena_mark(struct arena *self)
+{
+        return (struct arena_mark){ .chunk = self->chunks, .ptr = self->ptr };
+}
+
+void arena_reset_to(struct arena *self, struct arena_mark mark)
+{
+        while (self->chunks != mark.chunk) {
+                struct arena_chunk *chunk = self->chunks;
+                self->chunks = chunk->next;
+                chunk->next = self->spare;
+                self->spare = chunk;
+        }
+        self->ptr = mark.ptr;
+        self->end = mark.chunk ? mark.chunk->data + mark.chunk->cap : NULL;
+        self->last = NULL;
+}
+
+void arena_reset(struct arena *self)
+{
+        arena_reset_to(self, (struct arena_mark){ .chunk = NULL, .ptr = NULL });
+        __atomic_store_n(&self->allocator.stats.live, 0, __ATOMIC_RELAXED);
+}
+
+void arena_free(struct arena *self)
+{
+        arena_reset(self);
+        while (self->spare != NULL) {
+                struct arena_chunk *chunk = self->spare;
+                self->spare = chunk->next;
+                arena_chunk_free(chunk);
+        }
+}
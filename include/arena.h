@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "./allocator.h"
+
+/**
+ * Back chunks with huge pages: `MAP_HUGETLB` if the system has some reserved,
+ * otherwise transparent huge pages via `madvise()`.
+ */
+#define ARENA_HUGE_PAGES 1
+
+/** Default size of the chunks an arena bumps through */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+struct arena_chunk {
+        struct arena_chunk *next;
+        /** Usable bytes after this header */
+        size_t cap;
+        /** Size of the whole mapping, if this chunk was `mmap()`ed */
+        size_t map_len;
+        _Alignas(max_align_t) uint8_t data[];
+};
+
+/**
+ * A bump allocator for short-lived allocations. Allocating is a pointer bump
+ * inside the current chunk, and freeing individual allocations is a no-op:
+ * memory is handed back all at once by `arena_reset()` (or back to a point
+ * saved by `arena_mark()`), after which chunks are reused rather than freed.
+ *
+ * The intended use is one arena per event loop, reset after every batch of
+ * events, so that all the transient allocations of handling a message cost a
+ * few pointer bumps.
+ *
+ * # Example
+ *
+ * ```c
+ * struct arena arena = arena_new(ARENA_CHUNK_SIZE, 0);
+ * while (true) {
+ *         struct dynarray msg = dynarray_new_in(&arena);
+ *         // ...
+ *         arena_reset(&arena);
+ * }
+ * arena_free(&arena);
+ * ```
+ */
+struct arena {
+        /** 
+         * This arena as a `struct allocator`, for containers that take one.
+         * Frees are no-ops, and a reset releases everything at once.
+         */
+        struct allocator allocator;
+        /** Chunks in use, most recent first. `ptr` and `end` are in the first. */
+        struct arena_chunk *chunks;
+        /** Chunks released by a reset, kept for reuse */
+        struct arena_chunk *spare;
+        uint8_t *ptr;
+        uint8_t *end;
+        /** Start of the most recent allocation, which can grow in place */
+        uint8_t *last;
+        size_t chunk_size;
+        uint32_t flags;
+};
+
+/**
+ * A point in an arena to reset back to. See `arena_mark()`.
+ */
+struct arena_mark {
+        struct arena_chunk *chunk;
+        uint8_t *ptr;
+};
+
+/**
+ * Construct an arena that allocates `chunk_size` bytes at a time. `flags` is
+ * `0` or `ARENA_HUGE_PAGES`. This does not allocate.
+ */
+struct arena arena_new(size_t chunk_size, uint32_t flags);
+
+/**
+ * Allocate `size` bytes, aligned for any type. Never returns `NULL`.
+ */
+void *arena_alloc(struct arena *self, size_t size);
+
+/**
+ * Resize an allocation of `used` bytes at `ptr` to `size` bytes, keeping its
+ * contents. If `ptr` is the most recent allocation and there is room, this
+ * grows it in place. `ptr` may also point outside the arena, in which case
+ * `used` bytes are copied out of it.
+ */
+void *arena_realloc(struct arena *self, void *ptr, size_t used, size_t size);
+
+/**
+ * Remember the current position, so that everything allocated after this can
+ * be released with `arena_reset_to()`.
+ */
+struct arena_mark arena_mark(struct arena *self);
+
+/**
+ * Release everything allocated since `mark` was taken.
+ */
+void arena_reset_to(struct arena *self, struct arena_mark mark);
+
+/**
+ * Release every allocation, keeping the chunks for reuse.
+ */
+void arena_reset(struct arena *self);
+
+/**
+ * Free this arena and all its chunks, invalidating it for any future use.
+ */
+void arena_free(struct arena *self);
@@ -0,0 +1,186 @@
+#include <stdlib.h>
+#include <sched.h>
+
+#include "./cjtable.h"
+#include "./jtable.h"
+#include "./dynarray.h"
+#include "./panic.h"
+
+#define LOAD(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+
+/** Spins a reader does on a busy stripe before giving its timeslice away */
+#define CJTABLE_SPINS 64
+
+/** Wait for a writer to leave its critical section */
+static inline void cpu_relax(unsigned *spins)
+{
+        if (++*spins % CJTABLE_SPINS == 0) {
+                // The writer may have been descheduled mid-section
+                sched_yield();
+                return;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+}
+
+static inline struct cjtable_stripe *cjtable_stripe_of(cjtable *self, keyint_t k)
+{
+        // jtable uses the low bits of the key for the home bucket, so pick the
+        // stripe from the high bits of a multiplicative hash instead
+        uint64_t h = (uint64_t)k * 0x9e3779b97f4a7c15ull;
+        return &self->stripes[h >> 58 & (CJTABLE_STRIPES - 1)];
+}
+
+static inline void stripe_write_begin(struct cjtable_stripe *s)
+{
+        __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void stripe_write_end(struct cjtable_stripe *s)
+{
+        __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+void cjtable_init(cjtable *self)
+{
+        for (size_t i = 0; i < CJTABLE_STRIPES; ++i) {
+                struct cjtable_stripe *s = &self->stripes[i];
+                if (pthread_mutex_init(&s->lock, NULL)) {
+                        PANIC("pthread_mutex_init() failed");
+                }
+                s->seq = 0;
+                jtable_init(&s->tbl);
+                s->retired = dynarray_new();
+        }
+}
+
+void cjtable_insert(cjtable *self, keyint_t k, valint_t v)
+{
+        struct cjtable_stripe *s = cjtable_stripe_of(self, k);
+        pthread_mutex_lock(&s->lock);
+        if (jtable_full(&s->tbl)) {
+                // Readers keep using the old array while we rehash
+                size_t cap = s->tbl.cap ? s->tbl.cap * 4 : JTABLE_MIN_CAP;
+                jtable grown = jtable_rehashed(&s->tbl, cap);
+                stripe_write_begin(s);
+                if (s->tbl.buckets != NULL) {
+                        DYNARRAY_PUSH(&s->retired, jtable, s->tbl);
+                }
+                __atomic_store_n(&s->tbl.buckets, grown.buckets, __ATOMIC_RELAXED);
+                __atomic_store_n(&s->tbl.cap, grown.cap, __ATOMIC_RELAXED);
+                s->tbl.len = grown.len;
+                stripe_write_end(s);
+        }
+        stripe_write_begin(s);
+        jtable_insert(&s->tbl, k, v);
+        stripe_write_end(s);
+        pthread_mutex_unlock(&s->lock);
+}
+
+void cjtable_remove(cjtable *self, keyint_t k)
+{
+        struct cjtable_stripe *s = cjtable_stripe_of(self, k);
+        pthread_mutex_lock(&s->lock);
+        stripe_write_begin(s);
+        // Never shrink: readers may be walking the current array
+        jtable_remove_noshrink(&s->tbl, k);
+        stripe_write_end(s);
+        pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * The read side of `jtable_lookup()`, for a bucket array that may be mutated
+ * underneath us. Every load is relaxed-atomic, as is every store jtable.c
+ * makes to a bucket, so there is no data race. The walk is bounded and stays
+ * in range, so a torn read can produce a wrong answer (which the seqlock
+ * rejects) but never a fault or an endless loop.
+ */
+static bool cjtable_probe(struct bucket *buckets, size_t cap, keyint_t k, valint_t *out)
+{
+        if (cap == 0) {
+                return false;
+        }
+        // Must agree with `hash()` in jtable.c
+        size_t i = (size_t)k % cap;
+        if (LOAD(&buckets[i].ctrl) == CTRL_EMPTY) {
+                return false;
+        }
+        i = (i + LOAD(&buckets[i].chain_start)) % cap;
+        for (size_t steps = 0; steps < cap; ++steps) {
+                struct bucket *b = &buckets[i];
+                if (LOAD(&b->key) == k && LOAD(&b->ctrl) != CTRL_EMPTY) {
+                        *out = LOAD(&b->val);
+                        return true;
+                }
+                uint16_t next = LOAD(&b->next);
+                if (next == 0) {
+                        return false;
+                }
+                i = (i + next) % cap;
+        }
+        return false;
+}
+
+bool cjtable_lookup(cjtable *self, keyint_t k, valint_t *out)
+{
+        struct cjtable_stripe *s = cjtable_stripe_of(self, k);
+        unsigned spins = 0;
+        while (true) {
+                unsigned seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+                if (seq & 1) {
+                        cpu_relax(&spins);
+                        continue;
+                }
+                struct bucket *buckets = LOAD(&s->tbl.buckets);
+                size_t cap = LOAD(&s->tbl.cap);
+                // Make sure `buckets` and `cap` belong together before walking.
+                // Arrays are never freed under us, so from here on the walk is
+                // memory-safe even if a writer starts.
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (LOAD(&s->seq) != seq) {
+                        continue;
+                }
+                valint_t v;
+                bool found = cjtable_probe(buckets, cap, k, &v);
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (LOAD(&s->seq) == seq) {
+                        if (found) {
+                                *out = v;
+                        }
+                        return found;
+                }
+        }
+}
+
+/** Free the arrays `s` retired. Its lock is held, or nothing else runs. */
+static void stripe_reclaim(struct cjtable_stripe *s)
+{
+        jtable *it = dynarray_begin(&s->retired);
+        for (size_t j = 0; j < DYNARRAY_LENGTH(&s->retired, jtable); ++j) {
+                jtable_deinit(&it[j]);
+        }
+        dynarray_free(&s->retired);
+        s->retired = dynarray_new();
+}
+
+void cjtable_reclaim(cjtable *self)
+{
+        for (size_t i = 0; i < CJTABLE_STRIPES; ++i) {
+                struct cjtable_stripe *s = &self->stripes[i];
+                pthread_mutex_lock(&s->lock);
+                stripe_reclaim(s);
+                pthread_mutex_unlock(&s->lock);
+        }
+}
+
+void cjtable_deinit(cjtable *self)
+{
+        for (size_t i = 0; i < CJTABLE_STRIPES; ++i) {
+                struct cjtable_stripe *s = &self->stripes[i];
+                stripe_reclaim(s);
+                jtable_deinit(&s->tbl);
+                pthread_mutex_destroy(&s->lock);
+        }
+}
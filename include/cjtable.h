@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "./jtable.h"
+#include "./dynarray.h"
+
+/** Number of independently locked stripes. Must be a power of 2. */
+#define CJTABLE_STRIPES 64
+
+/**
+ * One independently locked part of a `cjtable`. Padded to a cache line so that
+ * writers on neighbouring stripes do not invalidate each other's readers.
+ */
+struct cjtable_stripe {
+        /** Serializes writers of this stripe */
+        pthread_mutex_t lock;
+        /** Seqlock counter: odd while a writer is mutating `tbl` */
+        unsigned seq;
+        jtable tbl;
+        /**
+         * Tables replaced by a resize, internal type `jtable`. Lock-free
+         * readers may still be walking them, so they are only freed by
+         * `cjtable_reclaim()` or `cjtable_deinit()`.
+         */
+        struct dynarray retired;
+} __attribute__((aligned(64)));
+
+/**
+ * A concurrent map with the same keys, values and probing scheme as `jtable`.
+ *
+ * Keys are spread over `CJTABLE_STRIPES` stripes, each a `jtable` of its own.
+ * Writers take the mutex of a single stripe, so writers on different stripes
+ * never contend. Readers take no lock and write no shared memory: they
+ * validate against the stripe's seqlock and retry if a writer got in the way,
+ * so read-mostly workloads scale with the number of reader threads.
+ *
+ * Growing a stripe is online: the larger bucket array is built while readers
+ * keep using the old one, and is then published with a single pointer swap.
+ * The old array is kept, since a reader may still be walking it, until
+ * `cjtable_reclaim()`. Each array is 4x the one before it, so those kept
+ * never add up to more than a third of the live ones: at most 4/3 of the
+ * memory the table has at its biggest. Stripes never shrink.
+ */
+typedef struct {
+        struct cjtable_stripe stripes[CJTABLE_STRIPES];
+} cjtable;
+
+void cjtable_init(cjtable *);
+
+/**
+ * Insert or update `k`. Safe to call concurrently with any other `cjtable_*`
+ * function except `cjtable_init()` and `cjtable_deinit()`.
+ */
+void cjtable_insert(cjtable *, keyint_t k, valint_t v);
+
+/**
+ * Remove `k` if it is present. Same thread-safety as `cjtable_insert()`.
+ */
+void cjtable_remove(cjtable *, keyint_t k);
+
+/**
+ * Lock-free lookup. Returns `true` and writes the value to `out` if `k` is
+ * present. A value is copied out rather than pointed to, because a pointer
+ * into the table would race with writers.
+ */
+bool cjtable_lookup(cjtable *, keyint_t k, valint_t *out);
+
+/**
+ * Free the bucket arrays replaced by growing. Only safe while no
+ * `cjtable_lookup()` is running, e.g. between phases of a workload, or from
+ * the only thread that looks keys up; inserts and removes may carry on.
+ */
+void cjtable_reclaim(cjtable *);
+
+void cjtable_deinit(cjtable *);
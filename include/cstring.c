@@ -2,12 +2,42 @@
 #include "./dynarray.h"
 #include "./type.h"
 #include "./panic.h"
+#include "./utf8.h"
 
 struct cstring cstring_new()
 {
         return cstring_is("");
 }
 
+struct cstring cstring_with_capacity(size_t cap)
+{
+        struct cstring s;
+        s.buf = dynarray_with_capacity(TYPEINFO(uint8_t), cap + 1);
+        *(uint8_t *)dynarray_next(&s.buf, TYPEINFO(uint8_t)) = '\0';
+        return s;
+}
+
+struct cstring cstring_new_inline(void *buf, size_t cap)
+{
+        struct cstring s;
+        s.buf = dynarray_new_inline(buf, cap);
+        *(uint8_t *)dynarray_next(&s.buf, TYPEINFO(uint8_t)) = '\0';
+        return s;
+}
+
+struct cstring cstring_new_with_allocator(struct allocator *alloc)
+{
+        struct cstring s;
+        s.buf = dynarray_new_with_allocator(alloc);
+        *(uint8_t *)dynarray_next(&s.buf, TYPEINFO(uint8_t)) = '\0';
+        return s;
+}
+
+struct cstring cstring_new_in(struct arena *arena)
+{
+        return cstring_new_with_allocator(&arena->allocator);
+}
+
 void cstring_free(struct cstring *restrict self)
 {
         dynarray_free(&self->buf);
@@ -15,9 +45,9 @@ void cstring_free(struct cstring *restrict self)
 
 struct cstring cstring_is(char const *cstr)
 {
-        struct cstring s;
-        s.buf = dynarray_new();
-        cstring_extend_cstr(&s, cstr);
+        size_t len = strlen(cstr);
+        struct cstring s = cstring_with_capacity(len);
+        cstring_extend(&s, (uint8_t const *)cstr, (uint8_t const *)cstr + len);
         return s;
 }
 
@@ -59,11 +89,27 @@ void cstring_push(struct cstring *restrict self, codepoint ch)
 {
         uint8_t out[4];
         size_t encoding_length = encode_utf8(out, ch);
-        dynarray_pop(&self->buf, TYPEINFO(uint8_t));
-        for (size_t i = 0; i < encoding_length; ++i) {
-                *(uint8_t *)dynarray_next(&self->buf, TYPEINFO(uint8_t)) = out[i];
-        }
-        *(uint8_t *)dynarray_next(&self->buf, TYPEINFO(uint8_t)) = 0x00;
+        cstring_extend(self, out, out + encoding_length);
+}
+
+struct cstring_builder cstring_begin(struct cstring *restrict s, size_t hint)
+{
+        struct cstring_builder b = { .buf = s->buf };
+        b.buf.len -= 1;
+        dynarray_reserve(&b.buf, TYPEINFO(uint8_t), hint + 1);
+        return b;
+}
+
+void cstring_append_codepoint(struct cstring_builder *restrict self, codepoint ch)
+{
+        uint8_t out[4];
+        cstring_append(self, out, encode_utf8(out, ch));
+}
+
+struct cstring cstring_finish(struct cstring_builder *restrict self)
+{
+        cstring_append(self, "", 1);
+        return (struct cstring){ .buf = self->buf };
 }
 
 void cstring_extend_cstr(struct cstring *restrict self, char const *cstr)
@@ -84,9 +130,13 @@ bool cstr_eq(char const *lhs, char const *rhs)
 
 void cstring_extend(struct cstring *restrict self, uint8_t const *begin, uint8_t const *end)
 {
-        dynarray_pop(&self->buf, TYPEINFO(uint8_t));
-        dynarray_extend(&self->buf, (void *)begin, (void *)end);
-        *(uint8_t *)dynarray_next(&self->buf, TYPEINFO(uint8_t)) = '\0';
+        // Write over the old null-byte, and append a new one
+        size_t n = end - begin;
+        dynarray_reserve(&self->buf, TYPEINFO(uint8_t), n);
+        uint8_t *dst = (uint8_t *)self->buf.data + self->buf.len - 1;
+        memcpy(dst, begin, n);
+        dst[n] = '\0';
+        self->buf.len += n;
 }
 
 uint8_t cstring_get(struct cstring const *self, size_t index)
@@ -101,12 +151,13 @@ char const *cstring_as_cstr(struct cstring const *self)
 
 str cstring_as_str(struct cstring const *self)
 {
-        return str_new(dynarray_begin(&self->buf), dynarray_end(&self->buf) - 1);
+        struct dynarray *buf = (struct dynarray *)&self->buf;
+        return str_new_unchecked(dynarray_begin(buf), (uint8_t *)dynarray_end(buf) - 1);
 }
 
 struct codepoints cstring_codepoints(struct cstring const *self)
 {
-        TODO();
+        return str_codepoints(cstring_as_str(self));
 }
 
 uint8_t *str_begin(str self)
@@ -124,28 +175,44 @@ uint8_t str_get(str self, size_t index)
         return *(uint8_t *)slice_get(self.sl, TYPEINFO(uint8_t), index);
 }
 
-str str_new(uint8_t *begin, uint8_t *end)
+str str_new_unchecked(uint8_t *begin, uint8_t *end)
 {
         return (str){
                 .sl =
                         (slice){
                                 .begin = begin,
-                                .end = end - 1,
+                                .end = end,
                         },
         };
 }
 
+str str_new(uint8_t *begin, uint8_t *end)
+{
+        if (!utf8_validate(begin, end - begin)) {
+                return str_new_unchecked(begin, begin);
+        }
+        return str_new_unchecked(begin, end);
+}
+
+size_t str_count(str self)
+{
+        return utf8_count(str_begin(self), str_length(self));
+}
+
 struct codepoints str_codepoints(str const self)
 {
-        TODO();
+        return (struct codepoints){ .iter = self.sl };
 }
 
 codepoint codepoints_next(struct codepoints *self)
 {
-        TODO();
+        uint8_t const *it = self->iter.begin;
+        codepoint ch = codepoint_new(utf8_decode(&it));
+        self->iter.begin = (void *)it;
+        return ch;
 }
 
 bool codepoints_has_next(struct codepoints *self)
 {
-        TODO();
+        return self->iter.begin != self->iter.end;
 }
\ No newline at end of file
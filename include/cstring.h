@@ -34,10 +34,9 @@ typedef struct {
  * should just use a `struct dynarray`.
  * 
  * Common convenience functions are ommitted on purpose, to indicate their 
- * performance cost. For example `.count()` is not present. This should be done
- * by creating a `codepoints` iterator and incrementing a counter yourself. 
- * If you don't want to do all that, you should probably just use a `struct
- * dynarray`.
+ * performance cost. The exception is `str_count()`, which is vectorized and
+ * so much cheaper than iterating. If you don't want to do all that, you should
+ * probably just use a `struct dynarray`.
  * 
  * Some terminology that is used throughout:
  * 
@@ -86,13 +85,22 @@ typedef struct {
  * suite is comprised of `*_codepoints()` `codepoints_has_next()` and 
  * `codepoints_next()`. 
  * 
- * This iterator is O(n) over the bytes. 
+ * This iterator is O(n) over the bytes. It decodes without checking, which is
+ * fine because a `str` is valid utf8.
+ *
+ * # Example
+ *
+ * ```c
+ * struct codepoints it = cstring_codepoints(&s);
+ * while (codepoints_has_next(&it)) {
+ *         printf("U+%04X\n", codepoint_as_uint32(codepoints_next(&it)));
+ * }
+ * ```
  */
 struct codepoints {
         /**
-         * The slice we are iterating over. This slice should update the 
-         * `begin` field as the iteration progresses. Slice has internal type
-         * `codepoint`.
+         * The bytes we are iterating over. `begin` is advanced past each
+         * codepoint as the iteration progresses.
          */
         slice iter;
 };
@@ -122,6 +130,39 @@ static inline uint32_t codepoint_as_uint32(codepoint ch)
  */
 struct cstring cstring_new();
 
+/**
+ * Construct a new, empty `cstring` with room for `cap` bytes before it has to
+ * reallocate, not counting the null-byte.
+ */
+struct cstring cstring_with_capacity(size_t cap);
+
+/**
+ * Construct a new, empty `cstring` whose bytes live in `buf` until it outgrows
+ * `cap` bytes (including the null-byte). See `dynarray_new_inline()`, whose 
+ * safety requirements apply here too.
+ */
+struct cstring cstring_new_inline(void *buf, size_t cap);
+
+/**
+ * Construct a new, empty `cstring` whose storage comes from `alloc`. See
+ * `struct allocator`.
+ */
+struct cstring cstring_new_with_allocator(struct allocator *alloc);
+
+/**
+ * Construct a new, empty `cstring` that allocates from `arena`. See 
+ * `dynarray_new_in()`.
+ */
+struct cstring cstring_new_in(struct arena *arena);
+
+/**
+ * Declare a `struct cstring` called `name` with `N` bytes of inline storage on
+ * the stack. See `DYNARRAY_INLINE()`.
+ */
+#define CSTRING_INLINE(name, N)                              \
+        _Alignas(max_align_t) uint8_t name##_storage[N];     \
+        struct cstring name = cstring_new_inline(name##_storage, N)
+
 /**
  * Free this `cstring`, invalidating it for any future use.
  */
@@ -164,6 +205,73 @@ void cstring_extend_cstr(struct cstring *self, char const *cstr);
  */
 void cstring_extend(struct cstring *self, uint8_t const *begin, uint8_t const *end);
 
+/**
+ * A `cstring` being built from many fragments. Appending to a `cstring` keeps
+ * it null-terminated after every call, which costs a pop, a push and an extra
+ * capacity check per fragment. A builder drops the null-byte for the duration:
+ * each append is one capacity check and one `memcpy()`, and the terminator is
+ * written once by `cstring_finish()`.
+ *
+ * Reserving up front with the `hint` of `cstring_begin()` brings that down to
+ * a branch that is never taken.
+ *
+ * # Example
+ *
+ * ```c
+ * CSTRING_INLINE(line, 256);
+ * struct cstring_builder b = cstring_begin(&line, strlen(name) + strlen(msg) + 3);
+ * cstring_append_cstr(&b, name);
+ * cstring_append_cstr(&b, ": ");
+ * cstring_append_cstr(&b, msg);
+ * cstring_append(&b, "\n", 1);
+ * line = cstring_finish(&b);
+ * ```
+ */
+struct cstring_builder {
+        /** Internal type `char`. Not null-terminated. */
+        struct dynarray buf;
+};
+
+/**
+ * Start appending to `s`, with room for at least `hint` more bytes. `s` is
+ * moved into the builder, and must not be used until it is given back by
+ * `cstring_finish()`.
+ */
+struct cstring_builder cstring_begin(struct cstring *s, size_t hint);
+
+/**
+ * Append `n` bytes.
+ *
+ * # Safety
+ * - Must be valid utf8, once the whole string is built.
+ */
+static inline void cstring_append(struct cstring_builder *self, void const *bytes, size_t n)
+{
+        if (__builtin_expect(self->buf.cap - self->buf.len < n, 0)) {
+                dynarray_reserve(&self->buf, TYPEINFO(uint8_t), n);
+        }
+        memcpy((uint8_t *)self->buf.data + self->buf.len, bytes, n);
+        self->buf.len += n;
+}
+
+/**
+ * Append the bytes of a cstr. See `cstring_append()`.
+ */
+static inline void cstring_append_cstr(struct cstring_builder *self, char const *cstr)
+{
+        cstring_append(self, cstr, strlen(cstr));
+}
+
+/**
+ * Encode a `codepoint` as utf8 and append it.
+ */
+void cstring_append_codepoint(struct cstring_builder *self, codepoint ch);
+
+/**
+ * Null-terminate the built string and hand it back as a `cstring`.
+ */
+struct cstring cstring_finish(struct cstring_builder *self);
+
 /**
  * Get the byte at the specified index. This returns an actual byte because 
  * there's really no reason to be modifying this byte directly in most cases.
@@ -225,10 +333,23 @@ static inline size_t str_length(str const self)
 
 /**
  * Construct a str with a beginning and an end. Returns an empty slice if the
- * provided buffer is not utf8.
+ * provided buffer is not utf8. See `utf8_validate()`.
  */
 str str_new(uint8_t *begin, uint8_t *end);
 
+/**
+ * Construct a str with a beginning and an end, without validating it.
+ *
+ * # Safety
+ * - The buffer must be valid utf8.
+ */
+str str_new_unchecked(uint8_t *begin, uint8_t *end);
+
+/**
+ * The number of codepoints in this str. See `utf8_count()`.
+ */
+size_t str_count(str self);
+
 /**
  * Get an iterator over the codepoints in a str.
  */
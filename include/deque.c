@@ -0,0 +1,134 @@
+#include <string.h>
+
+#include "./deque.h"
+#include "./panic.h"
+
+#define DEQUE_MIN_CAP 8
+
+struct deque deque_new()
+{
+        return deque_new_with_allocator(&allocator_libc);
+}
+
+struct deque deque_new_with_allocator(struct allocator *alloc)
+{
+        struct deque q;
+        q.buf = dynarray_new_with_allocator(alloc);
+        q.head = 0;
+        q.len = 0;
+        q.mask = SIZE_MAX;
+        return q;
+}
+
+static inline void *deque_slot(struct deque *self, struct type val_type, size_t i)
+{
+        return (uint8_t *)self->buf.data + (i & self->mask) * val_type.size;
+}
+
+/** Largest power of 2 that is less than or equal to `n`, for `n > 0` */
+static inline size_t floorpow2(size_t n)
+{
+        return (size_t)1 << (sizeof(size_t) * 8 - 1 - __builtin_clzl(n));
+}
+
+/** Grow to a capacity of at least `cap` elements, keeping the order */
+static void deque_grow(struct deque *self, struct type val_type, size_t cap)
+{
+        size_t oldcap = self->mask + 1;
+        dynarray_reserve(&self->buf, val_type, cap);
+        self->mask = floorpow2(self->buf.cap / val_type.size) - 1;
+        // The elements that wrapped around to the start now belong after the
+        // old end. The new capacity is at least double, so they fit.
+        if (self->head + self->len > oldcap) {
+                size_t wrapped = self->head + self->len - oldcap;
+                uint8_t *data = self->buf.data;
+                memcpy(data + oldcap * val_type.size, data, wrapped * val_type.size);
+        }
+}
+
+void deque_reserve(struct deque *self, struct type val_type, size_t n)
+{
+        size_t cap = self->mask + 1;
+        if (cap - self->len >= n) {
+                return;
+        }
+        size_t newcap = cap ? cap : DEQUE_MIN_CAP;
+        while (newcap - self->len < n) {
+                newcap *= 2;
+        }
+        deque_grow(self, val_type, newcap);
+}
+
+void *deque_push_back(struct deque *self, struct type val_type)
+{
+        if (__builtin_expect(self->len == self->mask + 1, 0)) {
+                deque_grow(self, val_type, self->len ? self->len * 2 : DEQUE_MIN_CAP);
+        }
+        return deque_slot(self, val_type, self->head + self->len++);
+}
+
+void *deque_push_front(struct deque *self, struct type val_type)
+{
+        if (__builtin_expect(self->len == self->mask + 1, 0)) {
+                deque_grow(self, val_type, self->len ? self->len * 2 : DEQUE_MIN_CAP);
+        }
+        self->head = (self->head - 1) & self->mask;
+        self->len++;
+        return deque_slot(self, val_type, self->head);
+}
+
+void *deque_pop_front(struct deque *self, struct type val_type)
+{
+        if (self->len == 0) {
+                return NULL;
+        }
+        void *front = deque_slot(self, val_type, self->head);
+        self->head = (self->head + 1) & self->mask;
+        self->len--;
+        return front;
+}
+
+void *deque_pop_back(struct deque *self, struct type val_type)
+{
+        if (self->len == 0) {
+                return NULL;
+        }
+        return deque_slot(self, val_type, self->head + --self->len);
+}
+
+void *deque_get(struct deque *self, struct type val_type, size_t index)
+{
+        if (index >= self->len) {
+                PANIC("index out of bounds: the length is %zu but the index is %zu", self->len,
+                      index);
+        }
+        return deque_slot(self, val_type, self->head + index);
+}
+
+size_t deque_as_slices(struct deque *self, struct type val_type, slice out[2])
+{
+        if (self->len == 0) {
+                return 0;
+        }
+        uint8_t *data = self->buf.data;
+        size_t cap = self->mask + 1;
+        size_t first = cap - self->head < self->len ? cap - self->head : self->len;
+        out[0] = slice_new(data + self->head * val_type.size,
+                           data + (self->head + first) * val_type.size);
+        if (first == self->len) {
+                return 1;
+        }
+        out[1] = slice_new(data, data + (self->len - first) * val_type.size);
+        return 2;
+}
+
+void deque_clear(struct deque *self)
+{
+        self->head = 0;
+        self->len = 0;
+}
+
+void deque_free(struct deque *self)
+{
+        dynarray_free(&self->buf);
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "./type.h"
+#include "./slice.h"
+#include "./dynarray.h"
+#include "./allocator.h"
+
+/**
+ * A double-ended queue, as a power-of-two ring buffer over a `dynarray`'s
+ * storage. Like `dynarray`, a deque has an associated inner type that the
+ * user keeps track of and passes in as a `struct type`.
+ *
+ * Pushing and popping at either end is an add and a mask. Once a deque has
+ * grown to its working size it never allocates again, so it suits queues that
+ * fill and drain all the time, like outbound message queues.
+ *
+ * Growing reallocates the storage (so large deques `mremap()`, see
+ * `allocator_libc`) and then moves the wrapped-around prefix to the end of the
+ * old capacity, so the order of elements is kept.
+ *
+ * # Example
+ *
+ * ```c
+ * struct deque q = deque_new();
+ * DEQUE_PUSH_BACK(&q, int, 2);
+ * DEQUE_PUSH_BACK(&q, int, 3);
+ * DEQUE_PUSH_FRONT(&q, int, 1);
+ * while (deque_length(&q) != 0) {
+ *         printf("%d ", DEQUE_POP_FRONT(&q, int));
+ * }
+ * deque_free(&q);
+ * ```
+ *
+ * This outputs `1 2 3 `.
+ */
+struct deque {
+        /** Storage. `buf.len` is unused, capacity comes from `mask`. */
+        struct dynarray buf;
+        /** Index of the first element */
+        size_t head;
+        /** Length in elements */
+        size_t len;
+        /** Capacity in elements, minus one. `SIZE_MAX` while unallocated. */
+        size_t mask;
+};
+
+/**
+ * Initialize an empty deque. This does not allocate.
+ */
+struct deque deque_new();
+
+/**
+ * Initialize an empty deque whose storage comes from `alloc`. This does not
+ * allocate.
+ */
+struct deque deque_new_with_allocator(struct allocator *alloc);
+
+/**
+ * Return the number of elements in this deque.
+ */
+static inline size_t deque_length(struct deque const *self)
+{
+        return self->len;
+}
+
+/**
+ * Make room for at least `n` more elements, so that the next `n` pushes do
+ * not allocate.
+ */
+void deque_reserve(struct deque *self, struct type val_type, size_t n);
+
+/**
+ * Get a pointer to a new slot at the back of this deque.
+ *
+ * # Safety
+ * You must initialize the value at this pointer to a valid value for the
+ * inner type.
+ */
+void *deque_push_back(struct deque *self, struct type val_type);
+
+/**
+ * Get a pointer to a new slot at the front of this deque. See
+ * `deque_push_back()`.
+ */
+void *deque_push_front(struct deque *self, struct type val_type);
+
+/**
+ * Remove the front element. The returned pointer is valid for reads of the
+ * inner type until the next push, or `NULL` if the deque is empty.
+ */
+void *deque_pop_front(struct deque *self, struct type val_type);
+
+/**
+ * Remove the back element. See `deque_pop_front()`.
+ */
+void *deque_pop_back(struct deque *self, struct type val_type);
+
+/**
+ * Bounds-checked access to the `index`-th element from the front.
+ */
+void *deque_get(struct deque *self, struct type val_type, size_t index);
+
+/**
+ * View the contents of this deque as at most two contiguous slices, in
+ * order. Writes them to `out` and returns how many there are (`0` if the
+ * deque is empty), e.g. to build a `writev()` iovec of the bytes in a
+ * `deque[uint8_t]` without copying.
+ */
+size_t deque_as_slices(struct deque *self, struct type val_type, slice out[2]);
+
+/**
+ * Remove every element, keeping the storage.
+ */
+void deque_clear(struct deque *self);
+
+/**
+ * Free this deque, invalidating it for any future use.
+ */
+void deque_free(struct deque *self);
+
+/**
+ * Evil macro for pushing to the back. See `DYNARRAY_PUSH()`.
+ */
+#define DEQUE_PUSH_BACK(self, T, val) *(T *)deque_push_back(self, TYPEINFO(T)) = val
+
+/**
+ * Evil macro for pushing to the front. See `DYNARRAY_PUSH()`.
+ */
+#define DEQUE_PUSH_FRONT(self, T, val) *(T *)deque_push_front(self, TYPEINFO(T)) = val
+
+/**
+ * Evil macro for popping from the front. The deque must not be empty.
+ */
+#define DEQUE_POP_FRONT(self, T) *(T *)deque_pop_front(self, TYPEINFO(T))
+
+/**
+ * Evil macro for popping from the back. The deque must not be empty.
+ */
+#define DEQUE_POP_BACK(self, T) *(T *)deque_pop_back(self, TYPEINFO(T))
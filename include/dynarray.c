@@ -2,6 +2,8 @@
 #include "./panic.h"
 #include "./type.h"
 #include "./slice.h"
+#include "./allocator.h"
+#include "./arena.h"
 
 #define DYN_ARRAY_MIN_CAP 4
 
@@ -11,29 +13,61 @@ struct dynarray dynarray_new()
         arr.data = NULL;
         arr.cap = 0;
         arr.len = 0;
+        arr.inline_data = NULL;
+        arr.alloc = &allocator_libc;
         return arr;
 }
 
-void *dynarray_begin(struct dynarray *self)
+struct dynarray dynarray_new_with_allocator(struct allocator *alloc)
 {
-        return self->data;
+        struct dynarray arr = dynarray_new();
+        arr.alloc = alloc;
+        return arr;
 }
 
-void *dynarray_end(struct dynarray *self)
+struct dynarray dynarray_new_inline(void *buf, size_t cap)
 {
-        return &((uint8_t *)self->data)[self->len];
+        return dynarray_new_inline_in(buf, cap, NULL);
 }
 
-void dynarray_resize(struct dynarray *restrict self, struct type val_type)
+struct dynarray dynarray_new_in(struct arena *arena)
+{
+        return dynarray_new_with_allocator(&arena->allocator);
+}
+
+struct dynarray dynarray_new_inline_in(void *buf, size_t cap, struct arena *arena)
+{
+        struct dynarray arr;
+        arr.data = buf;
+        arr.cap = cap;
+        arr.len = 0;
+        arr.inline_data = buf;
+        arr.alloc = arena ? &arena->allocator : &allocator_libc;
+        return arr;
+}
+
+/** Whether `data` is still the caller-provided inline storage */
+static inline bool dynarray_is_inline(struct dynarray const *self)
+{
+        return self->inline_data != NULL && self->data == self->inline_data;
+}
+
+/**
+ * Move this array into a `newcap`-byte allocation from its allocator. Spilling
+ * out of inline storage copies, anything else is a `realloc`.
+ */
+static void dynarray_realloc(struct dynarray *restrict self, size_t newcap)
 {
         void *newdata;
-        size_t newcap;
-        if (self->cap > 0) {
-                newcap = self->cap * 2;
-                newdata = realloc(self->data, newcap);
+        if (self->cap == 0) {
+                newdata = allocator_alloc(self->alloc, newcap);
+        } else if (dynarray_is_inline(self)) {
+                newdata = allocator_alloc(self->alloc, newcap);
+                if (newdata != NULL) {
+                        memcpy(newdata, self->data, self->len);
+                }
         } else {
-                newcap = DYN_ARRAY_MIN_CAP * val_type.size;
-                newdata = malloc(newcap);
+                newdata = allocator_realloc(self->alloc, self->data, self->cap, newcap);
         }
         if (newdata == NULL) {
                 PANIC("malloc() returned NULL");
@@ -42,6 +76,34 @@ void dynarray_resize(struct dynarray *restrict self, struct type val_type)
         self->cap = newcap;
 }
 
+void *dynarray_begin(struct dynarray *self)
+{
+        return self->data;
+}
+
+void *dynarray_end(struct dynarray *self)
+{
+        return &((uint8_t *)self->data)[self->len];
+}
+
+struct dynarray dynarray_with_capacity(struct type val_type, size_t n)
+{
+        struct dynarray arr = dynarray_new();
+        if (n > 0) {
+                dynarray_realloc(&arr, n * val_type.size);
+        }
+        return arr;
+}
+
+void dynarray_resize(struct dynarray *restrict self, struct type val_type)
+{
+        if (self->cap > 0) {
+                dynarray_realloc(self, self->cap * 2);
+        } else {
+                dynarray_realloc(self, DYN_ARRAY_MIN_CAP * val_type.size);
+        }
+}
+
 /**
  * `__builtin_clz` or fallback implementation for `size_t` 
  */
@@ -77,18 +139,29 @@ size_t minpow2(size_t n)
 
 void dynarray_resize_to_fit(struct dynarray *restrict self, size_t additional)
 {
-        void *newdata;
-        size_t newcap = minpow2(self->cap + additional);
-        if (self->cap == 0) {
-                newdata = malloc(newcap);
-        } else {
-                newdata = realloc(self->data, newcap);
+        dynarray_realloc(self, minpow2(self->cap + additional));
+}
+
+void dynarray_reserve(struct dynarray *restrict self, struct type val_type, size_t n)
+{
+        size_t additional = n * val_type.size;
+        if (self->cap - self->len < additional) {
+                dynarray_resize_to_fit(self, self->len + additional - self->cap);
         }
-        if (newdata == NULL) {
-                PANIC("malloc() returned NULL");
+}
+
+void dynarray_shrink_to_fit(struct dynarray *restrict self)
+{
+        if (dynarray_is_inline(self) || self->cap == self->len) {
+                return;
         }
-        self->data = newdata;
-        self->cap = newcap;
+        if (self->len == 0) {
+                allocator_free(self->alloc, self->data, self->cap);
+                self->data = NULL;
+                self->cap = 0;
+                return;
+        }
+        dynarray_realloc(self, self->len);
 }
 
 void *dynarray_next_unchecked(struct dynarray *restrict self, struct type val_type)
@@ -138,8 +211,8 @@ void *dynarray_pop(struct dynarray *restrict self, struct type val_type)
 
 void dynarray_free(struct dynarray *restrict self)
 {
-        if (self->data != NULL) {
-                free(self->data);
+        if (self->data != NULL && !dynarray_is_inline(self)) {
+                allocator_free(self->alloc, self->data, self->cap);
         }
 }
 
@@ -12,6 +12,9 @@
 
 #include "./type.h"
 #include "./slice.h"
+#include "./allocator.h"
+#include "./arena.h"
+#include "./panic.h"
 
 /**
  * A dynamic, exponentially growing array. Each array has an associate type, for
@@ -58,15 +61,86 @@ struct dynarray {
         size_t cap;
         /** length in bytes */
         size_t len;
+        /** 
+         * Caller-provided storage this array started out in, or `NULL`. See
+         * `dynarray_new_inline()`. While `data` points here it is never passed
+         * to `realloc()` or `free()`.
+         */
+        void *inline_data;
+        /** Where the heap storage comes from. See `struct allocator`. */
+        struct allocator *alloc;
 };
 
 #define DYN_ARRAY_MIN_CAP 4
 
 /**
- * Initialize an empty `dynarray`. This does not allocate.
+ * Initialize an empty `dynarray`, allocating from `allocator_libc`. This does 
+ * not allocate.
  */
 struct dynarray dynarray_new();
 
+/**
+ * Initialize an empty `dynarray` that stores its first `cap` bytes in `buf`,
+ * and only spills to the heap once it outgrows them. Apart from that, this is
+ * an ordinary `dynarray`: every `dynarray_*()` function works on it, and it
+ * must still be `dynarray_free()`d in case it spilled.
+ * 
+ * # Safety
+ * - `buf` must outlive the array, so an array with stack storage must not be
+ *   returned from the function that owns the storage.
+ * - `buf` must be aligned for the inner type.
+ * 
+ * Prefer `DYNARRAY_INLINE()` for stack storage.
+ */
+struct dynarray dynarray_new_inline(void *buf, size_t cap);
+
+/**
+ * Initialize an empty `dynarray` with room for exactly `n` elements of
+ * `val_type`, so that the first `n` pushes do not reallocate.
+ */
+struct dynarray dynarray_with_capacity(struct type val_type, size_t n);
+
+/**
+ * Initialize an empty `dynarray` whose storage comes from `alloc` rather than
+ * `allocator_libc`. This does not allocate.
+ */
+struct dynarray dynarray_new_with_allocator(struct allocator *alloc);
+
+/**
+ * Initialize an empty `dynarray` that allocates from `arena` instead of the
+ * heap. Growing bumps the arena (in place, if nothing else was allocated from
+ * it since), and `dynarray_free()` is a no-op: the memory is reclaimed when the
+ * arena is reset. The array must not be used after that.
+ */
+struct dynarray dynarray_new_in(struct arena *arena);
+
+/**
+ * `dynarray_new_inline()` that spills into `arena` rather than the heap.
+ */
+struct dynarray dynarray_new_inline_in(void *buf, size_t cap, struct arena *arena);
+
+/**
+ * Declare a `struct dynarray` called `name` with `N` bytes of inline storage
+ * on the stack. For example, this allocates nothing unless more than 64 bytes
+ * are pushed:
+ * 
+ ```c
+ DYNARRAY_INLINE(line, 64);
+ dynarray_extend(&line, &buf[0], &buf[n]);
+ dynarray_free(&line);
+ ```
+ */
+#define DYNARRAY_INLINE(name, N)                             \
+        _Alignas(max_align_t) uint8_t name##_storage[N];     \
+        struct dynarray name = dynarray_new_inline(name##_storage, N)
+
+/**
+ * `DYNARRAY_INLINE()` that spills into `arena` rather than the heap.
+ */
+#define DYNARRAY_INLINE_IN(name, N, arena)                   \
+        _Alignas(max_align_t) uint8_t name##_storage[N];     \
+        struct dynarray name = dynarray_new_inline_in(name##_storage, N, arena)
+
 /**
  * Return a pointer to the start of this array. This pointer is valid for casts
  * to a pointer to the inner type. And the resulting pointer is valid for reads
@@ -101,6 +175,19 @@ void dynarray_resize(struct dynarray *self, struct type val_type);
  */
 void dynarray_resize_to_fit(struct dynarray *self, size_t additional);
 
+/**
+ * Make room for at least `n` more elements of `val_type`, so that the next `n`
+ * pushes do not reallocate. Use this when the final size is known up front,
+ * e.g. when replaying a backlog.
+ */
+void dynarray_reserve(struct dynarray *self, struct type val_type, size_t n);
+
+/**
+ * Shrink the allocation to exactly the length of this array, freeing it if
+ * the array is empty. Arrays in their inline storage are left alone.
+ */
+void dynarray_shrink_to_fit(struct dynarray *self);
+
 /**
  * Get an aligned pointer to the next element in the dynamic array. Subsequent
  * calls to this function will increment the returned pointer as well as the
@@ -276,3 +363,97 @@ bool dynarray_memeq(struct dynarray const *lhs, struct dynarray const *rhs);
                 dynarray_extend(&__this, &__arr[0], &__arr[sizeof(__arr) / sizeof(T)]); \
                 __this;                                                                 \
         })
+
+/**
+ * Generate typed, `static inline` accessors for a `struct dynarray` of `T`,
+ * prefixed with `NAME`. The generic API takes a `struct type` and goes through
+ * out-of-line functions, so the element size is a runtime value at every call.
+ * Here it is `sizeof(T)`, so lengths and offsets fold into shifts and
+ * constants, and the fast path of a push is a compare, a store and an add.
+ *
+ * - `NAME_push(self, val)`
+ * - `NAME_pop(self)`: pointer to the popped element, or `NULL` if empty
+ * - `NAME_get(self, index)`: negative indices count from the end, like
+ *   `dynarray_get()`
+ * - `NAME_extend(self, vals, n)`: append `n` elements
+ * - `NAME_reserve(self, n)`: make room for at least `n` more elements
+ * - `NAME_length(self)`
+ *
+ * The arrays are ordinary `struct dynarray`s, so they can still be passed to
+ * the generic functions. `NAME_get()` panics on an out of bounds index unless
+ * `NDEBUG` is defined, in which case the check is compiled out.
+ *
+ * # Example
+ *
+ * ```c
+ * DYNARRAY_DEFINE(int_vec, int)
+ *
+ * struct dynarray arr = dynarray_new();
+ * int_vec_push(&arr, 1);
+ * int_vec_push(&arr, 2);
+ * *int_vec_get(&arr, -1) += 40; // [1, 42]
+ * ```
+ */
+#define DYNARRAY_DEFINE(NAME, T)                                                            \
+        static inline size_t NAME##_length(struct dynarray const *self)                     \
+        {                                                                                   \
+                return self->len / sizeof(T);                                               \
+        }                                                                                   \
+                                                                                            \
+        static inline void NAME##_reserve(struct dynarray *self, size_t n)                  \
+        {                                                                                   \
+                if (self->cap - self->len < n * sizeof(T)) {                                \
+                        dynarray_reserve(self, TYPEINFO(T), n);                             \
+                }                                                                           \
+        }                                                                                   \
+                                                                                            \
+        static inline void NAME##_push(struct dynarray *self, T val)                        \
+        {                                                                                   \
+                if (__builtin_expect(self->cap - self->len < sizeof(T), 0)) {               \
+                        dynarray_resize(self, TYPEINFO(T));                                 \
+                }                                                                           \
+                *(T *)((uint8_t *)self->data + self->len) = val;                            \
+                self->len += sizeof(T);                                                     \
+        }                                                                                   \
+                                                                                            \
+        static inline T *NAME##_pop(struct dynarray *self)                                  \
+        {                                                                                   \
+                if (self->len == 0) {                                                       \
+                        return NULL;                                                        \
+                }                                                                           \
+                self->len -= sizeof(T);                                                     \
+                return (T *)((uint8_t *)self->data + self->len);                            \
+        }                                                                                   \
+                                                                                            \
+        static inline T *NAME##_get(struct dynarray *self, ssize_t index)                   \
+        {                                                                                   \
+                size_t len = NAME##_length(self);                                           \
+                if (index < 0) {                                                            \
+                        index += (ssize_t)len;                                              \
+                }                                                                           \
+                DYNARRAY_BOUNDS_CHECK(index, len);                                          \
+                return (T *)self->data + index;                                             \
+        }                                                                                   \
+                                                                                            \
+        static inline void NAME##_extend(struct dynarray *self, T const *vals, size_t n)    \
+        {                                                                                   \
+                if (n == 0) {                                                               \
+                        return;                                                             \
+                }                                                                           \
+                NAME##_reserve(self, n);                                                    \
+                memcpy((uint8_t *)self->data + self->len, vals, n * sizeof(T));             \
+                self->len += n * sizeof(T);                                                 \
+        }
+
+#ifdef NDEBUG
+#define DYNARRAY_BOUNDS_CHECK(index, len) ((void)0)
+#else
+/** Used by `DYNARRAY_DEFINE()`. Compiled out under `NDEBUG`. */
+#define DYNARRAY_BOUNDS_CHECK(index, len)                                                     \
+        do {                                                                                  \
+                if ((size_t)(index) >= (len)) {                                               \
+                        PANIC("index out of bounds: the length is %zu but the index is %zd", \
+                              (size_t)(len), (ssize_t)(index));                               \
+                }                                                                             \
+        } while (0)
+#endif
@@ -1,58 +1,570 @@
 #include "./fmt.h"
+#include "./ryu.h"
 
-/** Overestimate the buffer size we need */
-#define BUF_SIZE_FOR(INT) (3 * sizeof(INT) + 1)
+_Static_assert(sizeof(uintmax_t) == sizeof(uint64_t), "kernels format at most 64 bits");
 
-#define DEFINE_FMT_INTEGRAL(FN_NAME, INT, SPEC)                                 \
+static char const DIGIT_PAIRS[200] = "00010203040506070809"
+                                     "10111213141516171819"
+                                     "20212223242526272829"
+                                     "30313233343536373839"
+                                     "40414243444546474849"
+                                     "50515253545556575859"
+                                     "60616263646566676869"
+                                     "70717273747576777879"
+                                     "80818283848586878889"
+                                     "90919293949596979899";
+
+static uint64_t const POW10[20] = {
+        1ull,
+        10ull,
+        100ull,
+        1000ull,
+        10000ull,
+        100000ull,
+        1000000ull,
+        10000000ull,
+        100000000ull,
+        1000000000ull,
+        10000000000ull,
+        100000000000ull,
+        1000000000000ull,
+        10000000000000ull,
+        100000000000000ull,
+        1000000000000000ull,
+        10000000000000000ull,
+        100000000000000000ull,
+        1000000000000000000ull,
+        10000000000000000000ull,
+};
+
+/** Number of significant bits in `v`, counting `0` as having one */
+static inline unsigned bit_width(uint64_t v)
+{
+        return 64 - __builtin_clzll(v | 1);
+}
+
+size_t fmt_dec_digits(uint64_t v)
+{
+        // 1233 / 4096 is just above log10(2), so this is floor(log10(v)) or
+        // one more, which the table lookup corrects
+        unsigned t = (bit_width(v) * 1233) >> 12;
+        return t + 1 - ((v | 1) < POW10[t]);
+}
+
+/** Write exactly 8 digits, as two independent 4-digit halves */
+static inline void fmt_dec8(char *out, uint32_t v)
+{
+        uint32_t hi = v / 10000, lo = v % 10000;
+        memcpy(out, &DIGIT_PAIRS[(hi / 100) * 2], 2);
+        memcpy(out + 2, &DIGIT_PAIRS[(hi % 100) * 2], 2);
+        memcpy(out + 4, &DIGIT_PAIRS[(lo / 100) * 2], 2);
+        memcpy(out + 6, &DIGIT_PAIRS[(lo % 100) * 2], 2);
+}
+
+size_t fmt_u64_dec(char *out, uint64_t v)
+{
+        size_t len = fmt_dec_digits(v);
+        char *it = out + len;
+        // Peel off 8 digits at a time, so that the rest is 32-bit arithmetic
+        while (v >= 100000000) {
+                it -= 8;
+                fmt_dec8(it, (uint32_t)(v % 100000000));
+                v /= 100000000;
+        }
+        uint32_t w = (uint32_t)v;
+        while (w >= 100) {
+                it -= 2;
+                memcpy(it, &DIGIT_PAIRS[(w % 100) * 2], 2);
+                w /= 100;
+        }
+        if (w >= 10) {
+                memcpy(it - 2, &DIGIT_PAIRS[w * 2], 2);
+        } else {
+                it[-1] = (char)('0' + w);
+        }
+        return len;
+}
+
+size_t fmt_i64_dec(char *out, int64_t v)
+{
+        if (v < 0) {
+                *out = '-';
+                return 1 + fmt_u64_dec(out + 1, (uint64_t)0 - (uint64_t)v);
+        }
+        return fmt_u64_dec(out, (uint64_t)v);
+}
+
+size_t fmt_u64_hex(char *out, uint64_t v, bool upper)
+{
+        char const *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+        size_t len = (bit_width(v) + 3) / 4;
+        for (char *it = out + len; it != out; v >>= 4) {
+                *--it = digits[v & 0xf];
+        }
+        return len;
+}
+
+size_t fmt_u64_oct(char *out, uint64_t v)
+{
+        size_t len = (bit_width(v) + 2) / 3;
+        for (char *it = out + len; it != out; v >>= 3) {
+                *--it = (char)('0' + (v & 7));
+        }
+        return len;
+}
+
+char *fmt_reserve(struct cstring *f, size_t n)
+{
+        if (f->buf.cap - f->buf.len < n) {
+                dynarray_reserve(&f->buf, TYPEINFO(uint8_t), n);
+        }
+        return (char *)f->buf.data + f->buf.len - 1;
+}
+
+void fmt_commit(struct cstring *f, size_t n)
+{
+        f->buf.len += n;
+        ((char *)f->buf.data)[f->buf.len - 1] = '\0';
+}
+
+/** Write `e` as a printf-style exponent: `e`, a sign and at least 2 digits */
+static inline size_t fmt_exponent(char *out, int32_t e)
+{
+        out[0] = 'e';
+        out[1] = e < 0 ? '-' : '+';
+        uint32_t abs = e < 0 ? (uint32_t)-e : (uint32_t)e;
+        if (abs < 10) {
+                out[2] = '0';
+                out[3] = (char)('0' + abs);
+                return 4;
+        }
+        return 2 + fmt_u64_dec(out + 2, abs);
+}
+
+/** `inf`, `-inf` or `nan` if `v` is not finite, or `0` */
+static inline size_t fmt_nonfinite(char *out, double v)
+{
+        if (__builtin_isnan(v)) {
+                memcpy(out, "nan", 3);
+                return 3;
+        }
+        if (__builtin_isinf(v)) {
+                char *it = out;
+                if (v < 0) {
+                        *it++ = '-';
+                }
+                memcpy(it, "inf", 3);
+                return (size_t)(it - out) + 3;
+        }
+        return 0;
+}
+
+static inline size_t fmt_zero(char *out, bool negative)
+{
+        memcpy(out, "-0.0" + !negative, 4);
+        return 4 - !negative;
+}
+
+/** Lay out a shortest decimal, as described in fmt.h */
+static size_t fmt_shortest(char *out, bool negative, struct ryu_decimal d)
+{
+        char *it = out;
+        if (negative) {
+                *it++ = '-';
+        }
+        char digits[FMT_INTEGRAL_MAX];
+        size_t n = fmt_u64_dec(digits, d.mantissa);
+        // The value is 0.digits * 10^point
+        int32_t point = d.exponent + (int32_t)n;
+        if (point - 1 < -4 || point - 1 >= 16) {
+                *it++ = digits[0];
+                if (n > 1) {
+                        *it++ = '.';
+                        memcpy(it, digits + 1, n - 1);
+                        it += n - 1;
+                }
+                it += fmt_exponent(it, point - 1);
+        } else if (point <= 0) {
+                memcpy(it, "0.", 2);
+                memset(it + 2, '0', (size_t)-point);
+                it += 2 + (size_t)-point;
+                memcpy(it, digits, n);
+                it += n;
+        } else if ((size_t)point >= n) {
+                memcpy(it, digits, n);
+                memset(it + n, '0', (size_t)point - n);
+                it += point;
+                memcpy(it, ".0", 2);
+                it += 2;
+        } else {
+                memcpy(it, digits, (size_t)point);
+                it[point] = '.';
+                memcpy(it + point + 1, digits + point, n - (size_t)point);
+                it += n + 1;
+        }
+        return (size_t)(it - out);
+}
+
+size_t fmt_f64_shortest(char *out, double v)
+{
+        size_t len = fmt_nonfinite(out, v);
+        if (len) {
+                return len;
+        }
+        bool negative = __builtin_signbit(v);
+        if (v == 0) {
+                return fmt_zero(out, negative);
+        }
+        return fmt_shortest(out, negative, ryu_d2d(v));
+}
+
+size_t fmt_f32_shortest(char *out, float v)
+{
+        size_t len = fmt_nonfinite(out, v);
+        if (len) {
+                return len;
+        }
+        bool negative = __builtin_signbit(v);
+        if (v == 0) {
+                return fmt_zero(out, negative);
+        }
+        return fmt_shortest(out, negative, ryu_f2d(v));
+}
+
+/*
+ * Each formatter reserves for the longest possible output, writes straight
+ * over the null-byte with a kernel and terminates once.
+ */
+
+#define DEFINE_FMT_SIGNED(FN_NAME, INT)                                         \
+        void FN_NAME(struct cstring *restrict f, INT const *value)              \
+        {                                                                       \
+                char *out = fmt_reserve(f, FMT_INTEGRAL_MAX);                   \
+                fmt_commit(f, fmt_i64_dec(out, (int64_t)*value));               \
+        }
+
+#define DEFINE_FMT_UNSIGNED(FN_NAME, INT)                                       \
+        void FN_NAME(struct cstring *restrict f, INT const *value)              \
+        {                                                                       \
+                char *out = fmt_reserve(f, FMT_INTEGRAL_MAX);                   \
+                fmt_commit(f, fmt_u64_dec(out, (uint64_t)*value));              \
+        }
+
+/** `UINT` is the unsigned type of the same width, which printf would use */
+#define DEFINE_FMT_HEX(FN_NAME, INT, UINT, UPPER)                               \
+        void FN_NAME(struct cstring *restrict f, INT const *value)              \
+        {                                                                       \
+                char *out = fmt_reserve(f, FMT_INTEGRAL_MAX);                   \
+                fmt_commit(f, fmt_u64_hex(out, (uint64_t)(UINT)*value, UPPER)); \
+        }
+
+#define DEFINE_FMT_OCT(FN_NAME, INT)                                            \
         void FN_NAME(struct cstring *restrict f, INT const *value)              \
         {                                                                       \
-                char buf[BUF_SIZE_FOR(INT)];                                    \
-                int buflen;                                                     \
-                snprintf(buf, BUF_SIZE_FOR(INT), SPEC "%n", *value, &buflen);   \
-                cstring_extend(f, (uint8_t *)&buf[0], (uint8_t *)&buf[buflen]); \
+                char *out = fmt_reserve(f, FMT_INTEGRAL_MAX);                   \
+                fmt_commit(f, fmt_u64_oct(out, (uint64_t)*value));              \
+        }
+
+DEFINE_FMT_SIGNED(fmt_char, char)
+DEFINE_FMT_UNSIGNED(fmt_uchar, unsigned char)
+DEFINE_FMT_HEX(fmt_uchar_hex, unsigned char, unsigned char, false)
+
+DEFINE_FMT_SIGNED(fmt_int, int)
+
+DEFINE_FMT_UNSIGNED(fmt_uint, unsigned int)
+DEFINE_FMT_OCT(fmt_uint_oct, unsigned int)
+DEFINE_FMT_HEX(fmt_uint_hex, unsigned int, unsigned int, false)
+DEFINE_FMT_HEX(fmt_uint_uhex, unsigned int, unsigned int, true)
+
+DEFINE_FMT_SIGNED(fmt_lint, long int)
+
+DEFINE_FMT_UNSIGNED(fmt_ulint, unsigned long int)
+DEFINE_FMT_OCT(fmt_ulint_oct, unsigned long int)
+DEFINE_FMT_HEX(fmt_ulint_hex, unsigned long int, unsigned long int, false)
+DEFINE_FMT_HEX(fmt_ulint_uhex, unsigned long int, unsigned long int, true)
+
+DEFINE_FMT_SIGNED(fmt_llint, long long int)
+
+DEFINE_FMT_UNSIGNED(fmt_ullint, unsigned long long int)
+DEFINE_FMT_OCT(fmt_ullint_oct, unsigned long long int)
+DEFINE_FMT_HEX(fmt_ullint_hex, unsigned long long int, unsigned long long int, false)
+DEFINE_FMT_HEX(fmt_ullint_uhex, unsigned long long int, unsigned long long int, true)
+
+DEFINE_FMT_UNSIGNED(fmt_size, size_t)
+DEFINE_FMT_HEX(fmt_size_hex, size_t, size_t, false)
+DEFINE_FMT_HEX(fmt_size_uhex, size_t, size_t, true)
+
+DEFINE_FMT_SIGNED(fmt_ptrdiff, ptrdiff_t)
+DEFINE_FMT_HEX(fmt_ptrdiff_hex, ptrdiff_t, size_t, false)
+DEFINE_FMT_HEX(fmt_ptrdiff_uhex, ptrdiff_t, size_t, true)
+
+DEFINE_FMT_SIGNED(fmt_intmax, intmax_t)
+DEFINE_FMT_HEX(fmt_intmax_hex, intmax_t, uintmax_t, false)
+DEFINE_FMT_HEX(fmt_intmax_uhex, intmax_t, uintmax_t, true)
+
+DEFINE_FMT_UNSIGNED(fmt_uintmax, uintmax_t)
+DEFINE_FMT_OCT(fmt_uintmax_oct, uintmax_t)
+DEFINE_FMT_HEX(fmt_uintmax_hex, uintmax_t, uintmax_t, false)
+DEFINE_FMT_HEX(fmt_uintmax_uhex, uintmax_t, uintmax_t, true)
+
+void fmt_double(struct cstring *restrict f, double const *value)
+{
+        char *out = fmt_reserve(f, FMT_FLOAT_MAX);
+        fmt_commit(f, fmt_f64_shortest(out, *value));
+}
+
+void fmt_float(struct cstring *restrict f, float const *value)
+{
+        char *out = fmt_reserve(f, FMT_FLOAT_MAX);
+        fmt_commit(f, fmt_f32_shortest(out, *value));
+}
+
+/*
+ * `fmt_double_fixed()` and `fmt_double_sci()` round from the exact decimal
+ * expansion of the value, which always exists since 2^-n = 5^n / 10^n: a
+ * double is `m2 * 2^e2`, which is the integer `m2 * 2^e2` for `e2 >= 0`, or
+ * the integer `m2 * 5^-e2` divided by `10^-e2`. That integer has at most 767
+ * digits (for the smallest subnormals), and is built up in base 2^32.
+ */
+
+/** Enough 32-bit limbs for `2^53 * 5^1074` */
+#define FMT_BIG_LIMBS 80
+/** Digits in `2^53 * 5^1074` */
+#define FMT_EXACT_DIGITS 767
+
+struct fmt_big {
+        uint32_t limbs[FMT_BIG_LIMBS];
+        size_t len;
+};
+
+static void fmt_big_mul(struct fmt_big *self, uint32_t m)
+{
+        uint64_t carry = 0;
+        for (size_t i = 0; i < self->len; ++i) {
+                carry += (uint64_t)self->limbs[i] * m;
+                self->limbs[i] = (uint32_t)carry;
+                carry >>= 32;
+        }
+        if (carry) {
+                self->limbs[self->len++] = (uint32_t)carry;
+        }
+}
+
+static void fmt_big_shl(struct fmt_big *self, unsigned bits)
+{
+        size_t words = bits / 32;
+        bits %= 32;
+        self->limbs[self->len] = 0;
+        for (size_t i = self->len + 1; i-- > 0;) {
+                uint32_t lo = i ? self->limbs[i - 1] : 0;
+                uint32_t hi = self->limbs[i];
+                self->limbs[i + words] = bits ? hi << bits | lo >> (32 - bits) : hi;
+        }
+        memset(self->limbs, 0, words * sizeof(uint32_t));
+        self->len += words + 1;
+        while (self->limbs[self->len - 1] == 0) {
+                self->len--;
+        }
+}
+
+/** Divide by `d`, returning the remainder */
+static uint32_t fmt_big_div(struct fmt_big *self, uint32_t d)
+{
+        uint64_t rem = 0;
+        for (size_t i = self->len; i-- > 0;) {
+                rem = rem << 32 | self->limbs[i];
+                self->limbs[i] = (uint32_t)(rem / d);
+                rem %= d;
         }
+        while (self->len && self->limbs[self->len - 1] == 0) {
+                self->len--;
+        }
+        return (uint32_t)rem;
+}
+
+/**
+ * Write the digits of finite, non-zero `|v|` to `out`, without leading zeros,
+ * and return how many there are. `v` is `0.digits * 10^*point`.
+ */
+static size_t fmt_exact_digits(char *out, double v, int32_t *point)
+{
+        uint64_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        uint64_t mantissa = bits & ((1ull << 52) - 1);
+        int32_t exponent = (int32_t)((bits >> 52) & 0x7ff);
+        uint64_t m2 = exponent ? mantissa | 1ull << 52 : mantissa;
+        int32_t e2 = (exponent ? exponent : 1) - 1023 - 52;
 
-DEFINE_FMT_INTEGRAL(fmt_char, char, "%d")
-DEFINE_FMT_INTEGRAL(fmt_uchar, unsigned char, "%u")
-DEFINE_FMT_INTEGRAL(fmt_uchar_hex, unsigned char, "%x")
+        struct fmt_big big = { .limbs = { (uint32_t)m2, (uint32_t)(m2 >> 32) } };
+        big.len = big.limbs[1] ? 2 : 1;
+        int32_t scale = 0;
+        if (e2 >= 0) {
+                fmt_big_shl(&big, (unsigned)e2);
+        } else {
+                // 5^13 is the largest power of 5 that fits in a limb
+                scale = -e2;
+                for (; e2 <= -13; e2 += 13) {
+                        fmt_big_mul(&big, 1220703125);
+                }
+                // and 10^k >> k is 5^k
+                fmt_big_mul(&big, (uint32_t)(POW10[-e2] >> -e2));
+        }
 
-DEFINE_FMT_INTEGRAL(fmt_int, int, "%d")
+        // Take 9 digits at a time from the bottom, then write them out from
+        // the top
+        uint32_t chunks[(FMT_EXACT_DIGITS + 8) / 9];
+        size_t nchunks = 0;
+        while (big.len) {
+                chunks[nchunks++] = fmt_big_div(&big, 1000000000);
+        }
+        size_t len = fmt_u64_dec(out, chunks[--nchunks]);
+        while (nchunks) {
+                uint32_t chunk = chunks[--nchunks];
+                out[len] = (char)('0' + chunk / 100000000);
+                fmt_dec8(out + len + 1, chunk % 100000000);
+                len += 9;
+        }
+        *point = (int32_t)len - scale;
+        return len;
+}
 
-DEFINE_FMT_INTEGRAL(fmt_uint, unsigned int, "%u")
-DEFINE_FMT_INTEGRAL(fmt_uint_oct, unsigned int, "%o")
-DEFINE_FMT_INTEGRAL(fmt_uint_hex, unsigned int, "%x")
-DEFINE_FMT_INTEGRAL(fmt_uint_uhex, unsigned int, "%X")
+/**
+ * Round the digits `0.digits * 10^*point` to the first `keep` of them, half
+ * to even, and return how many digits are left. `keep` can be out of range
+ * either way. Carrying out of the first digit (`0.99` to `1.0`) bumps
+ * `*point`, and leaves `keep + 1` digits.
+ */
+static size_t fmt_round_digits(char *digits, size_t len, ptrdiff_t keep, int32_t *point)
+{
+        if (keep < 0) {
+                return 0;
+        }
+        if ((size_t)keep >= len) {
+                return len;
+        }
+        char next = digits[keep];
+        bool up = next > '5';
+        if (next == '5') {
+                // Anything after the 5 means we are above half-way
+                up = keep > 0 && (digits[keep - 1] - '0') % 2 == 1;
+                for (size_t i = (size_t)keep + 1; i < len; ++i) {
+                        if (digits[i] != '0') {
+                                up = true;
+                                break;
+                        }
+                }
+        }
+        if (!up) {
+                return (size_t)keep;
+        }
+        size_t i = (size_t)keep;
+        while (i > 0 && digits[i - 1] == '9') {
+                digits[--i] = '0';
+        }
+        if (i == 0) {
+                digits[0] = '1';
+                memset(digits + 1, '0', (size_t)keep);
+                ++*point;
+                return (size_t)keep + 1;
+        }
+        digits[i - 1]++;
+        return (size_t)keep;
+}
+
+void fmt_double_fixed(struct cstring *restrict f, double value, unsigned precision)
+{
+        char *out = fmt_reserve(f, FMT_FLOAT_MAX);
+        size_t len = fmt_nonfinite(out, value);
+        if (len) {
+                fmt_commit(f, len);
+                return;
+        }
+        char digits[FMT_EXACT_DIGITS + 1];
+        int32_t point = 0;
+        size_t ndigits = 0;
+        if (value != 0) {
+                ndigits = fmt_exact_digits(digits, value, &point);
+                ndigits = fmt_round_digits(digits, ndigits, (ptrdiff_t)point + precision,
+                                           &point);
+        }
 
-DEFINE_FMT_INTEGRAL(fmt_lint, long int, "%ld")
+        size_t whole = point > 0 ? (size_t)point : 1;
+        out = fmt_reserve(f, 1 + whole + 1 + precision);
+        char *it = out;
+        if (__builtin_signbit(value)) {
+                *it++ = '-';
+        }
+        // Digits outside of [0, ndigits) are zeros
+        for (int32_t i = point > 0 ? 0 : point - 1; i < point; ++i) {
+                *it++ = i >= 0 && (size_t)i < ndigits ? digits[i] : '0';
+        }
+        if (precision) {
+                *it++ = '.';
+                for (int32_t i = point; i < point + (int32_t)precision; ++i) {
+                        *it++ = i >= 0 && (size_t)i < ndigits ? digits[i] : '0';
+                }
+        }
+        fmt_commit(f, (size_t)(it - out));
+}
 
-DEFINE_FMT_INTEGRAL(fmt_ulint, unsigned long int, "%lu")
-DEFINE_FMT_INTEGRAL(fmt_ulint_oct, unsigned long int, "%lo")
-DEFINE_FMT_INTEGRAL(fmt_ulint_hex, unsigned long int, "%lx")
-DEFINE_FMT_INTEGRAL(fmt_ulint_uhex, unsigned long int, "%lX")
+void fmt_double_sci(struct cstring *restrict f, double value, unsigned precision)
+{
+        char *out = fmt_reserve(f, FMT_FLOAT_MAX);
+        size_t len = fmt_nonfinite(out, value);
+        if (len) {
+                fmt_commit(f, len);
+                return;
+        }
+        char digits[FMT_EXACT_DIGITS + 1];
+        int32_t point = 1;
+        size_t ndigits = 0;
+        if (value != 0) {
+                ndigits = fmt_exact_digits(digits, value, &point);
+                ndigits = fmt_round_digits(digits, ndigits, (ptrdiff_t)precision + 1, &point);
+        }
 
-DEFINE_FMT_INTEGRAL(fmt_llint, long long int, "%lld")
+        out = fmt_reserve(f, 3 + precision + 5);
+        char *it = out;
+        if (__builtin_signbit(value)) {
+                *it++ = '-';
+        }
+        *it++ = ndigits ? digits[0] : '0';
+        if (precision) {
+                *it++ = '.';
+                for (size_t i = 1; i <= precision; ++i) {
+                        *it++ = i < ndigits ? digits[i] : '0';
+                }
+        }
+        it += fmt_exponent(it, point - 1);
+        fmt_commit(f, (size_t)(it - out));
+}
 
-DEFINE_FMT_INTEGRAL(fmt_ullint, unsigned long long int, "%llu")
-DEFINE_FMT_INTEGRAL(fmt_ullint_oct, unsigned long long int, "%llo")
-DEFINE_FMT_INTEGRAL(fmt_ullint_hex, unsigned long long int, "%llx")
-DEFINE_FMT_INTEGRAL(fmt_ullint_uhex, unsigned long long int, "%llX")
+void fmt_cstr(struct cstring *restrict f, char const *const *value)
+{
+        cstring_extend_cstr(f, *value);
+}
 
-DEFINE_FMT_INTEGRAL(fmt_size, size_t, "%zu")
-DEFINE_FMT_INTEGRAL(fmt_size_hex, size_t, "%zx")
-DEFINE_FMT_INTEGRAL(fmt_size_uhex, size_t, "%zX")
+void fmt_str(struct cstring *restrict f, str const *value)
+{
+        cstring_extend(f, str_begin(*value), str_end(*value));
+}
 
-DEFINE_FMT_INTEGRAL(fmt_ptrdiff, ptrdiff_t, "%td")
-DEFINE_FMT_INTEGRAL(fmt_ptrdiff_hex, ptrdiff_t, "%tx")
-DEFINE_FMT_INTEGRAL(fmt_ptrdiff_uhex, ptrdiff_t, "%tX")
+void fmt_rcstr(struct cstring *restrict f, struct rcstr *const *value)
+{
+        char const *s = rcstr_as_cstr(*value);
+        cstring_extend(f, (uint8_t const *)s, (uint8_t const *)s + rcstr_length(*value));
+}
 
-DEFINE_FMT_INTEGRAL(fmt_intmax, intmax_t, "%jd")
-DEFINE_FMT_INTEGRAL(fmt_intmax_hex, intmax_t, "%jx")
-DEFINE_FMT_INTEGRAL(fmt_intmax_uhex, intmax_t, "%jX")
+void fmt_cstring(struct cstring *restrict f, struct cstring const *const *value)
+{
+        char const *s = cstring_as_cstr(*value);
+        cstring_extend(f, (uint8_t const *)s, (uint8_t const *)s + (*value)->buf.len - 1);
+}
 
-DEFINE_FMT_INTEGRAL(fmt_uintmax, uintmax_t, "%ju")
-DEFINE_FMT_INTEGRAL(fmt_uintmax_oct, uintmax_t, "%jo")
-DEFINE_FMT_INTEGRAL(fmt_uintmax_hex, uintmax_t, "%jx")
-DEFINE_FMT_INTEGRAL(fmt_uintmax_uhex, uintmax_t, "%jX")
+void fmt_bool(struct cstring *restrict f, bool const *value)
+{
+        cstring_extend_cstr(f, *value ? "true" : "false");
+}
 
 void fmt_dynarray(struct cstring *restrict f, struct dynarray *arr, struct type ty,
                   formatter cb)
@@ -62,6 +574,7 @@ void fmt_dynarray(struct cstring *restrict f, struct dynarray *arr, struct type
 
         if (dynarray_length(arr, ty) == 0) {
                 cstring_extend_cstr(f, endch);
+                return;
         }
 
         char *it = dynarray_begin(arr);
@@ -4,6 +4,7 @@
 #include "./include/slice.h"
 #include "./include/type.h"
 #include "./include/cstring.h"
+#include "./include/rcstr.h"
 
 /**
  * A formatter is any function that can convert a value into a string without 
@@ -50,6 +51,63 @@
  */
 typedef void (*formatter)(struct cstring *restrict, void const *);
 
+/**
+ * Longest output of an integer formatter: 22 octal digits for 64 bits, or a
+ * sign and 20 decimal digits.
+ */
+#define FMT_INTEGRAL_MAX 22
+
+/*
+ * The kernels behind the integer formatters. They write the digits of `v` to
+ * `out`, which must have room for `FMT_INTEGRAL_MAX` bytes, and return how
+ * many were written. Nothing is null-terminated.
+ *
+ * Decimal output takes two digits at a time from a lookup table, and every
+ * kernel works out the length up front from the bit width of `v` (with
+ * `__builtin_clzll()`), so that it can write backwards from the end.
+ */
+
+/** Number of decimal digits in `v`. `0` has one. */
+size_t fmt_dec_digits(uint64_t v);
+size_t fmt_u64_dec(char *out, uint64_t v);
+size_t fmt_i64_dec(char *out, int64_t v);
+size_t fmt_u64_hex(char *out, uint64_t v, bool upper);
+size_t fmt_u64_oct(char *out, uint64_t v);
+
+/**
+ * Longest output of `fmt_f64_shortest()`: a sign, 17 digits, a point and a
+ * 5-character exponent.
+ */
+#define FMT_FLOAT_MAX 24
+
+/*
+ * The kernels behind `fmt_double()` and `fmt_float()`. They write the
+ * shortest decimal that reads back (with `strtod()` or `strtof()`) as exactly
+ * `v`, as found by `ryu_d2d()`, and return how many bytes that took. `out`
+ * must have room for `FMT_FLOAT_MAX` bytes, and nothing is null-terminated.
+ *
+ * The layout is that of Python's `repr()`: plain decimal when the exponent is
+ * in `[-4, 16)`, always with a point (`1.0`, `0.001`, `123.45`), and otherwise
+ * scientific, with at least two exponent digits (`1e+16`, `2.5e-07`).
+ * Infinities and NaNs are `inf`, `-inf` and `nan`.
+ */
+
+size_t fmt_f64_shortest(char *out, double v);
+size_t fmt_f32_shortest(char *out, float v);
+
+/**
+ * Make room for `n` more bytes in `f`, and return where they go. Write them
+ * and then call `fmt_commit()` with how many were actually used. This is how
+ * formatters write into the string without going through a buffer.
+ */
+char *fmt_reserve(struct cstring *f, size_t n);
+
+/**
+ * Take `n` bytes written after `fmt_reserve()` into the string, and
+ * null-terminate it.
+ */
+void fmt_commit(struct cstring *f, size_t n);
+
 #define DECLARE_FMT_INTEGRAL(FN_NAME, INT, SPEC) \
         void FN_NAME(struct cstring *restrict f, INT const *value);
 DECLARE_FMT_INTEGRAL(fmt_int, int, "%d")
@@ -94,6 +152,32 @@ DECLARE_FMT_INTEGRAL(fmt_uintmax_oct, uintmax_t, "%jo")
 DECLARE_FMT_INTEGRAL(fmt_uintmax_hex, uintmax_t, "%jx")
 DECLARE_FMT_INTEGRAL(fmt_uintmax_uhex, uintmax_t, "%jX")
 
+/**
+ * The shortest round-trip representation of a `double` (or `float`), see
+ * `fmt_f64_shortest()`. Unlike `%g`, no precision is lost, and unlike `%.17g`
+ * no noise digits are made up: `0.1` is `0.1`.
+ */
+void fmt_double(struct cstring *restrict f, double const *value);
+void fmt_float(struct cstring *restrict f, float const *value);
+
+/**
+ * `%.*f`: `value` with exactly `precision` digits after the point (and no
+ * point if that is `0`), rounded half-to-even from its exact binary value,
+ * like glibc. A `float` converts to `double` without loss, so use this for
+ * both.
+ *
+ * This works from the exact decimal expansion of `value`, which can run to
+ * hundreds of digits, so it is slower than `fmt_double()`. Use it when the
+ * number of digits matters more than round-tripping, e.g. in a table.
+ */
+void fmt_double_fixed(struct cstring *restrict f, double value, unsigned precision);
+
+/**
+ * `%.*e`: `value` as `d.ddde+XX`, with `precision` digits after the point,
+ * rounded like `fmt_double_fixed()`.
+ */
+void fmt_double_sci(struct cstring *restrict f, double value, unsigned precision);
+
 /**
  * Format a dynammic array with a callback. e.g.
  ```c
@@ -104,4 +188,193 @@ DECLARE_FMT_INTEGRAL(fmt_uintmax_uhex, uintmax_t, "%jX")
  { 1, 2, 3, 4 }
  ```
  */
-void fmt_dynarray(struct cstring *f, struct dynarray *arr, struct type ty, formatter cb);
\ No newline at end of file
+void fmt_dynarray(struct cstring *f, struct dynarray *arr, struct type ty, formatter cb);
+
+/*
+ * Formatters for the other types `FMT()` accepts. Strings are copied as they
+ * are.
+ */
+
+void fmt_cstr(struct cstring *restrict f, char const *const *value);
+void fmt_str(struct cstring *restrict f, str const *value);
+void fmt_rcstr(struct cstring *restrict f, struct rcstr *const *value);
+void fmt_cstring(struct cstring *restrict f, struct cstring const *const *value);
+/** `true` or `false` */
+void fmt_bool(struct cstring *restrict f, bool const *value);
+
+/**
+ * Append each argument to the `struct cstring *` `out`, formatted according
+ * to its type, which is picked at compile time with `_Generic`. Strings
+ * (`char *`, `str`, `struct rcstr *` and `struct cstring *`) are appended
+ * as-is, integers in decimal, floating point numbers with `fmt_double()` and
+ * `bool`s as `true` or `false`. Any other type is a compile error.
+ *
+ * There is no format string: literals are arguments like any other, so
+ * nothing is parsed at runtime. The output size is estimated from all the
+ * arguments first (string lengths, and `FMT_INTEGRAL_MAX` or `FMT_FLOAT_MAX`
+ * per number), and reserved in one go. Each argument is evaluated exactly
+ * once. At most 32 arguments are supported.
+ *
+ * # Example
+ *
+ * ```c
+ * struct cstring line = cstring_new();
+ * FMT(&line, name, " joined, ", nr_users, " online\n");
+ * ```
+ */
+#define FMT(out, ...)                                                          \
+        do {                                                                   \
+                struct cstring *fmt_out_ = (out);                              \
+                FMT_FOR_EACH(FMT_BIND_, __VA_ARGS__)                           \
+                fmt_reserve(fmt_out_, 0 FMT_FOR_EACH(FMT_HINT_, __VA_ARGS__)); \
+                FMT_FOR_EACH(FMT_WRITE_, __VA_ARGS__)                          \
+        } while (0)
+
+/** Upper bound on the bytes `FMT()` writes for `x` */
+#define FMT_HINT(x)                                       \
+        _Generic((x),                                     \
+                char *: fmt_hint_cstr,                    \
+                char const *: fmt_hint_cstr,              \
+                str: fmt_hint_str,                        \
+                struct rcstr *: fmt_hint_rcstr,           \
+                struct cstring *: fmt_hint_cstring,       \
+                struct cstring const *: fmt_hint_cstring, \
+                float: fmt_hint_float,                    \
+                double: fmt_hint_float,                   \
+                default: fmt_hint_integral)(x)
+
+/** The formatter `FMT()` uses for `x`, called with a pointer to it */
+#define FMT_FORMATTER(x)                                  \
+        _Generic((x),                                     \
+                char *: fmt_mut_cstr_,                    \
+                char const *: fmt_cstr,                   \
+                str: fmt_str,                             \
+                struct rcstr *: fmt_rcstr,                \
+                struct cstring *: fmt_mut_cstring_,       \
+                struct cstring const *: fmt_cstring,      \
+                bool: fmt_bool,                           \
+                char: fmt_char,                           \
+                signed char: fmt_schar_,                  \
+                unsigned char: fmt_uchar,                 \
+                short: fmt_short_,                        \
+                unsigned short: fmt_ushort_,              \
+                int: fmt_int,                             \
+                unsigned int: fmt_uint,                   \
+                long int: fmt_lint,                       \
+                unsigned long int: fmt_ulint,             \
+                long long int: fmt_llint,                 \
+                unsigned long long int: fmt_ullint,       \
+                float: fmt_float,                         \
+                double: fmt_double)
+
+static inline size_t fmt_hint_cstr(char const *s)
+{
+        return __builtin_strlen(s);
+}
+
+static inline size_t fmt_hint_str(str s)
+{
+        return str_length(s);
+}
+
+static inline size_t fmt_hint_rcstr(struct rcstr *s)
+{
+        return rcstr_length(s);
+}
+
+static inline size_t fmt_hint_cstring(struct cstring const *s)
+{
+        return s->buf.len - 1;
+}
+
+static inline size_t fmt_hint_integral(long long x)
+{
+        (void)x;
+        return FMT_INTEGRAL_MAX;
+}
+
+static inline size_t fmt_hint_float(double x)
+{
+        (void)x;
+        return FMT_FLOAT_MAX;
+}
+
+static inline void fmt_mut_cstr_(struct cstring *restrict f, char *const *value)
+{
+        fmt_cstr(f, (char const *const *)value);
+}
+
+static inline void fmt_mut_cstring_(struct cstring *restrict f, struct cstring *const *value)
+{
+        fmt_cstring(f, (struct cstring const *const *)value);
+}
+
+static inline void fmt_schar_(struct cstring *restrict f, signed char const *value)
+{
+        int v = *value;
+        fmt_int(f, &v);
+}
+
+static inline void fmt_short_(struct cstring *restrict f, short const *value)
+{
+        int v = *value;
+        fmt_int(f, &v);
+}
+
+static inline void fmt_ushort_(struct cstring *restrict f, unsigned short const *value)
+{
+        unsigned v = *value;
+        fmt_uint(f, &v);
+}
+
+#define FMT_CAT_(a, b) a##b
+#define FMT_CAT(a, b) FMT_CAT_(a, b)
+#define FMT_ARG_(i) FMT_CAT(fmt_arg_, i)
+#define FMT_BIND_(i, x) __auto_type FMT_ARG_(i) = (x);
+#define FMT_HINT_(i, x) +FMT_HINT(FMT_ARG_(i))
+#define FMT_WRITE_(i, x) FMT_FORMATTER(FMT_ARG_(i))(fmt_out_, &FMT_ARG_(i));
+
+/*
+ * `FMT_FOR_EACH(M, a, b, ...)` expands to `M(n, a) M(n - 1, b) ...`, in
+ * argument order, where the first argument is the number of arguments left.
+ */
+#define FMT_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16,   \
+                   _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, \
+                   _31, _32, N, ...)                                                     \
+        N
+#define FMT_NARGS(...)                                                                        \
+        FMT_NARGS_(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, \
+                   17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1)
+#define FMT_FOR_EACH(M, ...) FMT_CAT(FMT_EACH_, FMT_NARGS(__VA_ARGS__))(M, __VA_ARGS__)
+#define FMT_EACH_1(M, x) M(1, x)
+#define FMT_EACH_2(M, x, ...) M(2, x) FMT_EACH_1(M, __VA_ARGS__)
+#define FMT_EACH_3(M, x, ...) M(3, x) FMT_EACH_2(M, __VA_ARGS__)
+#define FMT_EACH_4(M, x, ...) M(4, x) FMT_EACH_3(M, __VA_ARGS__)
+#define FMT_EACH_5(M, x, ...) M(5, x) FMT_EACH_4(M, __VA_ARGS__)
+#define FMT_EACH_6(M, x, ...) M(6, x) FMT_EACH_5(M, __VA_ARGS__)
+#define FMT_EACH_7(M, x, ...) M(7, x) FMT_EACH_6(M, __VA_ARGS__)
+#define FMT_EACH_8(M, x, ...) M(8, x) FMT_EACH_7(M, __VA_ARGS__)
+#define FMT_EACH_9(M, x, ...) M(9, x) FMT_EACH_8(M, __VA_ARGS__)
+#define FMT_EACH_10(M, x, ...) M(10, x) FMT_EACH_9(M, __VA_ARGS__)
+#define FMT_EACH_11(M, x, ...) M(11, x) FMT_EACH_10(M, __VA_ARGS__)
+#define FMT_EACH_12(M, x, ...) M(12, x) FMT_EACH_11(M, __VA_ARGS__)
+#define FMT_EACH_13(M, x, ...) M(13, x) FMT_EACH_12(M, __VA_ARGS__)
+#define FMT_EACH_14(M, x, ...) M(14, x) FMT_EACH_13(M, __VA_ARGS__)
+#define FMT_EACH_15(M, x, ...) M(15, x) FMT_EACH_14(M, __VA_ARGS__)
+#define FMT_EACH_16(M, x, ...) M(16, x) FMT_EACH_15(M, __VA_ARGS__)
+#define FMT_EACH_17(M, x, ...) M(17, x) FMT_EACH_16(M, __VA_ARGS__)
+#define FMT_EACH_18(M, x, ...) M(18, x) FMT_EACH_17(M, __VA_ARGS__)
+#define FMT_EACH_19(M, x, ...) M(19, x) FMT_EACH_18(M, __VA_ARGS__)
+#define FMT_EACH_20(M, x, ...) M(20, x) FMT_EACH_19(M, __VA_ARGS__)
+#define FMT_EACH_21(M, x, ...) M(21, x) FMT_EACH_20(M, __VA_ARGS__)
+#define FMT_EACH_22(M, x, ...) M(22, x) FMT_EACH_21(M, __VA_ARGS__)
+#define FMT_EACH_23(M, x, ...) M(23, x) FMT_EACH_22(M, __VA_ARGS__)
+#define FMT_EACH_24(M, x, ...) M(24, x) FMT_EACH_23(M, __VA_ARGS__)
+#define FMT_EACH_25(M, x, ...) M(25, x) FMT_EACH_24(M, __VA_ARGS__)
+#define FMT_EACH_26(M, x, ...) M(26, x) FMT_EACH_25(M, __VA_ARGS__)
+#define FMT_EACH_27(M, x, ...) M(27, x) FMT_EACH_26(M, __VA_ARGS__)
+#define FMT_EACH_28(M, x, ...) M(28, x) FMT_EACH_27(M, __VA_ARGS__)
+#define FMT_EACH_29(M, x, ...) M(29, x) FMT_EACH_28(M, __VA_ARGS__)
+#define FMT_EACH_30(M, x, ...) M(30, x) FMT_EACH_29(M, __VA_ARGS__)
+#define FMT_EACH_31(M, x, ...) M(31, x) FMT_EACH_30(M, __VA_ARGS__)
+#define FMT_EACH_32(M, x, ...) M(32, x) FMT_EACH_31(M, __VA_ARGS__)
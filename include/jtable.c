@@ -2,14 +2,31 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "jtable.h"
+#include "panic.h"
 
 #define likely(x) __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
 
 #define LDF 0.8
 
+/** Number of keys whose home buckets are prefetched together by the batch 
+  * APIs. Roughly the number of outstanding L1 misses a core can track. 
+  */
+#define JTABLE_BATCH 16
+
+/** Store `v` to the bucket field `field`. A `cjtable` reader may be walking the
+  * buckets while its writer mutates them, so every store to a bucket is a
+  * relaxed atomic one; on the targets we run on it compiles to a plain store.
+  */
+#define SET(field, v) __atomic_store_n(&(field), (v), __ATOMIC_RELAXED)
+
 long pve_offset(long i, uint16_t offset, size_t mod)
 {
         i += offset;
@@ -32,18 +49,29 @@ size_t hash(keyint_t k)
         return k;
 }
 
-void jtable_init_with_capacity(jtable *self, size_t cap)
+void jtable_init_with_allocator(jtable *self, struct allocator *alloc)
 {
-        self->buckets = calloc(cap, sizeof(struct bucket));
+        self->buckets = NULL;
         self->len = 0;
+        self->cap = 0;
+        self->map = NULL;
+        self->map_len = 0;
+        self->alloc = alloc;
+}
+
+void jtable_init_with_capacity(jtable *self, size_t cap, struct allocator *alloc)
+{
+        jtable_init_with_allocator(self, alloc);
+        self->buckets = allocator_calloc(alloc, cap * sizeof(struct bucket));
+        if (self->buckets == NULL) {
+                PANIC("calloc() returned NULL");
+        }
         self->cap = cap;
 }
 
 void jtable_init(jtable *self)
 {
-        self->buckets = NULL;
-        self->len = 0;
-        self->cap = 0;
+        jtable_init_with_allocator(self, &allocator_libc);
 }
 
 void bucket_print(struct bucket b)
@@ -97,20 +125,60 @@ static inline size_t jtable_qprobe_until_empty(jtable *self, size_t i)
         return i;
 }
 
-void jtable_realloc(jtable *self)
+jtable jtable_rehashed(jtable const *self, size_t cap)
 {
         jtable newtbl;
-        jtable_init_with_capacity(&newtbl, self->cap ? self->cap * 4 : 32);
+        jtable_init_with_capacity(&newtbl, cap, self->alloc);
         for (size_t i = 0; i < self->cap; ++i) {
                 struct bucket b = self->buckets[i];
                 if (b.ctrl != CTRL_EMPTY) {
                         jtable_insert(&newtbl, b.key, b.val);
                 }
         }
+        return newtbl;
+}
+
+/** Rehash every entry into a fresh bucket array of `cap` buckets */
+static void jtable_rehash(jtable *self, size_t cap)
+{
+        jtable newtbl = jtable_rehashed(self, cap);
         jtable_deinit(self);
         *self = newtbl;
 }
 
+void jtable_realloc(jtable *self)
+{
+        jtable_rehash(self, self->cap ? self->cap * 4 : JTABLE_MIN_CAP);
+}
+
+/** Grow (by the usual factor of 4) until `additional` more entries fit */
+static void jtable_reserve(jtable *self, size_t additional)
+{
+        size_t cap = self->cap ? self->cap : JTABLE_MIN_CAP;
+        while (self->len + additional >= 3 * cap / 4) {
+                cap *= 4;
+        }
+        if (cap != self->cap) {
+                jtable_rehash(self, cap);
+        }
+}
+
+/** Fill the empty bucket `b` with a new entry */
+static inline void bucket_fill(struct bucket *b, char ctrl, uint16_t prev, keyint_t k, valint_t v)
+{
+        SET(b->ctrl, ctrl);
+        SET(b->prev, prev);
+        SET(b->next, 0);
+        SET(b->chain_start, 0);
+        SET(b->key, k);
+        SET(b->val, v);
+}
+
+static inline size_t jtable_home(jtable *self, keyint_t k)
+{
+        return hash(k) % self->cap;
+}
+
 static inline long jtable_follow_chain(jtable *self, keyint_t k, long i)
 {
         struct bucket *b = &self->buckets[i];
@@ -128,21 +196,16 @@ static inline long jtable_follow_chain(jtable *self, keyint_t k, long i)
         return i;
 }
 
-void jtable_insert(jtable *self, keyint_t k, valint_t v)
+/** Insert into a table that is known to have room, starting from the home 
+  * bucket `i` of `k` 
+  */
+static inline void jtable_insert_at(jtable *self, keyint_t k, valint_t v, long i)
 {
-        if (self->len >= 3 * self->cap / 4) {
-                jtable_realloc(self);
-        }
-        size_t h = hash(k);
-        long i = h % self->cap;
         struct bucket *b = &self->buckets[i];
         if (b->ctrl == CTRL_EMPTY) {
                 // We can immediately insert into the bucket
                 // extremely low-cost
-                memset(b, 0, sizeof(struct bucket));
-                b->ctrl = CTRL_SNUG;
-                b->key = k;
-                b->val = v;
+                bucket_fill(b, CTRL_SNUG, 0, k, v);
                 self->len++;
                 return;
         }
@@ -151,13 +214,8 @@ void jtable_insert(jtable *self, keyint_t k, valint_t v)
                 // occupied
                 // low-cost -- this is just a linear probe
                 long j = jtable_qprobe_until_empty(self, i);
-                b->chain_start = index_delta(i, j, self->cap);
-                b = &self->buckets[j];
-                i = (i + 1) % self->cap;
-                memset(b, 0, sizeof(struct bucket));
-                b->ctrl = CTRL_DISPLACED_HEAD;
-                b->key = k;
-                b->val = v;
+                SET(b->chain_start, index_delta(i, j, self->cap));
+                bucket_fill(&self->buckets[j], CTRL_DISPLACED_HEAD, 0, k, v);
                 self->len++;
                 return;
         }
@@ -165,31 +223,31 @@ void jtable_insert(jtable *self, keyint_t k, valint_t v)
         i = jtable_follow_chain(self, k, i);
         b = &self->buckets[i];
         if (b->key == k) {
-                b->val = v;
+                SET(b->val, v);
                 return;
         }
         // We have reached the end of a chain, without finding a match. We need
         // to probe for a new spot
         long j = jtable_lprobe_until_empty(self, i);
         uint16_t d = index_delta(i, j, self->cap);
-        b->next = d;
-        self->buckets[j] = (struct bucket){
-                .ctrl = CTRL_DISPLACED,
-                .prev = d,
-                .next = 0,
-                .key = k,
-                .val = v,
-        };
+        SET(b->next, d);
+        bucket_fill(&self->buckets[j], CTRL_DISPLACED, d, k, v);
         self->len++;
 }
 
-/** Lookup the index of a bucket that matches `k`. `-1` represents an absent 
-  * key 
+void jtable_insert(jtable *self, keyint_t k, valint_t v)
+{
+        if (jtable_full(self)) {
+                jtable_realloc(self);
+        }
+        jtable_insert_at(self, k, v, jtable_home(self, k));
+}
+
+/** Lookup the index of a bucket that matches `k`, starting from its home 
+  * bucket `i`. `-1` represents an absent key 
   */
-static inline long jtable_lookup_bucket(jtable *self, keyint_t k)
+static inline long jtable_lookup_bucket_at(jtable *self, keyint_t k, long i)
 {
-        size_t h = hash(k);
-        long i = h % self->cap;
         struct bucket *b = &self->buckets[i];
         if (b->ctrl == CTRL_EMPTY) {
                 return -1;
@@ -202,6 +260,14 @@ static inline long jtable_lookup_bucket(jtable *self, keyint_t k)
         return -1;
 }
 
+/** Lookup the index of a bucket that matches `k`. `-1` represents an absent 
+  * key 
+  */
+static inline long jtable_lookup_bucket(jtable *self, keyint_t k)
+{
+        return jtable_lookup_bucket_at(self, k, jtable_home(self, k));
+}
+
 /** For some bucket `b` that is being removed, replace it with the chain which
   * it blocks. 
   */
@@ -211,26 +277,26 @@ static inline void jtable_replace_with_chain_start(jtable *self, long i)
         if (b->chain_start) {
                 long j = (i + (long)b->chain_start) % self->cap;
                 struct bucket *headb = &self->buckets[j];
-                headb->ctrl = CTRL_EMPTY;
-                b->ctrl = CTRL_SNUG;
+                SET(headb->ctrl, CTRL_EMPTY);
+                SET(b->ctrl, CTRL_SNUG);
                 if (headb->next) {
-                        b->next = headb->next + b->chain_start;
+                        SET(b->next, headb->next + b->chain_start);
                         struct bucket *nextb = &self->buckets[(i + (long)b->next) % self->cap];
-                        nextb->prev = b->next;
+                        SET(nextb->prev, b->next);
                 } else {
-                        b->next = 0;
+                        SET(b->next, 0);
                 }
-                b->chain_start = 0;
-                b->prev = 0;
-                b->key = headb->key;
-                b->val = headb->val;
+                SET(b->chain_start, 0);
+                SET(b->prev, 0);
+                SET(b->key, headb->key);
+                SET(b->val, headb->val);
                 if (headb->chain_start) {
                         jtable_replace_with_chain_start(self, j);
                 }
         }
 }
 
-void jtable_remove(jtable *self, keyint_t k)
+void jtable_remove_noshrink(jtable *self, keyint_t k)
 {
         if (self->cap == 0) {
                 return;
@@ -253,46 +319,47 @@ void jtable_remove(jtable *self, keyint_t k)
         if (rmvb->key != k) {
                 return;
         }
+        self->len--;
 
         if (rmvb->ctrl == CTRL_SNUG) {
                 if (!rmvb->next) {
-                        rmvb->ctrl = CTRL_EMPTY;
+                        SET(rmvb->ctrl, CTRL_EMPTY);
                         return;
                 }
                 long j = (rmvi + (long)rmvb->next) % self->cap;
                 struct bucket *nextb = &self->buckets[j];
-                nextb->ctrl = CTRL_EMPTY;
-                rmvb->next = nextb->next ? rmvb->next + nextb->next : 0;
-                rmvb->key = nextb->key;
-                rmvb->val = nextb->val;
-                rmvb->prev = 0;
+                SET(nextb->ctrl, CTRL_EMPTY);
+                SET(rmvb->next, nextb->next ? rmvb->next + nextb->next : 0);
+                SET(rmvb->key, nextb->key);
+                SET(rmvb->val, nextb->val);
+                SET(rmvb->prev, 0);
                 if (nextb->next) {
                         struct bucket *nextnextb =
                                 &self->buckets[pve_offset(j, nextb->next, self->cap)];
-                        nextnextb->prev = rmvb->next;
+                        SET(nextnextb->prev, rmvb->next);
                 }
                 jtable_replace_with_chain_start(self, j);
                 return;
         }
 
         struct bucket rmvb_copy = *rmvb;
-        rmvb->ctrl = CTRL_EMPTY;
+        SET(rmvb->ctrl, CTRL_EMPTY);
         if (rmvb->prev) {
                 long j = nve_offset(rmvi, rmvb->prev, self->cap);
                 struct bucket *prevb = &self->buckets[j];
                 if (rmvb->next) {
-                        prevb->next += rmvb->next;
+                        SET(prevb->next, prevb->next + rmvb->next);
                 } else {
-                        prevb->next = 0;
+                        SET(prevb->next, 0);
                 }
         }
         if (rmvb->next) {
                 long j = pve_offset(rmvi, rmvb->next, self->cap);
                 struct bucket *nextb = &self->buckets[j];
                 if (rmvb->prev) {
-                        nextb->prev += rmvb->prev;
+                        SET(nextb->prev, nextb->prev + rmvb->prev);
                 } else {
-                        nextb->prev = 0;
+                        SET(nextb->prev, 0);
                 }
         }
         jtable_replace_with_chain_start(self, rmvi);
@@ -302,10 +369,80 @@ void jtable_remove(jtable *self, keyint_t k)
         // We just removed the thing the chain_start points to, we need to
         // clean that up
         if (rmvb_copy.next) {
-                b->chain_start += rmvb_copy.next;
+                SET(b->chain_start, b->chain_start + rmvb_copy.next);
         } else {
-                b->chain_start = 0;
+                SET(b->chain_start, 0);
+        }
+}
+
+void jtable_remove(jtable *self, keyint_t k)
+{
+        jtable_remove_noshrink(self, k);
+        if (self->cap > JTABLE_MIN_CAP && self->len < self->cap / JTABLE_SHRINK_DIVISOR) {
+                jtable_rehash(self, self->cap / 4);
+        }
+}
+
+void jtable_shrink_to_fit(jtable *self)
+{
+        if (self->len == 0) {
+                jtable_deinit(self);
+                return;
+        }
+        size_t cap = JTABLE_MIN_CAP;
+        while (self->len >= 3 * cap / 4) {
+                cap *= 4;
+        }
+        if (cap < self->cap) {
+                jtable_rehash(self, cap);
+        }
+}
+
+/** The bucket of the first entry whose home bucket is `h`, or `-1` if there is none */
+static long jtable_chain_head(jtable *self, size_t h)
+{
+        struct bucket *b = &self->buckets[h];
+        if (b->ctrl == CTRL_SNUG) {
+                return (long)h;
+        }
+        if (b->ctrl == CTRL_EMPTY || b->chain_start == 0) {
+                return -1;
+        }
+        return pve_offset((long)h, b->chain_start, self->cap);
+}
+
+/** The bucket of entry `rank` of the chain of `h`, or `-1` if it is shorter */
+static long jtable_chain_entry(jtable *self, size_t h, size_t rank)
+{
+        long i = jtable_chain_head(self, h);
+        for (size_t n = 0; i != -1 && n < rank; ++n) {
+                struct bucket *b = &self->buckets[i];
+                i = b->next ? pve_offset(i, b->next, self->cap) : -1;
         }
+        return i;
+}
+
+bool jtable_next(jtable *self, jtable_cursor *cursor, keyint_t *k, valint_t **v)
+{
+        for (; cursor->index < self->cap; cursor->index++, cursor->rank = 0) {
+                long i = jtable_chain_entry(self, cursor->index, cursor->rank);
+                if (i != -1) {
+                        cursor->rank++;
+                        *k = self->buckets[i].key;
+                        *v = &self->buckets[i].val;
+                        return true;
+                }
+        }
+        return false;
+}
+
+void jtable_cursor_remove(jtable *self, jtable_cursor *cursor)
+{
+        long i = jtable_chain_entry(self, cursor->index, cursor->rank - 1);
+        jtable_remove_noshrink(self, self->buckets[i].key);
+        // The rest of the chain moves up one, and no other entry changes its
+        // home bucket or its place in its chain
+        cursor->rank--;
 }
 
 valint_t *jtable_lookup(jtable *self, keyint_t k)
@@ -320,12 +457,208 @@ valint_t *jtable_lookup(jtable *self, keyint_t k)
         return &self->buckets[i].val;
 }
 
+void jtable_lookup_batch(jtable *self, keyint_t const *keys, size_t n, valint_t **out)
+{
+        if (self->cap == 0) {
+                for (size_t i = 0; i < n; ++i) {
+                        out[i] = NULL;
+                }
+                return;
+        }
+        size_t homes[JTABLE_BATCH];
+        for (size_t base = 0; base < n; base += JTABLE_BATCH) {
+                size_t m = n - base < JTABLE_BATCH ? n - base : JTABLE_BATCH;
+                // Issue every load up front, so that the misses overlap
+                for (size_t i = 0; i < m; ++i) {
+                        homes[i] = jtable_home(self, keys[base + i]);
+                        __builtin_prefetch(&self->buckets[homes[i]], 0, 1);
+                }
+                for (size_t i = 0; i < m; ++i) {
+                        long j = jtable_lookup_bucket_at(self, keys[base + i], homes[i]);
+                        out[base + i] = j == -1 ? NULL : &self->buckets[j].val;
+                }
+        }
+}
+
+void jtable_insert_batch(jtable *self, keyint_t const *keys, valint_t const *vals, size_t n)
+{
+        if (n == 0) {
+                return;
+        }
+        // Grow once, so that no insert in the batch moves the buckets under
+        // our prefetches
+        jtable_reserve(self, n);
+        size_t homes[JTABLE_BATCH];
+        for (size_t base = 0; base < n; base += JTABLE_BATCH) {
+                size_t m = n - base < JTABLE_BATCH ? n - base : JTABLE_BATCH;
+                for (size_t i = 0; i < m; ++i) {
+                        homes[i] = jtable_home(self, keys[base + i]);
+                        __builtin_prefetch(&self->buckets[homes[i]], 1, 1);
+                }
+                for (size_t i = 0; i < m; ++i) {
+                        jtable_insert_at(self, keys[base + i], vals[base + i], homes[i]);
+                }
+        }
+}
+
 void jtable_deinit(jtable *self)
 {
-        if (self->buckets != NULL) {
-                free(self->buckets);
+        if (self->map != NULL) {
+                munmap(self->map, self->map_len);
+        } else if (self->buckets != NULL) {
+                allocator_free(self->alloc, self->buckets, self->cap * sizeof(struct bucket));
         }
         self->buckets = NULL;
         self->cap = 0;
         self->len = 0;
+        self->map = NULL;
+        self->map_len = 0;
+}
+
+#define JTABLE_FILE_MAGIC "jtable\0\1"
+#define JTABLE_FILE_VERSION 1
+/** Buckets start on their own page, so they can be used straight from the 
+  * mapping 
+  */
+#define JTABLE_FILE_DATA_OFFSET 4096
+
+struct jtable_file_header {
+        char magic[8];
+        uint32_t version;
+        /** Guards against a snapshot from a build with another bucket layout */
+        uint32_t bucket_size;
+        uint64_t cap;
+        uint64_t len;
+        /** FNV-1a of this header, computed with this field set to 0 */
+        uint64_t checksum;
+};
+
+static uint64_t jtable_header_checksum(struct jtable_file_header hdr)
+{
+        hdr.checksum = 0;
+        uint8_t const *p = (uint8_t const *)&hdr;
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < sizeof hdr; ++i) {
+                h ^= p[i];
+                h *= 0x100000001b3ull;
+        }
+        return h;
+}
+
+/** `write()` all of `buf`, retrying on short writes */
+static int write_all(int fd, void const *buf, size_t len)
+{
+        uint8_t const *p = buf;
+        while (len > 0) {
+                ssize_t n = write(fd, p, len);
+                if (n == -1) {
+                        if (errno == EINTR) continue;
+                        return -1;
+                }
+                p += n;
+                len -= n;
+        }
+        return 0;
+}
+
+/** `fsync()` the directory that contains `path`, so a rename into it is durable */
+static int fsync_parent(char const *path)
+{
+        char const *slash = strrchr(path, '/');
+        char *dir;
+        if (slash == NULL) {
+                dir = strdup(".");
+        } else {
+                dir = strndup(path, slash == path ? 1 : (size_t)(slash - path));
+        }
+        if (dir == NULL) {
+                PANIC("strdup() returned NULL");
+        }
+        int fd = open(dir, O_RDONLY | O_DIRECTORY);
+        free(dir);
+        if (fd == -1) return -1;
+        int ret = fsync(fd);
+        int err = errno;
+        close(fd);
+        errno = err;
+        return ret;
+}
+
+int jtable_save(jtable *self, char const *path)
+{
+        struct jtable_file_header hdr;
+        memset(&hdr, 0, sizeof hdr);
+        memcpy(hdr.magic, JTABLE_FILE_MAGIC, sizeof hdr.magic);
+        hdr.version = JTABLE_FILE_VERSION;
+        hdr.bucket_size = sizeof(struct bucket);
+        hdr.cap = self->cap;
+        hdr.len = self->len;
+        hdr.checksum = jtable_header_checksum(hdr);
+
+        // Write next to the destination and rename over it, so that a crash 
+        // mid-save never leaves a torn snapshot behind
+        size_t tmplen = strlen(path) + sizeof ".tmp";
+        char *tmp = malloc(tmplen);
+        if (tmp == NULL) {
+                PANIC("malloc() returned NULL");
+        }
+        snprintf(tmp, tmplen, "%s.tmp", path);
+        int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+                free(tmp);
+                return -1;
+        }
+        uint8_t page[JTABLE_FILE_DATA_OFFSET] = { 0 };
+        memcpy(page, &hdr, sizeof hdr);
+        if (write_all(fd, page, sizeof page) == -1 ||
+            write_all(fd, self->buckets, self->cap * sizeof(struct bucket)) == -1 ||
+            fsync(fd) == -1) {
+                int err = errno;
+                close(fd);
+                unlink(tmp);
+                free(tmp);
+                errno = err;
+                return -1;
+        }
+        close(fd);
+        int ret = rename(tmp, path);
+        free(tmp);
+        if (ret == -1) return -1;
+        return fsync_parent(path);
+}
+
+int jtable_open_mapped(jtable *self, char const *path, bool writable)
+{
+        int fd = open(path, O_RDONLY);
+        if (fd == -1) return -1;
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+                close(fd);
+                return -1;
+        }
+        struct jtable_file_header hdr;
+        // `cap` comes from the file: bound it before it is multiplied. Any
+        // capacity is valid, since buckets are found with `% cap`.
+        if ((size_t)st.st_size < JTABLE_FILE_DATA_OFFSET ||
+            pread(fd, &hdr, sizeof hdr, 0) != sizeof hdr ||
+            memcmp(hdr.magic, JTABLE_FILE_MAGIC, sizeof hdr.magic) != 0 ||
+            hdr.version != JTABLE_FILE_VERSION || hdr.bucket_size != sizeof(struct bucket) ||
+            hdr.checksum != jtable_header_checksum(hdr) || hdr.len > hdr.cap ||
+            hdr.cap > (SIZE_MAX - JTABLE_FILE_DATA_OFFSET) / sizeof(struct bucket) ||
+            (size_t)st.st_size != JTABLE_FILE_DATA_OFFSET + hdr.cap * sizeof(struct bucket)) {
+                close(fd);
+                errno = EINVAL;
+                return -1;
+        }
+        int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+        void *map = mmap(NULL, st.st_size, prot, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) return -1;
+        jtable_init(self);
+        self->map = map;
+        self->map_len = st.st_size;
+        self->buckets = (struct bucket *)((uint8_t *)map + JTABLE_FILE_DATA_OFFSET);
+        self->cap = hdr.cap;
+        self->len = hdr.len;
+        return 0;
 }
\ No newline at end of file
@@ -2,6 +2,9 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
+
+#include "./allocator.h"
 
 typedef intptr_t keyint_t;
 typedef intptr_t valint_t;
@@ -11,6 +14,18 @@ typedef intptr_t valint_t;
 #define CTRL_DISPLACED ((char)2)
 #define CTRL_DISPLACED_HEAD ((char)3)
 
+/** Capacity of the first allocation. Every capacity is this times a power of 
+  * 4. 
+  */
+#define JTABLE_MIN_CAP 32
+
+/** Shrink once fewer than 1 in this many buckets is in use. Growing happens at 
+  * 3/4 and shrinking divides the capacity by 4, so a shrunk table sits at under 
+  * 1/4 load: far enough from both thresholds that alternating inserts and 
+  * removes cannot make it thrash. 
+  */
+#define JTABLE_SHRINK_DIVISOR 16
+
 struct bucket {
         char ctrl;
         uint16_t prev;
@@ -24,16 +39,149 @@ typedef struct {
         struct bucket *buckets;
         size_t len;
         size_t cap;
+        /** Start of the file mapping `buckets` lives in, or `NULL` if they are 
+          * heap-allocated. See `jtable_open_mapped()`. 
+          */
+        void *map;
+        size_t map_len;
+        /** Where `buckets` come from. See `struct allocator`. */
+        struct allocator *alloc;
 } jtable;
 
 void jtable_init(jtable *);
 
+/**
+ * `jtable_init()`, but buckets are allocated from `alloc` rather than 
+ * `allocator_libc`.
+ */
+void jtable_init_with_allocator(jtable *, struct allocator *alloc);
+
+void jtable_init_with_capacity(jtable *, size_t cap, struct allocator *alloc);
+
+/**
+ * Whether the next insert of a new key would make the table grow. 
+ */
+static inline bool jtable_full(jtable const *self)
+{
+        return self->len >= 3 * self->cap / 4;
+}
+
+/**
+ * A copy of this table with `cap` buckets, which must be enough to hold its
+ * entries without growing. `self` is only read, so it can stay in use (by
+ * lock-free readers, say) until the copy replaces it.
+ */
+jtable jtable_rehashed(jtable const *, size_t cap);
+
 void jtable_print(jtable *);
 
 void jtable_insert(jtable *, keyint_t, valint_t);
 
+/**
+ * Remove `k` if it is present. Shrinks the table once it is mostly empty, so 
+ * memory follows the live working set; this invalidates cursors and pointers 
+ * into the table.
+ */
 void jtable_remove(jtable *, keyint_t);
 
+/**
+ * `jtable_remove()` that never reallocates, i.e. the bucket array is 
+ * guaranteed to stay where it is.
+ */
+void jtable_remove_noshrink(jtable *, keyint_t);
+
+/**
+ * Reallocate to the smallest capacity that holds the current entries without 
+ * growing on the next insert. An empty table releases its buckets entirely.
+ */
+void jtable_shrink_to_fit(jtable *);
+
+/**
+ * A position in a `jtable`, for iterating over its entries. A `jtable` goes
+ * by home bucket, and then along the chain of entries with that home, which
+ * removing an entry never reorders. Initialize with `JTABLE_CURSOR_INIT`.
+ */
+typedef struct {
+        /** The home bucket */
+        size_t index;
+        /** Entries of the chain of `index` already yielded */
+        size_t rank;
+} jtable_cursor;
+
+#define JTABLE_CURSOR_INIT ((jtable_cursor){ .index = 0, .rank = 0 })
+
+/**
+ * Advance `cursor`, writing the next entry to `k` and `v`. Returns `false` once
+ * every entry has been yielded. Inserting or calling `jtable_remove()` while 
+ * iterating invalidates the cursor; to remove entries while iterating, use 
+ * `jtable_cursor_remove()`.
+ * 
+ * # Example
+ * 
+ * ```c
+ * jtable_cursor it = JTABLE_CURSOR_INIT;
+ * keyint_t k;
+ * valint_t *v;
+ * while (jtable_next(&tbl, &it, &k, &v)) {
+ *         if (*v == 0) {
+ *                 jtable_cursor_remove(&tbl, &it);
+ *         }
+ * }
+ * ```
+ */
+bool jtable_next(jtable *, jtable_cursor *cursor, keyint_t *k, valint_t **v);
+
+/**
+ * Remove the entry last yielded by `jtable_next()`. Iteration then carries on 
+ * without skipping or repeating any entry. The table is not shrunk; call 
+ * `jtable_shrink_to_fit()` afterwards if you removed a lot.
+ */
+void jtable_cursor_remove(jtable *, jtable_cursor *cursor);
+
 valint_t *jtable_lookup(jtable *, keyint_t);
 
-void jtable_deinit(jtable *);
\ No newline at end of file
+/**
+ * Look up `n` keys at once, writing the result for `keys[i]` to `out[i]` (with
+ * the same meaning as `jtable_lookup()`). All home buckets of a batch are 
+ * prefetched before any probe is resolved, so cache misses overlap instead of 
+ * being paid one after another.
+ */
+void jtable_lookup_batch(jtable *, keyint_t const *keys, size_t n, valint_t **out);
+
+/**
+ * Insert `n` key-value pairs at once. This is equivalent to calling 
+ * `jtable_insert()` on each pair in order, but grows the table at most once and 
+ * prefetches home buckets ahead of the inserts.
+ */
+void jtable_insert_batch(jtable *, keyint_t const *keys, valint_t const *vals, size_t n);
+
+void jtable_deinit(jtable *);
+
+/**
+ * Write a snapshot of this table to `path`, atomically replacing any existing
+ * file, and durably: the file and its directory are synced. Buckets address 
+ * each other by relative offsets only, so the bucket array is written out 
+ * as-is and can be used in place by `jtable_open_mapped()`. Keys and values 
+ * are stored verbatim: a snapshot of pointers is meaningless to another 
+ * process.
+ * 
+ * # Returns
+ * - `-1` for failure and set `errno`
+ * - `0` for success
+ */
+int jtable_save(jtable *, char const *path);
+
+/**
+ * Initialize a table directly on top of a snapshot written by `jtable_save()`,
+ * with no per-entry work: the file is `mmap()`ed and pages are faulted in as 
+ * lookups touch them. Only the header is checked, against its checksum.
+ * 
+ * If `writable`, the mapping is copy-on-write: the table may be modified, but 
+ * changes stay private to this process and the file is left untouched. 
+ * Otherwise the table is read-only and must not be modified.
+ * 
+ * # Returns
+ * - `-1` for failure and set `errno` (`EINVAL` for a corrupt snapshot)
+ * - `0` for success
+ */
+int jtable_open_mapped(jtable *, char const *path, bool writable);
\ No newline at end of file
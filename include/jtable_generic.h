@@ -0,0 +1,501 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "./jtable.h"
+#include "./allocator.h"
+#include "./panic.h"
+
+/**
+ * `jtable` for arbitrary key and value types. `jtable` itself is fixed to
+ * `keyint_t` and `valint_t`, so anything bigger than a pointer has to be boxed,
+ * costing an indirection per lookup. A generated table instead stores keys and
+ * values inline in its buckets, with their sizes known at compile time.
+ *
+ * Like the `fmt_*` formatters, tables are generated with a pair of macros:
+ * `DECLARE_JTABLE()` goes in a header and `DEFINE_JTABLE()` in exactly one
+ * translation unit.
+ *
+ * - `NAME`: name of the table type, and prefix of its functions
+ * - `K`, `V`: key and value types
+ * - `HASH`: `size_t HASH(K const *)`
+ * - `EQ`: `bool EQ(K const *, K const *)`
+ *
+ * The generated API mirrors `jtable`: `NAME_init()`,
+ * `NAME_init_with_allocator()`, `NAME_insert()`,
+ * `NAME_lookup()`, `NAME_remove()`, `NAME_next()` (iterating with a
+ * `jtable_cursor`), `NAME_cursor_remove()` and `NAME_deinit()`. Keys and
+ * values are passed by pointer, so large types are not copied on every call.
+ *
+ * Only the typed entry points are generated. The chains are kept by the
+ * `jtable_generic_*()` helpers below, shared by every table and told the
+ * bucket size and the key comparison by a `struct jtable_layout`, which is a
+ * constant the compiler folds into each table's copy of them.
+ *
+ * # Example
+ *
+ * ```c
+ * struct stats { uint64_t msgs; uint64_t bytes; };
+ *
+ * static inline size_t hash_int(int const *k) { return *k; }
+ * static inline bool eq_int(int const *a, int const *b) { return *a == *b; }
+ *
+ * DECLARE_JTABLE(stats_table, int, struct stats)
+ * DEFINE_JTABLE(stats_table, int, struct stats, hash_int, eq_int)
+ *
+ * stats_table tbl;
+ * stats_table_init(&tbl);
+ * int fd = 4;
+ * stats_table_insert(&tbl, &fd, &(struct stats){ 0 });
+ * stats_table_lookup(&tbl, &fd)->msgs++;
+ * stats_table_deinit(&tbl);
+ * ```
+ */
+#define DECLARE_JTABLE(NAME, K, V)                                                  \
+        struct NAME##_bucket {                                                      \
+                struct jtable_links links;                                          \
+                K key;                                                              \
+                V val;                                                              \
+        };                                                                          \
+                                                                                    \
+        typedef struct {                                                            \
+                struct NAME##_bucket *buckets;                                      \
+                size_t len;                                                         \
+                size_t cap;                                                         \
+                struct allocator *alloc;                                            \
+        } NAME;                                                                     \
+                                                                                    \
+        void NAME##_init(NAME *self);                                               \
+        void NAME##_init_with_allocator(NAME *self, struct allocator *alloc);       \
+        void NAME##_insert(NAME *self, K const *k, V const *v);                     \
+        V *NAME##_lookup(NAME *self, K const *k);                                   \
+        void NAME##_remove(NAME *self, K const *k);                                 \
+        bool NAME##_next(NAME *self, jtable_cursor *cursor, K **k, V **v);          \
+        void NAME##_cursor_remove(NAME *self, jtable_cursor *cursor);               \
+        void NAME##_deinit(NAME *self);
+
+/** The start of every bucket of a generated table: the links of `struct bucket` */
+struct jtable_links {
+        char ctrl;
+        uint16_t prev;
+        uint16_t next;
+        uint16_t chain_start;
+};
+
+/** What the `jtable_generic_*()` helpers need to know about a table's buckets */
+struct jtable_layout {
+        /** `sizeof` a bucket */
+        size_t size;
+        /** Offset of the key in a bucket. The value follows it. */
+        size_t entry;
+        /** Whether the key at `key` is `*k` */
+        bool (*eq)(void const *key, void const *k);
+};
+
+static inline long jtable_generic_pve_offset(long i, uint16_t offset, size_t mod)
+{
+        i += offset;
+        return i >= (long)mod ? i - (long)mod : i;
+}
+
+static inline long jtable_generic_nve_offset(long i, uint16_t offset, size_t mod)
+{
+        i -= offset;
+        return i < 0 ? (long)mod + i : i;
+}
+
+static inline long jtable_generic_index_delta(long i, long j, long mod)
+{
+        return j < i ? mod - i + j : j - i;
+}
+
+/** FNV-1a of `len` bytes, for the `HASH` of a string key */
+static inline size_t jtable_hash_bytes(void const *bytes, size_t len)
+{
+        uint8_t const *p = bytes;
+        size_t h = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < len; ++i) {
+                h ^= p[i];
+                h *= 0x100000001b3ull;
+        }
+        return h;
+}
+
+static inline struct jtable_links *jtable_generic_at(void *buckets, struct jtable_layout l, long i)
+{
+        return (struct jtable_links *)((char *)buckets + (size_t)i * l.size);
+}
+
+static inline void *jtable_generic_key(struct jtable_links *b, struct jtable_layout l)
+{
+        return (char *)b + l.entry;
+}
+
+/** Copy the key and value of `from` to `to`, leaving the links of `to` alone */
+static inline void jtable_generic_move(struct jtable_links *to, struct jtable_links *from,
+                                       struct jtable_layout l)
+{
+        memcpy((char *)to + l.entry, (char *)from + l.entry, l.size - l.entry);
+}
+
+/** Take the empty bucket `b` into use, with the given links */
+static inline void jtable_generic_fill(struct jtable_links *b, char ctrl, uint16_t prev)
+{
+        *b = (struct jtable_links){ .ctrl = ctrl, .prev = prev };
+}
+
+static inline long jtable_generic_lprobe_until_empty(void *buckets, size_t cap,
+                                                     struct jtable_layout l, long i)
+{
+        do {
+                i += 1;
+                i %= (long)cap;
+        } while (jtable_generic_at(buckets, l, i)->ctrl != CTRL_EMPTY);
+        return i;
+}
+
+static inline long jtable_generic_qprobe_until_empty(void *buckets, size_t cap,
+                                                     struct jtable_layout l, long i)
+{
+        long pi = 1;
+        do {
+                i += pi++;
+                i %= (long)cap;
+        } while (jtable_generic_at(buckets, l, i)->ctrl != CTRL_EMPTY);
+        return i;
+}
+
+/**
+ * Follow the chain of the home bucket `i` to the bucket of `k`, or else to
+ * its last bucket
+ */
+static inline long jtable_generic_follow_chain(void *buckets, size_t cap, struct jtable_layout l,
+                                               void const *k, long i)
+{
+        struct jtable_links *b = jtable_generic_at(buckets, l, i);
+        i = jtable_generic_pve_offset(i, b->chain_start, cap);
+        b = jtable_generic_at(buckets, l, i);
+        do {
+                if (l.eq(jtable_generic_key(b, l), k)) {
+                        return i;
+                }
+                i = jtable_generic_pve_offset(i, b->next, cap);
+                b = jtable_generic_at(buckets, l, i);
+        } while (b->next != 0);
+        return i;
+}
+
+/**
+ * Find the bucket of `k`, whose home bucket is `i`, in a table that has
+ * room for it, linking a new one into its chain if it isn't there yet.
+ *
+ * # Returns
+ * - the index of the bucket. `fresh` is set if it is new, and its key and
+ *   value are for the caller to write.
+ */
+static inline long jtable_generic_insert_at(void *buckets, size_t cap, struct jtable_layout l,
+                                            void const *k, long i, bool *fresh)
+{
+        struct jtable_links *b = jtable_generic_at(buckets, l, i);
+        *fresh = true;
+        if (b->ctrl == CTRL_EMPTY) {
+                jtable_generic_fill(b, CTRL_SNUG, 0);
+                return i;
+        }
+        if (b->ctrl != CTRL_SNUG && b->chain_start == 0) {
+                long j = jtable_generic_qprobe_until_empty(buckets, cap, l, i);
+                b->chain_start = (uint16_t)jtable_generic_index_delta(i, j, (long)cap);
+                jtable_generic_fill(jtable_generic_at(buckets, l, j), CTRL_DISPLACED_HEAD, 0);
+                return j;
+        }
+        i = jtable_generic_follow_chain(buckets, cap, l, k, i);
+        b = jtable_generic_at(buckets, l, i);
+        if (l.eq(jtable_generic_key(b, l), k)) {
+                *fresh = false;
+                return i;
+        }
+        long j = jtable_generic_lprobe_until_empty(buckets, cap, l, i);
+        uint16_t d = (uint16_t)jtable_generic_index_delta(i, j, (long)cap);
+        b->next = d;
+        jtable_generic_fill(jtable_generic_at(buckets, l, j), CTRL_DISPLACED, d);
+        return j;
+}
+
+/**
+ * The bucket of `k`, whose home bucket is `i`
+ *
+ * # Returns
+ * - `-1` if `k` is absent
+ */
+static inline long jtable_generic_lookup_at(void *buckets, size_t cap, struct jtable_layout l,
+                                            void const *k, long i)
+{
+        if (jtable_generic_at(buckets, l, i)->ctrl == CTRL_EMPTY) {
+                return -1;
+        }
+        i = jtable_generic_follow_chain(buckets, cap, l, k, i);
+        return l.eq(jtable_generic_key(jtable_generic_at(buckets, l, i), l), k) ? i : -1;
+}
+
+/** For the bucket `i` that is being removed, replace it with the chain it blocks */
+static inline void jtable_generic_replace_with_chain_start(void *buckets, size_t cap,
+                                                           struct jtable_layout l, long i)
+{
+        struct jtable_links *b = jtable_generic_at(buckets, l, i);
+        while (b->chain_start) {
+                long j = (i + (long)b->chain_start) % (long)cap;
+                struct jtable_links *headb = jtable_generic_at(buckets, l, j);
+                headb->ctrl = CTRL_EMPTY;
+                b->ctrl = CTRL_SNUG;
+                if (headb->next) {
+                        b->next = headb->next + b->chain_start;
+                        jtable_generic_at(buckets, l, (i + (long)b->next) % (long)cap)->prev =
+                                b->next;
+                } else {
+                        b->next = 0;
+                }
+                b->chain_start = 0;
+                b->prev = 0;
+                jtable_generic_move(b, headb, l);
+                // The head may itself have blocked a chain
+                i = j;
+                b = headb;
+        }
+}
+
+/**
+ * Unlink the bucket of `k`, whose home bucket is `i`, if it is there. The
+ * table never moves, and `k` must not point into it.
+ *
+ * # Returns
+ * - whether `k` was there
+ */
+static inline bool jtable_generic_remove_at(void *buckets, size_t cap, struct jtable_layout l,
+                                            void const *k, long i)
+{
+        struct jtable_links *b = jtable_generic_at(buckets, l, i);
+        if (b->ctrl == CTRL_EMPTY) {
+                return false;
+        }
+        long rmvi = jtable_generic_follow_chain(buckets, cap, l, k, i);
+        struct jtable_links *rmvb = jtable_generic_at(buckets, l, rmvi);
+        if (!l.eq(jtable_generic_key(rmvb, l), k)) {
+                return false;
+        }
+        if (rmvb->ctrl == CTRL_SNUG) {
+                if (!rmvb->next) {
+                        rmvb->ctrl = CTRL_EMPTY;
+                        return true;
+                }
+                long j = (rmvi + (long)rmvb->next) % (long)cap;
+                struct jtable_links *nextb = jtable_generic_at(buckets, l, j);
+                nextb->ctrl = CTRL_EMPTY;
+                rmvb->next = nextb->next ? rmvb->next + nextb->next : 0;
+                rmvb->prev = 0;
+                jtable_generic_move(rmvb, nextb, l);
+                if (nextb->next) {
+                        jtable_generic_at(buckets, l,
+                                          jtable_generic_pve_offset(j, nextb->next, cap))
+                                ->prev = rmvb->next;
+                }
+                jtable_generic_replace_with_chain_start(buckets, cap, l, j);
+                return true;
+        }
+        struct jtable_links rmv = *rmvb;
+        rmvb->ctrl = CTRL_EMPTY;
+        if (rmv.prev) {
+                long j = jtable_generic_nve_offset(rmvi, rmv.prev, cap);
+                struct jtable_links *prevb = jtable_generic_at(buckets, l, j);
+                prevb->next = rmv.next ? prevb->next + rmv.next : 0;
+        }
+        if (rmv.next) {
+                long j = jtable_generic_pve_offset(rmvi, rmv.next, cap);
+                struct jtable_links *nextb = jtable_generic_at(buckets, l, j);
+                nextb->prev = rmv.prev ? nextb->prev + rmv.prev : 0;
+        }
+        jtable_generic_replace_with_chain_start(buckets, cap, l, rmvi);
+        if ((i + b->chain_start) % (long)cap == rmvi) {
+                // The chain started with what was removed
+                b->chain_start = rmv.next ? b->chain_start + rmv.next : 0;
+        }
+        return true;
+}
+
+/** The bucket of the first entry whose home bucket is `h`, or `-1` if there is none */
+static inline long jtable_generic_chain_head(void *buckets, size_t cap, struct jtable_layout l,
+                                             size_t h)
+{
+        struct jtable_links *b = jtable_generic_at(buckets, l, (long)h);
+        if (b->ctrl == CTRL_SNUG) {
+                return (long)h;
+        }
+        if (b->ctrl == CTRL_EMPTY || b->chain_start == 0) {
+                return -1;
+        }
+        return jtable_generic_pve_offset((long)h, b->chain_start, cap);
+}
+
+/** The bucket of entry `rank` of the chain of `h`, or `-1` if it is shorter */
+static inline long jtable_generic_chain_entry(void *buckets, size_t cap, struct jtable_layout l,
+                                              size_t h, size_t rank)
+{
+        long i = jtable_generic_chain_head(buckets, cap, l, h);
+        for (size_t n = 0; i != -1 && n < rank; ++n) {
+                struct jtable_links *b = jtable_generic_at(buckets, l, i);
+                i = b->next ? jtable_generic_pve_offset(i, b->next, cap) : -1;
+        }
+        return i;
+}
+
+/** Advance `cursor`, as `jtable_next()`, to the bucket of the next entry, or `-1` */
+static inline long jtable_generic_next(void *buckets, size_t cap, struct jtable_layout l,
+                                       jtable_cursor *cursor)
+{
+        for (; cursor->index < cap; cursor->index++, cursor->rank = 0) {
+                long i = jtable_generic_chain_entry(buckets, cap, l, cursor->index, cursor->rank);
+                if (i != -1) {
+                        cursor->rank++;
+                        return i;
+                }
+        }
+        return -1;
+}
+
+/**
+ * See `DECLARE_JTABLE()`. The entry points hash with `HASH`, and hand the
+ * chains to the `jtable_generic_*()` helpers, which compare keys with `EQ`.
+ */
+#define DEFINE_JTABLE(NAME, K, V, HASH, EQ)                                                  \
+        static bool NAME##_key_eq(void const *key, void const *k)                            \
+        {                                                                                    \
+                return EQ((K const *)key, (K const *)k);                                     \
+        }                                                                                    \
+                                                                                             \
+        static struct jtable_layout const NAME##_layout = {                                  \
+                .size = sizeof(struct NAME##_bucket),                                        \
+                .entry = offsetof(struct NAME##_bucket, key),                                \
+                .eq = NAME##_key_eq,                                                         \
+        };                                                                                   \
+                                                                                             \
+        void NAME##_init_with_allocator(NAME *self, struct allocator *alloc)                 \
+        {                                                                                    \
+                self->buckets = NULL;                                                        \
+                self->len = 0;                                                               \
+                self->cap = 0;                                                               \
+                self->alloc = alloc;                                                         \
+        }                                                                                    \
+                                                                                             \
+        void NAME##_init(NAME *self)                                                         \
+        {                                                                                    \
+                NAME##_init_with_allocator(self, &allocator_libc);                           \
+        }                                                                                    \
+                                                                                             \
+        void NAME##_deinit(NAME *self)                                                       \
+        {                                                                                    \
+                if (self->buckets != NULL) {                                                 \
+                        allocator_free(self->alloc, self->buckets,                           \
+                                       self->cap * sizeof(struct NAME##_bucket));            \
+                }                                                                            \
+                self->buckets = NULL;                                                        \
+                self->cap = 0;                                                               \
+                self->len = 0;                                                               \
+        }                                                                                    \
+                                                                                             \
+        static inline size_t NAME##_home(NAME *self, K const *k)                             \
+        {                                                                                    \
+                return HASH(k) % self->cap;                                                  \
+        }                                                                                    \
+                                                                                             \
+        static void NAME##_insert_at(NAME *self, K const *k, V const *v)                     \
+        {                                                                                    \
+                bool fresh;                                                                  \
+                long i = jtable_generic_insert_at(self->buckets, self->cap, NAME##_layout,   \
+                                                  k, (long)NAME##_home(self, k), &fresh);    \
+                if (fresh) {                                                                 \
+                        self->buckets[i].key = *k;                                           \
+                        self->len++;                                                         \
+                }                                                                            \
+                self->buckets[i].val = *v;                                                   \
+        }                                                                                    \
+                                                                                             \
+        static void NAME##_rehash(NAME *self, size_t cap)                                    \
+        {                                                                                    \
+                NAME newtbl;                                                                 \
+                NAME##_init_with_allocator(&newtbl, self->alloc);                            \
+                newtbl.buckets =                                                             \
+                        allocator_calloc(self->alloc, cap * sizeof(struct NAME##_bucket));   \
+                if (newtbl.buckets == NULL) {                                                \
+                        PANIC("calloc() returned NULL");                                     \
+                }                                                                            \
+                newtbl.cap = cap;                                                            \
+                for (size_t i = 0; i < self->cap; ++i) {                                     \
+                        struct NAME##_bucket *b = &self->buckets[i];                         \
+                        if (b->links.ctrl != CTRL_EMPTY) {                                   \
+                                NAME##_insert_at(&newtbl, &b->key, &b->val);                 \
+                        }                                                                    \
+                }                                                                            \
+                NAME##_deinit(self);                                                         \
+                *self = newtbl;                                                              \
+        }                                                                                    \
+                                                                                             \
+        void NAME##_insert(NAME *self, K const *k, V const *v)                               \
+        {                                                                                    \
+                if (self->len >= 3 * self->cap / 4) {                                        \
+                        NAME##_rehash(self, self->cap ? self->cap * 4 : JTABLE_MIN_CAP);     \
+                }                                                                            \
+                NAME##_insert_at(self, k, v);                                                \
+        }                                                                                    \
+                                                                                             \
+        V *NAME##_lookup(NAME *self, K const *k)                                             \
+        {                                                                                    \
+                if (self->cap == 0) {                                                        \
+                        return NULL;                                                         \
+                }                                                                            \
+                long i = jtable_generic_lookup_at(self->buckets, self->cap, NAME##_layout,   \
+                                                  k, (long)NAME##_home(self, k));            \
+                return i == -1 ? NULL : &self->buckets[i].val;                               \
+        }                                                                                    \
+                                                                                             \
+        void NAME##_remove(NAME *self, K const *k)                                           \
+        {                                                                                    \
+                if (self->cap == 0) {                                                        \
+                        return;                                                              \
+                }                                                                            \
+                if (jtable_generic_remove_at(self->buckets, self->cap, NAME##_layout, k,     \
+                                             (long)NAME##_home(self, k))) {                  \
+                        self->len--;                                                         \
+                }                                                                            \
+                if (self->cap > JTABLE_MIN_CAP &&                                            \
+                    self->len < self->cap / JTABLE_SHRINK_DIVISOR) {                         \
+                        NAME##_rehash(self, self->cap / 4);                                  \
+                }                                                                            \
+        }                                                                                    \
+                                                                                             \
+        bool NAME##_next(NAME *self, jtable_cursor *cursor, K **k, V **v)                    \
+        {                                                                                    \
+                long i = jtable_generic_next(self->buckets, self->cap, NAME##_layout,        \
+                                             cursor);                                        \
+                if (i == -1) {                                                               \
+                        return false;                                                        \
+                }                                                                            \
+                *k = &self->buckets[i].key;                                                  \
+                *v = &self->buckets[i].val;                                                  \
+                return true;                                                                 \
+        }                                                                                    \
+                                                                                             \
+        void NAME##_cursor_remove(NAME *self, jtable_cursor *cursor)                         \
+        {                                                                                    \
+                long i = jtable_generic_chain_entry(self->buckets, self->cap, NAME##_layout, \
+                                                    cursor->index, cursor->rank - 1);        \
+                /* Not a pointer into the buckets, which removing moves around */            \
+                K k = self->buckets[i].key;                                                  \
+                if (jtable_generic_remove_at(self->buckets, self->cap, NAME##_layout, &k,    \
+                                             (long)cursor->index)) {                         \
+                        self->len--;                                                         \
+                }                                                                            \
+                cursor->rank--;                                                              \
+        }
@@ -0,0 +1,45 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "./rcstr.h"
+#include "./panic.h"
+
+struct rcstr *rcstr_new(char const *bytes, size_t len)
+{
+        struct rcstr *self = malloc(sizeof(struct rcstr) + len + 1);
+        if (self == NULL) {
+                PANIC("malloc() returned NULL");
+        }
+        self->refs = 1;
+        self->len = len;
+        memcpy(self->data, bytes, len);
+        self->data[len] = '\0';
+        return self;
+}
+
+struct rcstr *rcstr_from_cstr(char const *cstr)
+{
+        return rcstr_new(cstr, strlen(cstr));
+}
+
+struct rcstr *rcstr_from_cstring(struct cstring const *s)
+{
+        return rcstr_new(cstring_as_cstr(s), s->buf.len - 1);
+}
+
+void rcstr_drop(struct rcstr *self)
+{
+        if (self == NULL) {
+                return;
+        }
+        // Release our writes to the string, and acquire everyone else's before
+        // freeing it
+        if (__atomic_sub_fetch(&self->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+                free(self);
+        }
+}
+
+str rcstr_as_str(struct rcstr *self)
+{
+        return str_new_unchecked((uint8_t *)self->data, (uint8_t *)self->data + self->len);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "./cstring.h"
+
+/**
+ * An immutable, atomically reference counted string. The count, the length
+ * and the (null-terminated) bytes share one allocation, so a string costs a
+ * single `malloc()` however many places hold on to it.
+ *
+ * Holders each own one reference: `rcstr_clone()` takes another and
+ * `rcstr_drop()` releases one, freeing the string with the last. Both are a
+ * single atomic operation, so references can be passed between threads, but
+ * the bytes can never change.
+ *
+ * # Example
+ *
+ * ```c
+ * struct rcstr *msg = rcstr_new("hello", 5);
+ * DEQUE_PUSH_BACK(&alice_queue, struct rcstr *, rcstr_clone(msg));
+ * DEQUE_PUSH_BACK(&bob_queue, struct rcstr *, rcstr_clone(msg));
+ * rcstr_drop(msg);
+ * ```
+ */
+struct rcstr {
+        size_t refs;
+        size_t len;
+        char data[];
+};
+
+/**
+ * Copy `len` bytes into a new string, with a reference count of `1`.
+ *
+ * # Safety
+ * - The bytes should be valid utf8, like those of a `cstring`.
+ */
+struct rcstr *rcstr_new(char const *bytes, size_t len);
+
+/**
+ * `rcstr_new()` with the bytes of a cstr.
+ */
+struct rcstr *rcstr_from_cstr(char const *cstr);
+
+/**
+ * `rcstr_new()` with the bytes of a `cstring`.
+ */
+struct rcstr *rcstr_from_cstring(struct cstring const *s);
+
+/**
+ * Take another reference to `self`, and return it.
+ */
+static inline struct rcstr *rcstr_clone(struct rcstr *self)
+{
+        __atomic_add_fetch(&self->refs, 1, __ATOMIC_RELAXED);
+        return self;
+}
+
+/**
+ * Release a reference to `self`, freeing it if it was the last. Does nothing
+ * if `self` is `NULL`.
+ */
+void rcstr_drop(struct rcstr *self);
+
+/**
+ * The bytes of this string, null-terminated.
+ */
+static inline char const *rcstr_as_cstr(struct rcstr const *self)
+{
+        return self->data;
+}
+
+/**
+ * The length of this string in bytes, not counting the null-byte.
+ */
+static inline size_t rcstr_length(struct rcstr const *self)
+{
+        return self->len;
+}
+
+/**
+ * View this string as a `str`. Valid for as long as the reference is held.
+ */
+str rcstr_as_str(struct rcstr *self);
@@ -0,0 +1,213 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "./ryu.h"
+#include "./ryu_table.h"
+
+#define DOUBLE_MANTISSA_BITS 52
+#define DOUBLE_BIAS 1023
+#define FLOAT_MANTISSA_BITS 23
+#define FLOAT_BIAS 127
+#define POW5_INV_BITCOUNT 125
+#define POW5_BITCOUNT 125
+
+/** Bit width of `5^e`, i.e. `ceil(log2(5^e))`, and `1` for `e = 0` */
+static inline int32_t pow5bits(int32_t e)
+{
+        return ((e * 1217359) >> 19) + 1;
+}
+
+/** `floor(log10(2^e))`, for `0 <= e <= 1650` */
+static inline int32_t log10_pow2(int32_t e)
+{
+        return (e * 78913) >> 18;
+}
+
+/** `floor(log10(5^e))`, for `0 <= e <= 2620` */
+static inline int32_t log10_pow5(int32_t e)
+{
+        return (e * 732923) >> 20;
+}
+
+static inline bool multiple_of_pow5(uint64_t v, int32_t p)
+{
+        int32_t count = 0;
+        for (; v % 5 == 0; v /= 5) {
+                count++;
+        }
+        return count >= p;
+}
+
+static inline bool multiple_of_pow2(uint64_t v, int32_t p)
+{
+        return (v & ((1ull << p) - 1)) == 0;
+}
+
+/** `(m * mul) >> j`, where `mul` is 128 bits and `j >= 64` */
+static inline uint64_t mul_shift(uint64_t m, uint64_t const mul[2], int32_t j)
+{
+        unsigned __int128 lo = (unsigned __int128)m * mul[0];
+        unsigned __int128 hi = (unsigned __int128)m * mul[1];
+        return (uint64_t)(((lo >> 64) + hi) >> (j - 64));
+}
+
+/**
+ * The shortest decimal in the interval around `m2 * 2^e2`. `m2` and `e2` are
+ * the binary mantissa and exponent of the value, and `mm_shift` is whether
+ * the lower neighbour is the same distance away as the upper one (it is
+ * closer for powers of two, where the exponent steps down).
+ *
+ * Everything is scaled by 4 so that the bounds, which are half-way to each
+ * neighbour, are integers: `mv = 4 * m2` is the value, `mv + 2` the upper
+ * bound and `mv - 1 - mm_shift` the lower one.
+ */
+static struct ryu_decimal ryu_shortest(uint64_t m2, int32_t e2, bool mm_shift)
+{
+        // Round-to-even reads the bounds back as this value if it is even
+        bool accept_bounds = (m2 & 1) == 0;
+        uint64_t mv = 4 * m2;
+        e2 -= 2;
+
+        // Step 1: vr, vp and vm are the value and its bounds, multiplied by
+        // 10^-e10 and truncated. The vm/vr_trailing_zeros flags are whether
+        // the truncation dropped only zeros, which matters only when the
+        // power of 10 divides the value exactly.
+        uint64_t vr, vp, vm;
+        int32_t e10;
+        bool vm_trailing_zeros = false;
+        bool vr_trailing_zeros = false;
+        if (e2 >= 0) {
+                // Keep one more digit than strictly needed, so there is a
+                // removed digit to round with
+                int32_t q = log10_pow2(e2) - (e2 > 3);
+                int32_t k = POW5_INV_BITCOUNT + pow5bits(q) - 1;
+                int32_t i = -e2 + q + k;
+                e10 = q;
+                vr = mul_shift(mv, RYU_POW5_INV_SPLIT[q], i);
+                vp = mul_shift(mv + 2, RYU_POW5_INV_SPLIT[q], i);
+                vm = mul_shift(mv - 1 - mm_shift, RYU_POW5_INV_SPLIT[q], i);
+                // 5^22 is more than 2^53 * 4, so no larger power can divide
+                if (q <= 21) {
+                        if (mv % 5 == 0) {
+                                vr_trailing_zeros = multiple_of_pow5(mv, q);
+                        } else if (accept_bounds) {
+                                vm_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+                        } else {
+                                vp -= multiple_of_pow5(mv + 2, q);
+                        }
+                }
+        } else {
+                int32_t q = log10_pow5(-e2) - (-e2 > 1);
+                int32_t i = -e2 - q;
+                int32_t k = pow5bits(i) - POW5_BITCOUNT;
+                int32_t j = q - k;
+                e10 = q + e2;
+                vr = mul_shift(mv, RYU_POW5_SPLIT[i], j);
+                vp = mul_shift(mv + 2, RYU_POW5_SPLIT[i], j);
+                vm = mul_shift(mv - 1 - mm_shift, RYU_POW5_SPLIT[i], j);
+                if (q <= 1) {
+                        // mv has at least two trailing zero bits, mv + 2 at
+                        // least one, and mv - 1 - mm_shift one iff mm_shift
+                        vr_trailing_zeros = true;
+                        if (accept_bounds) {
+                                vm_trailing_zeros = mm_shift;
+                        } else {
+                                vp--;
+                        }
+                } else if (q < 63) {
+                        vr_trailing_zeros = multiple_of_pow2(mv, q);
+                }
+        }
+
+        // Step 2: remove the digits that vp and vm agree on. lastRemoved is
+        // the last digit taken off vr, to round with.
+        int32_t removed = 0;
+        uint64_t output;
+        if (vm_trailing_zeros || vr_trailing_zeros) {
+                // The exact case, which is rare: vm may be exactly on the
+                // boundary, and vr may be exactly half-way
+                uint8_t last_removed = 0;
+                while (vp / 10 > vm / 10) {
+                        vm_trailing_zeros &= vm % 10 == 0;
+                        vr_trailing_zeros &= last_removed == 0;
+                        last_removed = (uint8_t)(vr % 10);
+                        vr /= 10;
+                        vp /= 10;
+                        vm /= 10;
+                        removed++;
+                }
+                if (vm_trailing_zeros) {
+                        while (vm % 10 == 0) {
+                                vr_trailing_zeros &= last_removed == 0;
+                                last_removed = (uint8_t)(vr % 10);
+                                vr /= 10;
+                                vp /= 10;
+                                vm /= 10;
+                                removed++;
+                        }
+                }
+                if (vr_trailing_zeros && last_removed == 5 && vr % 2 == 0) {
+                        // Exactly half-way, so round to even
+                        last_removed = 4;
+                }
+                output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) ||
+                               last_removed >= 5);
+        } else {
+                bool round_up = false;
+                // Usually at least two digits go, so try that first
+                if (vp / 100 > vm / 100) {
+                        round_up = vr % 100 >= 50;
+                        vr /= 100;
+                        vp /= 100;
+                        vm /= 100;
+                        removed += 2;
+                }
+                while (vp / 10 > vm / 10) {
+                        round_up = vr % 10 >= 5;
+                        vr /= 10;
+                        vp /= 10;
+                        vm /= 10;
+                        removed++;
+                }
+                output = vr + (vr == vm || round_up);
+        }
+
+        // Step 3: Ryu can leave trailing zeros when the value is an integer
+        // (or close to one), which we promise not to
+        int32_t exponent = e10 + removed;
+        while (output % 10 == 0) {
+                output /= 10;
+                exponent++;
+        }
+        return (struct ryu_decimal){ .mantissa = output, .exponent = exponent };
+}
+
+struct ryu_decimal ryu_d2d(double value)
+{
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        uint64_t mantissa = bits & ((1ull << DOUBLE_MANTISSA_BITS) - 1);
+        int32_t exponent = (int32_t)((bits >> DOUBLE_MANTISSA_BITS) & 0x7ff);
+        // Subnormals have the exponent of the smallest normal, and no
+        // implicit leading 1
+        uint64_t m2 = exponent ? mantissa | 1ull << DOUBLE_MANTISSA_BITS : mantissa;
+        int32_t e2 = (exponent ? exponent : 1) - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS;
+        return ryu_shortest(m2, e2, mantissa != 0 || exponent <= 1);
+}
+
+/*
+ * A float is just a double with a narrower mantissa and exponent range, so it
+ * goes through the double code and tables: the multiplications are exact for
+ * any 55-bit `mv` in the double exponent range, which covers every float.
+ * Only the bounds differ, since they depend on the float's neighbours.
+ */
+struct ryu_decimal ryu_f2d(float value)
+{
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        uint32_t mantissa = bits & ((1u << FLOAT_MANTISSA_BITS) - 1);
+        int32_t exponent = (int32_t)((bits >> FLOAT_MANTISSA_BITS) & 0xff);
+        uint64_t m2 = exponent ? mantissa | 1u << FLOAT_MANTISSA_BITS : mantissa;
+        int32_t e2 = (exponent ? exponent : 1) - FLOAT_BIAS - FLOAT_MANTISSA_BITS;
+        return ryu_shortest(m2, e2, mantissa != 0 || exponent <= 1);
+}
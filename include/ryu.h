@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * A finite, non-zero floating point magnitude as `mantissa * 10^exponent`,
+ * where the mantissa has no trailing zeros.
+ */
+struct ryu_decimal {
+        uint64_t mantissa;
+        int32_t exponent;
+};
+
+/**
+ * The shortest decimal that reads back as `value`: the one with the fewest
+ * digits that lies strictly between `value` and its neighbours (or on the
+ * boundary, when the mantissa is even and round-to-even would pick `value`).
+ * Ties between equally short decimals go to the closest one.
+ *
+ * This is Ryu (Adams, "Ryū: Fast Float-to-String Conversion"), which computes
+ * the decimal interval around `value` with one 64x128-bit multiplication per
+ * bound, from a table of powers of 5, and then strips digits that all three
+ * bounds agree on. No big integers and no loop over candidate lengths.
+ *
+ * # Safety
+ * - `value` must be finite, and must not be zero. The sign is ignored.
+ */
+struct ryu_decimal ryu_d2d(double value);
+
+/**
+ * `ryu_d2d()` for a `float`, i.e. the shortest decimal that reads back as
+ * `value` with `strtof()`. This has at most 9 digits, where a `double` can
+ * need 17.
+ *
+ * # Safety
+ * - `value` must be finite, and must not be zero. The sign is ignored.
+ */
+struct ryu_decimal ryu_f2d(float value);
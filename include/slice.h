@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/types.h>
 
 /**
  * A more sane generic slice type. For example, we can use this type to 
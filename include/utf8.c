@@ -0,0 +1,343 @@
+#include <string.h>
+
+#include "./utf8.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define UTF8_X86 1
+#include <immintrin.h>
+#endif
+
+static bool utf8_validate_scalar(uint8_t const *buf, size_t len)
+{
+        size_t i = 0;
+        while (i < len) {
+                // Skip ASCII a word at a time
+                if (len - i >= 8) {
+                        uint64_t word;
+                        memcpy(&word, buf + i, sizeof word);
+                        if ((word & 0x8080808080808080) == 0) {
+                                i += 8;
+                                continue;
+                        }
+                }
+                uint8_t b = buf[i];
+                if (b < 0x80) {
+                        i++;
+                        continue;
+                }
+                // Number of continuation bytes, and the range of the first one
+                size_t n;
+                uint8_t lo = 0x80, hi = 0xbf;
+                if (b >= 0xc2 && b <= 0xdf) {
+                        n = 1;
+                } else if (b == 0xe0) {
+                        n = 2;
+                        lo = 0xa0; // overlong
+                } else if (b == 0xed) {
+                        n = 2;
+                        hi = 0x9f; // surrogates
+                } else if (b >= 0xe1 && b <= 0xef) {
+                        n = 2;
+                } else if (b == 0xf0) {
+                        n = 3;
+                        lo = 0x90; // overlong
+                } else if (b >= 0xf1 && b <= 0xf3) {
+                        n = 3;
+                } else if (b == 0xf4) {
+                        n = 3;
+                        hi = 0x8f; // above U+10FFFF
+                } else {
+                        return false;
+                }
+                if (len - i - 1 < n || buf[i + 1] < lo || buf[i + 1] > hi) {
+                        return false;
+                }
+                for (size_t j = 2; j <= n; ++j) {
+                        if ((buf[i + j] & 0xc0) != 0x80) {
+                                return false;
+                        }
+                }
+                i += n + 1;
+        }
+        return true;
+}
+
+static size_t utf8_count_scalar(uint8_t const *buf, size_t len)
+{
+        size_t count = 0;
+        for (size_t i = 0; i < len; ++i) {
+                count += (int8_t)buf[i] > -65;
+        }
+        return count;
+}
+
+#ifdef UTF8_X86
+
+/*
+ * Error classes of a (previous byte, byte) pair. A pair is invalid when the
+ * three lookups below agree on some class. See the paper cited on
+ * `utf8_validate()`.
+ */
+#define TOO_SHORT (1 << 0)
+#define TOO_LONG (1 << 1)
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE (1 << 3)
+#define SURROGATE (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTS (1 << 7)
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+/** Indexed by the high nibble of the previous byte */
+#define BYTE_1_HIGH                                                                     \
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, \
+                TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS, TOO_SHORT | OVERLONG_2,     \
+                TOO_SHORT, TOO_SHORT | OVERLONG_3 | SURROGATE,                          \
+                (char)(TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4)
+
+/** Indexed by the low nibble of the previous byte */
+#define BYTE_1_LOW                                                                          \
+        (char)(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4), (char)(CARRY | OVERLONG_2), \
+                (char)CARRY, (char)CARRY, (char)(CARRY | TOO_LARGE),                        \
+                (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),                                 \
+                (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),                                 \
+                (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),                                 \
+                (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),                                 \
+                (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),                                 \
+                (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),                                 \
+                (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),                                 \
+                (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),                                 \
+                (char)(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE),                     \
+                (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),                                 \
+                (char)(CARRY | TOO_LARGE | TOO_LARGE_1000)
+
+/** Indexed by the high nibble of the current byte */
+#define BYTE_2_HIGH                                                                            \
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, \
+                (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 |         \
+                       OVERLONG_4),                                                             \
+                (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),              \
+                (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),               \
+                (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),               \
+                TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+
+/*
+ * The blocks are checked one at a time, carrying the previous block (for the
+ * pairs that straddle the boundary) and whether it ended in the middle of a
+ * sequence.
+ */
+struct utf8_state_sse {
+        __m128i prev_input;
+        __m128i prev_incomplete;
+        __m128i error;
+};
+
+__attribute__((target("ssse3"))) static inline void utf8_step_ssse3(struct utf8_state_sse *s,
+                                                                    __m128i input)
+{
+        if (_mm_movemask_epi8(input) == 0) {
+                // All ASCII: only an unfinished sequence before this is wrong
+                s->error = _mm_or_si128(s->error, s->prev_incomplete);
+                s->prev_input = input;
+                return;
+        }
+        __m128i nibble = _mm_set1_epi8(0x0f);
+        __m128i prev1 = _mm_alignr_epi8(input, s->prev_input, 15);
+        __m128i byte_1_high = _mm_shuffle_epi8(
+                _mm_setr_epi8(BYTE_1_HIGH), _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+        __m128i byte_1_low =
+                _mm_shuffle_epi8(_mm_setr_epi8(BYTE_1_LOW), _mm_and_si128(prev1, nibble));
+        __m128i byte_2_high = _mm_shuffle_epi8(
+                _mm_setr_epi8(BYTE_2_HIGH), _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+        __m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+        // Third and fourth bytes of 3 and 4 byte sequences must be continuations
+        __m128i prev2 = _mm_alignr_epi8(input, s->prev_input, 14);
+        __m128i prev3 = _mm_alignr_epi8(input, s->prev_input, 13);
+        __m128i is_third = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xe0 - 1)));
+        __m128i is_fourth = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xf0 - 1)));
+        __m128i must23 = _mm_cmpgt_epi8(_mm_or_si128(is_third, is_fourth), _mm_setzero_si128());
+        __m128i must23_80 = _mm_and_si128(must23, _mm_set1_epi8((char)0x80));
+        s->error = _mm_or_si128(s->error, _mm_xor_si128(must23_80, special));
+
+        __m128i max = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                    (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+        s->prev_incomplete = _mm_subs_epu8(input, max);
+        s->prev_input = input;
+}
+
+__attribute__((target("ssse3"))) static bool utf8_validate_ssse3(uint8_t const *buf, size_t len)
+{
+        struct utf8_state_sse s = { _mm_setzero_si128(), _mm_setzero_si128(),
+                                    _mm_setzero_si128() };
+        size_t i = 0;
+        for (; len - i >= 16; i += 16) {
+                utf8_step_ssse3(&s, _mm_loadu_si128((__m128i const *)(buf + i)));
+        }
+        if (i < len) {
+                // Zero padding is ASCII, so a truncated sequence fails here
+                uint8_t tail[16] = { 0 };
+                memcpy(tail, buf + i, len - i);
+                utf8_step_ssse3(&s, _mm_loadu_si128((__m128i const *)tail));
+        }
+        __m128i error = _mm_or_si128(s.error, s.prev_incomplete);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xffff;
+}
+
+struct utf8_state_avx2 {
+        __m256i prev_input;
+        __m256i prev_incomplete;
+        __m256i error;
+};
+
+/** The 32 bytes ending `n` bytes before the end of `input` */
+#define PREV_AVX2(input, prev_input, n) \
+        _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev_input, input, 0x21), 16 - (n))
+
+__attribute__((target("avx2"))) static inline void utf8_step_avx2(struct utf8_state_avx2 *s,
+                                                                  __m256i input)
+{
+        if (_mm256_movemask_epi8(input) == 0) {
+                s->error = _mm256_or_si256(s->error, s->prev_incomplete);
+                s->prev_input = input;
+                return;
+        }
+        __m256i nibble = _mm256_set1_epi8(0x0f);
+        __m256i prev1 = PREV_AVX2(input, s->prev_input, 1);
+        __m256i byte_1_high =
+                _mm256_shuffle_epi8(_mm256_setr_epi8(BYTE_1_HIGH, BYTE_1_HIGH),
+                                    _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+        __m256i byte_1_low = _mm256_shuffle_epi8(_mm256_setr_epi8(BYTE_1_LOW, BYTE_1_LOW),
+                                                 _mm256_and_si256(prev1, nibble));
+        __m256i byte_2_high =
+                _mm256_shuffle_epi8(_mm256_setr_epi8(BYTE_2_HIGH, BYTE_2_HIGH),
+                                    _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+        __m256i special =
+                _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+        __m256i prev2 = PREV_AVX2(input, s->prev_input, 2);
+        __m256i prev3 = PREV_AVX2(input, s->prev_input, 3);
+        __m256i is_third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xe0 - 1)));
+        __m256i is_fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xf0 - 1)));
+        __m256i must23 =
+                _mm256_cmpgt_epi8(_mm256_or_si256(is_third, is_fourth), _mm256_setzero_si256());
+        __m256i must23_80 = _mm256_and_si256(must23, _mm256_set1_epi8((char)0x80));
+        s->error = _mm256_or_si256(s->error, _mm256_xor_si256(must23_80, special));
+
+        __m256i max = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                       -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                       (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+        s->prev_incomplete = _mm256_subs_epu8(input, max);
+        s->prev_input = input;
+}
+
+__attribute__((target("avx2"))) static bool utf8_validate_avx2(uint8_t const *buf, size_t len)
+{
+        struct utf8_state_avx2 s = { _mm256_setzero_si256(), _mm256_setzero_si256(),
+                                     _mm256_setzero_si256() };
+        size_t i = 0;
+        for (; len - i >= 32; i += 32) {
+                utf8_step_avx2(&s, _mm256_loadu_si256((__m256i const *)(buf + i)));
+        }
+        if (i < len) {
+                uint8_t tail[32] = { 0 };
+                memcpy(tail, buf + i, len - i);
+                utf8_step_avx2(&s, _mm256_loadu_si256((__m256i const *)tail));
+        }
+        __m256i error = _mm256_or_si256(s.error, s.prev_incomplete);
+        return _mm256_testz_si256(error, error);
+}
+
+/* Every byte that is not a continuation byte (0x80..0xbf) starts a codepoint */
+
+static size_t utf8_count_sse2(uint8_t const *buf, size_t len)
+{
+        size_t count = 0;
+        size_t i = 0;
+        for (; len - i >= 16; i += 16) {
+                __m128i input = _mm_loadu_si128((__m128i const *)(buf + i));
+                __m128i starts = _mm_cmpgt_epi8(input, _mm_set1_epi8(-65));
+                count += __builtin_popcount(_mm_movemask_epi8(starts));
+        }
+        return count + utf8_count_scalar(buf + i, len - i);
+}
+
+__attribute__((target("avx2,popcnt"))) static size_t utf8_count_avx2(uint8_t const *buf,
+                                                                     size_t len)
+{
+        size_t count = 0;
+        size_t i = 0;
+        for (; len - i >= 32; i += 32) {
+                __m256i input = _mm256_loadu_si256((__m256i const *)(buf + i));
+                __m256i starts = _mm256_cmpgt_epi8(input, _mm256_set1_epi8(-65));
+                count += __builtin_popcount((unsigned)_mm256_movemask_epi8(starts));
+        }
+        return count + utf8_count_scalar(buf + i, len - i);
+}
+
+#endif /* UTF8_X86 */
+
+/*
+ * Runtime dispatch: the first call picks an implementation and caches it.
+ */
+
+static struct utf8_kernel const utf8_all_kernels[] = {
+        { "scalar", utf8_validate_scalar, utf8_count_scalar },
+#ifdef UTF8_X86
+        { "ssse3", utf8_validate_ssse3, utf8_count_sse2 },
+        { "avx2", utf8_validate_avx2, utf8_count_avx2 },
+#endif
+};
+
+size_t utf8_kernels(struct utf8_kernel const **kernels)
+{
+        size_t n = 1;
+#ifdef UTF8_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+                n = 3;
+        } else if (__builtin_cpu_supports("ssse3")) {
+                n = 2;
+        }
+#endif
+        *kernels = utf8_all_kernels;
+        return n;
+}
+
+typedef bool (*utf8_validate_fn)(uint8_t const *, size_t);
+typedef size_t (*utf8_count_fn)(uint8_t const *, size_t);
+
+static bool utf8_validate_resolve(uint8_t const *buf, size_t len);
+static size_t utf8_count_resolve(uint8_t const *buf, size_t len);
+
+static utf8_validate_fn utf8_validate_impl = utf8_validate_resolve;
+static utf8_count_fn utf8_count_impl = utf8_count_resolve;
+
+static bool utf8_validate_resolve(uint8_t const *buf, size_t len)
+{
+        struct utf8_kernel const *kernels;
+        size_t n = utf8_kernels(&kernels);
+        utf8_validate_fn fn = kernels[n - 1].validate;
+        __atomic_store_n(&utf8_validate_impl, fn, __ATOMIC_RELAXED);
+        return fn(buf, len);
+}
+
+static size_t utf8_count_resolve(uint8_t const *buf, size_t len)
+{
+        struct utf8_kernel const *kernels;
+        size_t n = utf8_kernels(&kernels);
+        utf8_count_fn fn = kernels[n - 1].count;
+        __atomic_store_n(&utf8_count_impl, fn, __ATOMIC_RELAXED);
+        return fn(buf, len);
+}
+
+bool utf8_validate(uint8_t const *buf, size_t len)
+{
+        return __atomic_load_n(&utf8_validate_impl, __ATOMIC_RELAXED)(buf, len);
+}
+
+size_t utf8_count(uint8_t const *buf, size_t len)
+{
+        return __atomic_load_n(&utf8_count_impl, __ATOMIC_RELAXED)(buf, len);
+}
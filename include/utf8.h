@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Check that `len` bytes at `buf` are well-formed utf8: no overlong encodings,
+ * no surrogates, nothing above `U+10FFFF` and no truncated sequences.
+ *
+ * This is the lookup-table algorithm from simdjson (Keiser and Lemire,
+ * "Validating UTF-8 In Less Than One Instruction Per Byte"), which classifies
+ * every byte and the one before it with three 16-entry table lookups, rather
+ * than decoding. The implementation is picked at runtime: AVX2 if the CPU has
+ * it, then SSSE3, then a scalar decoder.
+ */
+bool utf8_validate(uint8_t const *buf, size_t len);
+
+/**
+ * Count the codepoints in `len` bytes of valid utf8 at `buf`, i.e. the bytes
+ * that are not continuation bytes. Vectorized like `utf8_validate()`.
+ *
+ * # Safety
+ * - `buf` must be valid utf8, or the result is meaningless (but not UB).
+ */
+size_t utf8_count(uint8_t const *buf, size_t len);
+
+/** One implementation of `utf8_validate()` and `utf8_count()` */
+struct utf8_kernel {
+        char const *name;
+        bool (*validate)(uint8_t const *buf, size_t len);
+        size_t (*count)(uint8_t const *buf, size_t len);
+};
+
+/**
+ * The implementations this CPU can run, for tests to compare: the scalar one
+ * first, and last the one `utf8_validate()` and `utf8_count()` use.
+ *
+ * # Returns
+ * - how many there are, at `*kernels`
+ */
+size_t utf8_kernels(struct utf8_kernel const **kernels);
+
+/**
+ * Decode the codepoint starting at `*it`, advancing `*it` past it.
+ *
+ * # Safety
+ * - `*it` must point to the start of a valid utf8 sequence.
+ */
+static inline uint32_t utf8_decode(uint8_t const **it)
+{
+        uint8_t const *p = *it;
+        uint32_t b0 = p[0];
+        if (b0 < 0x80) {
+                *it = p + 1;
+                return b0;
+        } else if (b0 < 0xe0) {
+                *it = p + 2;
+                return (b0 & 0x1f) << 6 | (p[1] & 0x3f);
+        } else if (b0 < 0xf0) {
+                *it = p + 3;
+                return (b0 & 0x0f) << 12 | (p[1] & 0x3f) << 6 | (p[2] & 0x3f);
+        } else {
+                *it = p + 4;
+                return (b0 & 0x07) << 18 | (p[1] & 0x3f) << 12 | (p[2] & 0x3f) << 6 |
+                       (p[3] & 0x3f);
+        }
+}
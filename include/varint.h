@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Longest encoding of a 64-bit varint: 7 bits per byte.
+ */
+#define VARINT_MAX 10
+
+/*
+ * Unsigned LEB128 varints: 7 bits per byte, least significant group first,
+ * with the top bit set on every byte but the last. Values below 128 take one
+ * byte, which for lengths and ids is almost all of them.
+ */
+
+/** Number of bytes `varint_encode()` writes for `v` */
+static inline size_t varint_length(uint64_t v)
+{
+        unsigned bits = 64 - __builtin_clzll(v | 1);
+        return (bits + 6) / 7;
+}
+
+/**
+ * Write `v` to `out`, which must have room for `VARINT_MAX` bytes, and return
+ * the number of bytes written.
+ */
+static inline size_t varint_encode(uint8_t *out, uint64_t v)
+{
+        size_t len = 0;
+        while (v >= 0x80) {
+                out[len++] = (uint8_t)v | 0x80;
+                v >>= 7;
+        }
+        out[len++] = (uint8_t)v;
+        return len;
+}
+
+/**
+ * Read a varint from `*it`, advancing `*it` past it. Reads nothing past
+ * `end`.
+ *
+ * # Returns
+ * - `false` if the varint runs past `end`, or is longer than `VARINT_MAX`
+ *   bytes. `*it` is left where it was.
+ */
+static inline bool varint_decode(uint8_t const **it, uint8_t const *end, uint64_t *v)
+{
+        uint64_t result = 0;
+        uint8_t const *p = *it;
+        for (unsigned shift = 0; p != end && shift < 7 * VARINT_MAX; shift += 7) {
+                uint8_t byte = *p++;
+                result |= (uint64_t)(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) {
+                        *it = p;
+                        *v = result;
+                        return true;
+                }
+        }
+        return false;
+}
@@ -0,0 +1,223 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+
+#include "attachment.h"
+#include "../include/panic.h"
+
+/** Write the filename of an upload in progress, `<id>.part`, to `out` */
+static void upload_partname(char *out, char const *id)
+{
+        snprintf(out, NAME_MAX + 1, "%s.part", id);
+}
+
+/** Whether `id` could be an attachment id, so it is safe as a filename */
+static bool attachment_valid_id(char const *id)
+{
+        size_t len = strspn(id, "0123456789abcdef");
+        return len == ATTACHMENT_ID_LEN && id[len] == '\0';
+}
+
+/** Whether an attachment last written at `mtime` is past `ATTACHMENT_TTL` */
+static bool attachment_expired(time_t mtime, time_t now)
+{
+        return now - mtime >= ATTACHMENT_TTL;
+}
+
+/**
+ * Remove the attachments that have expired, and `.part` files too if
+ * `parts`, and count the bytes of the rest as `stored`.
+ *
+ * # Returns
+ * - `-1` for failure and set `errno`
+ * - `0` for success
+ */
+static int attachments_sweep(struct attachments *self, bool parts)
+{
+        // Our own descriptor, since reading a directory moves its offset
+        int fd = openat(self->dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR *dir = fd == -1 ? NULL : fdopendir(fd);
+        if (dir == NULL) return -1;
+        time_t now = time(NULL);
+        off_t stored = 0;
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL) {
+                char const *dot = strchr(ent->d_name, '.');
+                if (dot) {
+                        if (parts && strcmp(dot, ".part") == 0) {
+                                unlinkat(self->dirfd, ent->d_name, 0);
+                        }
+                        continue;
+                }
+                struct stat st;
+                if (!attachment_valid_id(ent->d_name) ||
+                    fstatat(self->dirfd, ent->d_name, &st, 0) == -1) {
+                        continue;
+                }
+                if (attachment_expired(st.st_mtime, now)) {
+                        unlinkat(self->dirfd, ent->d_name, 0);
+                        continue;
+                }
+                stored += st.st_size;
+        }
+        closedir(dir);
+        self->stored = stored;
+        return 0;
+}
+
+int attachments_open(struct attachments *self, char const *dir)
+{
+        if (mkdir(dir, 0700) == -1 && errno != EEXIST) return -1;
+        if ((self->dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) return -1;
+        self->stored = 0;
+        self->reserved = 0;
+        return attachments_sweep(self, true);
+}
+
+int upload_begin(struct attachments *self, struct sockclient *client, off_t size)
+{
+        if (size <= 0 || size > ATTACHMENT_MAX) {
+                errno = EFBIG;
+                return -1;
+        }
+        if (self->stored + self->reserved + size > ATTACHMENT_QUOTA) {
+                // Expired attachments only take up room until it is wanted
+                if (attachments_sweep(self, false) == -1) return -1;
+                if (self->stored + self->reserved + size > ATTACHMENT_QUOTA) {
+                        errno = EDQUOT;
+                        return -1;
+                }
+        }
+        struct upload *upload = malloc(sizeof *upload);
+        if (upload == NULL) {
+                PANIC("malloc() returned NULL");
+        }
+        uint64_t id;
+        if (getrandom(&id, sizeof id, 0) == -1) {
+                PANIC("getrandom() failed: %s", strerror(errno));
+        }
+        for (size_t i = 0; i < ATTACHMENT_ID_LEN; ++i) {
+                upload->id[i] = "0123456789abcdef"[(id >> (60 - 4 * i)) & 0xf];
+        }
+        upload->id[ATTACHMENT_ID_LEN] = '\0';
+        upload->offset = 0;
+        upload->size = size;
+
+        char partname[NAME_MAX + 1];
+        upload_partname(partname, upload->id);
+        upload->fd = openat(self->dirfd, partname, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (upload->fd == -1) {
+                free(upload);
+                return -1;
+        }
+        if (pipe2(upload->pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+                int err = errno;
+                close(upload->fd);
+                unlinkat(self->dirfd, partname, 0);
+                free(upload);
+                errno = err;
+                return -1;
+        }
+        client->upload = upload;
+        self->reserved += size;
+        return 0;
+}
+
+/** Close the descriptors of the upload of `client`, and forget it */
+static void upload_free(struct sockclient *client)
+{
+        close(client->upload->pipe[0]);
+        close(client->upload->pipe[1]);
+        close(client->upload->fd);
+        free(client->upload);
+        client->upload = NULL;
+}
+
+void upload_abort(struct attachments *self, struct sockclient *client)
+{
+        if (client->upload == NULL) {
+                return;
+        }
+        char partname[NAME_MAX + 1];
+        upload_partname(partname, client->upload->id);
+        unlinkat(self->dirfd, partname, 0);
+        self->reserved -= client->upload->size;
+        upload_free(client);
+}
+
+int upload_receive(struct attachments *self, struct sockclient *client)
+{
+        struct upload *upload = client->upload;
+        size_t want = (size_t)(upload->size - upload->offset);
+        if (want > ATTACHMENT_CHUNK) {
+                want = ATTACHMENT_CHUNK;
+        }
+        ssize_t n = splice(client->sockfd, NULL, upload->pipe[1], NULL, want,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == -1 && errno == EAGAIN) {
+                return 0;
+        }
+        if (n <= 0) {
+                goto fail;
+        }
+        // The pipe holds all of it, so this never waits on the socket
+        for (ssize_t left = n; left > 0;) {
+                ssize_t moved = splice(upload->pipe[0], NULL, upload->fd, &upload->offset,
+                                       (size_t)left, SPLICE_F_MOVE);
+                if (moved <= 0) {
+                        goto fail;
+                }
+                left -= moved;
+        }
+        if (upload->offset < upload->size) {
+                return 0;
+        }
+        char partname[NAME_MAX + 1];
+        upload_partname(partname, upload->id);
+        if (renameat(self->dirfd, partname, self->dirfd, upload->id) == -1) {
+                goto fail;
+        }
+        self->reserved -= upload->size;
+        self->stored += upload->size;
+        upload_free(client);
+        return 1;
+fail:
+        upload_abort(self, client);
+        return -1;
+}
+
+int attachment_open(struct attachments *self, char const *id, off_t *size)
+{
+        if (!attachment_valid_id(id)) {
+                errno = ENOENT;
+                return -1;
+        }
+        int fd = openat(self->dirfd, id, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) return -1;
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+                int err = errno;
+                close(fd);
+                errno = err;
+                return -1;
+        }
+        if (attachment_expired(st.st_mtime, time(NULL))) {
+                close(fd);
+                if (unlinkat(self->dirfd, id, 0) == 0) {
+                        self->stored -= st.st_size;
+                }
+                errno = ENOENT;
+                return -1;
+        }
+        *size = st.st_size;
+        return fd;
+}
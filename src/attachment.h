@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "main.h"
+
+/** Largest attachment, in bytes */
+#define ATTACHMENT_MAX (64 * 1024 * 1024)
+/** Most bytes of an upload moved per event, so other clients get a turn */
+#define ATTACHMENT_CHUNK (64 * 1024)
+/** Most bytes all attachments may take up, counting uploads in progress */
+#define ATTACHMENT_QUOTA ((off_t)1024 * 1024 * 1024)
+/** Seconds an attachment is kept after it was uploaded */
+#define ATTACHMENT_TTL (7 * 24 * 60 * 60)
+/** Length of an attachment's id: 16 hex digits */
+#define ATTACHMENT_ID_LEN 16
+
+/**
+ * Blobs clients hand each other: pastes, images, anything too big for a chat
+ * line. Each is a file in the attachment directory, named by its id, a
+ * random 64 bit number in hex, which the uploader shares however they like.
+ *
+ * The bytes never pass through the server's memory. An upload is moved from
+ * the socket into a pipe, and from the pipe into the file, with `splice()`,
+ * `ATTACHMENT_CHUNK` bytes per event, and staged as `<id>.part` until it is
+ * complete. A download is a `client_send_file()` of the whole file.
+ *
+ * Attachments expire `ATTACHMENT_TTL` after they were uploaded, and
+ * together may take up no more than `ATTACHMENT_QUOTA`. An upload reserves
+ * its whole size when it begins, and once the quota is full, expired
+ * attachments are removed to make room.
+ */
+struct attachments {
+        /** The attachment directory */
+        int dirfd;
+        /** Bytes of the complete attachments, expired or not */
+        off_t stored;
+        /** Bytes reserved by uploads in progress */
+        off_t reserved;
+};
+
+/** An upload in progress */
+struct upload {
+        /** Bytes on their way from the socket to `fd` */
+        int pipe[2];
+        /** The `.part` file */
+        int fd;
+        off_t offset;
+        off_t size;
+        char id[ATTACHMENT_ID_LEN + 1];
+};
+
+/**
+ * Use (and create, if need be) the directory `dir` for attachments, and
+ * remove any uploads that were cut off by a restart, and any attachments
+ * that have expired.
+ *
+ * # Returns
+ * - `-1` for failure and set `errno`
+ * - `0` for success
+ */
+int attachments_open(struct attachments *self, char const *dir);
+
+/**
+ * Get ready to receive `size` bytes from `client` into a new attachment.
+ * Until they have all arrived, whatever `client` sends is the attachment.
+ *
+ * # Returns
+ * - `-1` for failure and set `errno`. `EFBIG` means `size` is `0`, or over
+ *   `ATTACHMENT_MAX`. `EDQUOT` means there is no room for it under
+ *   `ATTACHMENT_QUOTA`.
+ * - `0` for success
+ */
+int upload_begin(struct attachments *self, struct sockclient *client, off_t size);
+
+/**
+ * Move what has arrived of the upload of `client`, up to `ATTACHMENT_CHUNK`
+ * bytes, into its file. Once it is complete the attachment is kept under
+ * its id, and `client->upload` is cleared.
+ *
+ * # Returns
+ * - `-1` if the upload failed, and was abandoned. The client hung up, or the
+ *   server couldn't write the file.
+ * - `0` if there is more to come
+ * - `1` if the upload is complete
+ */
+int upload_receive(struct attachments *self, struct sockclient *client);
+
+/** Abandon the upload of `client`, if it has one, and remove its file */
+void upload_abort(struct attachments *self, struct sockclient *client);
+
+/**
+ * Open the attachment `id` for reading, and write its size to `size`.
+ *
+ * # Returns
+ * - `-1` for failure and set `errno`. `ENOENT` means there is no such
+ *   attachment, or it has expired.
+ * - the file descriptor
+ */
+int attachment_open(struct attachments *self, char const *id, off_t *size);
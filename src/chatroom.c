@@ -0,0 +1,475 @@
+#include <sys/random.h>
+#include <sys/sendfile.h>
+
+#include "chatroom.h"
+#include "frame.h"
+#include "../include/cstring.h"
+#include "../include/fmt.h"
+#include "../include/panic.h"
+
+/** Inline storage for an outgoing message */
+#define SEND_INLINE_CAP 256
+
+DYNARRAY_DEFINE(clients, struct sockclient *)
+DYNARRAY_DEFINE(sessions, struct session)
+
+struct chatroom chatroom_new()
+{
+        struct chatroom self;
+        self.next_seq = 1;
+        self.backlog = deque_new();
+        self.clients = dynarray_new();
+        self.sessions = dynarray_new();
+        return self;
+}
+
+void chatroom_join(struct chatroom *self, struct sockclient *client)
+{
+        clients_push(&self->clients, client);
+}
+
+/** Forget sessions whose grace period is over */
+static void chatroom_expire_sessions(struct chatroom *self, time_t now)
+{
+        for (size_t i = 0; i < sessions_length(&self->sessions);) {
+                struct session *session = sessions_get(&self->sessions, (ssize_t)i);
+                if (now - session->detached_at < RESUME_GRACE) {
+                        ++i;
+                        continue;
+                }
+                rcstr_drop(session->name);
+                *session = *sessions_pop(&self->sessions);
+        }
+}
+
+void chatroom_leave(struct chatroom *self, struct sockclient *client)
+{
+        ratelimit_forget(&self->ratelimit, client);
+        upload_abort(&self->attachments, client);
+        size_t len = clients_length(&self->clients);
+        for (size_t i = 0; i < len; ++i) {
+                if (*clients_get(&self->clients, (ssize_t)i) == client) {
+                        *clients_get(&self->clients, (ssize_t)i) =
+                                *clients_get(&self->clients, -1);
+                        clients_pop(&self->clients);
+                        break;
+                }
+        }
+        time_t now = time(NULL);
+        chatroom_expire_sessions(self, now);
+        if (client->token) {
+                struct session session = {
+                        .token = client->token,
+                        .name = rcstr_clone(client->name),
+                        .detached_at = now,
+                };
+                sessions_push(&self->sessions, session);
+        }
+}
+
+struct sockclient *chatroom_find(struct chatroom *self, char const *name)
+{
+        size_t len = clients_length(&self->clients);
+        for (size_t i = 0; i < len; ++i) {
+                struct sockclient *client = *clients_get(&self->clients, (ssize_t)i);
+                if (client->token && strcmp(rcstr_as_cstr(client->name), name) == 0) {
+                        return client;
+                }
+        }
+        return NULL;
+}
+
+bool chatroom_name_taken(struct chatroom *self, struct sockclient const *client)
+{
+        size_t len = clients_length(&self->clients);
+        for (size_t i = 0; i < len; ++i) {
+                struct sockclient *other = *clients_get(&self->clients, (ssize_t)i);
+                if (other != client && other->token &&
+                    strcmp(rcstr_as_cstr(other->name), rcstr_as_cstr(client->name)) == 0) {
+                        return true;
+                }
+        }
+        return false;
+}
+
+void chatroom_open_session(struct chatroom *self, struct sockclient *client)
+{
+        (void)self;
+        // 0 means no session
+        do {
+                if (getrandom(&client->token, sizeof client->token, 0) == -1) {
+                        PANIC("getrandom() failed: %s", strerror(errno));
+                }
+        } while (client->token == 0);
+}
+
+/** Format `msg` once, as a line or as a `FRAME_MESSAGE`, to go to any number of clients */
+static struct rcstr *message_format(struct message const *msg, bool binary)
+{
+        CSTRING_INLINE(out, SEND_INLINE_CAP);
+        if (binary) {
+                size_t namelen = rcstr_length(msg->from);
+                struct frame_header hdr = {
+                        .len = varint_length(msg->seq) + varint_length(namelen) + namelen +
+                               rcstr_length(msg->text),
+                        .opcode = FRAME_MESSAGE,
+                };
+                uint8_t *it = (uint8_t *)fmt_reserve(&out, FRAME_HEADER_MAX + 2 * VARINT_MAX);
+                size_t len = frame_encode_header(it, &hdr);
+                len += varint_encode(it + len, msg->seq);
+                len += varint_encode(it + len, namelen);
+                fmt_commit(&out, len);
+                FMT(&out, msg->from, msg->text);
+        } else {
+                FMT(&out, msg->seq, " ", msg->from, ": ");
+                size_t text_start = out.buf.len - 1;
+                FMT(&out, msg->text, "\n");
+                // Text from binary clients can have newlines, which would
+                // forge lines here
+                char *data = out.buf.data;
+                for (size_t i = text_start; i < out.buf.len - 2; ++i) {
+                        if (data[i] == '\n') {
+                                data[i] = ' ';
+                        }
+                }
+        }
+        struct rcstr *formatted = rcstr_from_cstring(&out);
+        cstring_free(&out);
+        return formatted;
+}
+
+/** Send `msg` to `client`, as a line or a `FRAME_MESSAGE` */
+static void client_send_message(struct sockclient *client, struct message const *msg)
+{
+        struct rcstr *formatted = message_format(msg, client->flags & CLIENTBINARY);
+        client_send_shared(client, formatted);
+        rcstr_drop(formatted);
+}
+
+void chatroom_post(struct chatroom *self, struct rcstr *from, struct rcstr *text)
+{
+        if (deque_length(&self->backlog) == BACKLOG_CAP) {
+                struct message old = DEQUE_POP_FRONT(&self->backlog, struct message);
+                rcstr_drop(old.from);
+                rcstr_drop(old.text);
+        }
+        struct message msg = { .seq = self->next_seq++, .from = rcstr_clone(from), .text = text };
+        DEQUE_PUSH_BACK(&self->backlog, struct message, msg);
+        history_append(&self->history, msg.seq, msg.from, msg.text);
+        search_add(&self->search, msg.seq, msg.text);
+
+        // Formatted once for each protocol, when the first client that speaks
+        // it is reached, and shared by all of them
+        struct rcstr *line = NULL;
+        struct rcstr *frame = NULL;
+        size_t len = clients_length(&self->clients);
+        for (size_t i = 0; i < len; ++i) {
+                struct sockclient *client = *clients_get(&self->clients, (ssize_t)i);
+                if (!client->token) {
+                        continue;
+                }
+                struct rcstr **formatted = client->flags & CLIENTBINARY ? &frame : &line;
+                if (*formatted == NULL) {
+                        *formatted = message_format(&msg, client->flags & CLIENTBINARY);
+                }
+                client_send_shared(client, *formatted);
+        }
+        rcstr_drop(line);
+        rcstr_drop(frame);
+}
+
+/**
+ * Send `client` the messages `[from, to)` from the history log, for a resume
+ * that reaches back further than the backlog
+ */
+static void chatroom_replay_log(struct chatroom *self, struct sockclient *client, uint64_t from,
+                                uint64_t to)
+{
+        off_t begin, end, unused;
+        if (!history_find(&self->history, from, &begin, &unused)) {
+                return;
+        }
+        // `to` is the oldest message in the backlog, if there is one
+        if (!history_find(&self->history, to, &end, &unused)) {
+                end = self->history.size;
+        }
+        int fd = dup(self->history.fd);
+        if (fd == -1) {
+                return;
+        }
+        client_send_log(client, fd, begin, end);
+}
+
+bool chatroom_resume(struct chatroom *self, struct sockclient *client, uint64_t token,
+                     uint64_t last_seq)
+{
+        chatroom_expire_sessions(self, time(NULL));
+        size_t i = 0;
+        size_t nr_sessions = sessions_length(&self->sessions);
+        while (i < nr_sessions && sessions_get(&self->sessions, (ssize_t)i)->token != token) {
+                ++i;
+        }
+        if (token == 0 || i == nr_sessions) {
+                return false;
+        }
+        struct session *session = sessions_get(&self->sessions, (ssize_t)i);
+        rcstr_drop(client->name);
+        client->name = session->name;
+        client->token = token;
+        *session = *sessions_pop(&self->sessions);
+
+        client_reply(client, "+resumed");
+        // The backlog holds [first, next_seq)
+        size_t backlog_len = deque_length(&self->backlog);
+        uint64_t first = self->next_seq - backlog_len;
+        if (last_seq + 1 < first) {
+                chatroom_replay_log(self, client, last_seq + 1, first);
+        }
+        size_t start = last_seq < first ? 0 : last_seq + 1 - first;
+        for (size_t j = start; j < backlog_len; ++j) {
+                client_send_message(client, deque_get(&self->backlog, TYPEINFO(struct message), j));
+        }
+        return true;
+}
+
+/** Disconnect `client`. The next read sees the end of the stream, and cleans up. */
+static void client_kick(struct sockclient *client)
+{
+        shutdown(client->sockfd, SHUT_RDWR);
+}
+
+void client_update_events(struct sockclient *client)
+{
+        uint32_t events = 0;
+        if (!(client->flags & CLIENTTHROTTLED)) {
+                events |= EPOLLIN;
+        }
+        if (deque_length(&client->outbox) != 0) {
+                events |= EPOLLOUT;
+        }
+        struct epoll_event event = { events, { .ptr = client } };
+        epoll_ctl(client->epollfd, EPOLL_CTL_MOD, client->sockfd, &event);
+}
+
+/**
+ * Send as much of `out` as the socket takes, but no more than `*budget`
+ * bytes, which are taken off it.
+ *
+ * # Returns
+ * - `-1` for failure and set `errno`
+ * - `0` if the socket is full, or the budget spent
+ * - `1` if all of it was sent
+ */
+static int outbound_send(struct sockclient *client, struct outbound *out, size_t *budget)
+{
+        while (out->offset < out->end) {
+                size_t count = (size_t)(out->end - out->offset);
+                if (*budget == 0) {
+                        return 0;
+                }
+                if (count > *budget) {
+                        count = *budget;
+                }
+                ssize_t sent;
+                if (out->bytes) {
+                        char const *data = rcstr_as_cstr(out->bytes) + out->offset;
+                        sent = send(client->sockfd, data, count, MSG_NOSIGNAL | MSG_DONTWAIT);
+                        if (sent > 0) {
+                                out->offset += sent;
+                                client->outbox_bytes -= (size_t)sent;
+                        }
+                } else {
+                        sent = sendfile(client->sockfd, out->fd, &out->offset, count);
+                }
+                if (sent == -1) {
+                        return errno == EAGAIN ? 0 : -1;
+                }
+                if (sent == 0) {
+                        // The file is shorter than it was
+                        errno = EIO;
+                        return -1;
+                }
+                *budget -= (size_t)sent;
+        }
+        return 1;
+}
+
+static void outbound_free(struct sockclient *client, struct outbound *out)
+{
+        if (out->bytes) {
+                client->outbox_bytes -= (size_t)(out->end - out->offset);
+                rcstr_drop(out->bytes);
+        } else {
+                if (out->finish) {
+                        out->finish(out->arg, out->fd, out->offset, out->end);
+                }
+                close(out->fd);
+        }
+}
+
+static void client_enqueue(struct sockclient *client, struct outbound out)
+{
+        if (out.bytes) {
+                client->outbox_bytes += (size_t)(out.end - out.offset);
+                if (client->outbox_bytes > OUTBOX_MAX) {
+                        client_kick(client);
+                }
+        }
+        DEQUE_PUSH_BACK(&client->outbox, struct outbound, out);
+        if (deque_length(&client->outbox) == 1) {
+                client_update_events(client);
+        }
+}
+
+/**
+ * Send as much of `len` bytes at `buf` as the socket takes right now, if
+ * nothing is waiting ahead of them.
+ *
+ * # Returns
+ * - `-1` if the client was disconnected
+ * - `n` for the number of bytes sent, which are all of them if `n == len`
+ */
+static ssize_t client_send_now(struct sockclient *client, void const *buf, size_t len)
+{
+        if (deque_length(&client->outbox) != 0) {
+                return 0;
+        }
+        ssize_t n = send(client->sockfd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n == -1 && errno != EAGAIN) {
+                client_kick(client);
+                return -1;
+        }
+        return n == -1 ? 0 : n;
+}
+
+void client_send(struct sockclient *client, void const *buf, size_t len)
+{
+        ssize_t sent = client_send_now(client, buf, len);
+        if (sent == -1 || (size_t)sent == len) {
+                return;
+        }
+        struct outbound out = {
+                .bytes = rcstr_new((char const *)buf + sent, len - (size_t)sent),
+                .fd = -1,
+                .offset = 0,
+                .end = (off_t)(len - (size_t)sent),
+        };
+        client_enqueue(client, out);
+}
+
+void client_send_shared(struct sockclient *client, struct rcstr *bytes)
+{
+        size_t len = rcstr_length(bytes);
+        ssize_t sent = client_send_now(client, rcstr_as_cstr(bytes), len);
+        if (sent == -1 || (size_t)sent == len) {
+                return;
+        }
+        // The rest is sent from the same string, not a copy of it
+        struct outbound out = {
+                .bytes = rcstr_clone(bytes),
+                .fd = -1,
+                .offset = sent,
+                .end = (off_t)len,
+        };
+        client_enqueue(client, out);
+}
+
+void client_send_file(struct sockclient *client, int fd, off_t offset, off_t end)
+{
+        client_send_file_then(client, fd, offset, end, NULL, NULL);
+}
+
+void client_send_file_then(struct sockclient *client, int fd, off_t offset, off_t end,
+                           void (*finish)(void *arg, int fd, off_t offset, off_t end),
+                           void *arg)
+{
+        struct outbound out = {
+                .bytes = NULL,
+                .fd = fd,
+                .offset = offset,
+                .end = end,
+                .finish = finish,
+                .arg = arg,
+        };
+        if (deque_length(&client->outbox) == 0) {
+                size_t budget = FLUSH_BUDGET;
+                int done = outbound_send(client, &out, &budget);
+                if (done == -1) {
+                        client_kick(client);
+                }
+                if (done != 0) {
+                        outbound_free(client, &out);
+                        return;
+                }
+        }
+        client_enqueue(client, out);
+}
+
+void client_flush(struct sockclient *client)
+{
+        size_t budget = FLUSH_BUDGET;
+        while (deque_length(&client->outbox) != 0) {
+                struct outbound *out = deque_get(&client->outbox, TYPEINFO(struct outbound), 0);
+                int done = outbound_send(client, out, &budget);
+                if (done == -1) {
+                        client_kick(client);
+                }
+                if (done != 1) {
+                        return;
+                }
+                outbound_free(client, out);
+                deque_pop_front(&client->outbox, TYPEINFO(struct outbound));
+        }
+        client_update_events(client);
+}
+
+void client_clear_outbox(struct sockclient *client)
+{
+        while (deque_length(&client->outbox) != 0) {
+                outbound_free(client, deque_pop_front(&client->outbox, TYPEINFO(struct outbound)));
+        }
+        deque_free(&client->outbox);
+}
+
+void client_reply(struct sockclient *client, char const *text)
+{
+        CSTRING_INLINE(out, SEND_INLINE_CAP);
+        if (client->flags & CLIENTBINARY) {
+                struct frame_header hdr = { .len = strlen(text), .opcode = FRAME_REPLY };
+                uint8_t *it = (uint8_t *)fmt_reserve(&out, FRAME_HEADER_MAX);
+                fmt_commit(&out, frame_encode_header(it, &hdr));
+                FMT(&out, text);
+        } else {
+                FMT(&out, text, "\n");
+        }
+        client_send(client, cstring_as_cstr(&out), out.buf.len - 1);
+        cstring_free(&out);
+}
+
+void client_send_log(struct sockclient *client, int fd, off_t begin, off_t end)
+{
+        if (client->flags & CLIENTBINARY) {
+                uint8_t hdrbuf[FRAME_HEADER_MAX];
+                struct frame_header hdr = { .len = (uint64_t)(end - begin), .opcode = FRAME_LOG };
+                client_send(client, hdrbuf, frame_encode_header(hdrbuf, &hdr));
+        } else {
+                CSTRING_INLINE(reply, SEND_INLINE_CAP);
+                FMT(&reply, "+history ", (long)(end - begin));
+                client_reply(client, cstring_as_cstr(&reply));
+                cstring_free(&reply);
+        }
+        client_send_file(client, fd, begin, end);
+}
+
+void client_send_private(struct sockclient *client, char const *lines, size_t len)
+{
+        CSTRING_INLINE(out, SEND_INLINE_CAP);
+        if (client->flags & CLIENTBINARY) {
+                struct frame_header hdr = { .len = len, .opcode = FRAME_PRIVATE };
+                uint8_t *it = (uint8_t *)fmt_reserve(&out, FRAME_HEADER_MAX);
+                fmt_commit(&out, frame_encode_header(it, &hdr));
+        }
+        cstring_extend(&out, (uint8_t const *)lines, (uint8_t const *)lines + len);
+        client_send(client, cstring_as_cstr(&out), out.buf.len - 1);
+        cstring_free(&out);
+}
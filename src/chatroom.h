@@ -0,0 +1,213 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "main.h"
+#include "mailbox.h"
+#include "history.h"
+#include "search.h"
+#include "filter.h"
+#include "ratelimit.h"
+#include "attachment.h"
+#include "../include/deque.h"
+#include "../include/dynarray.h"
+#include "../include/rcstr.h"
+
+/** Messages kept for `.resume`. The oldest go first. */
+#define BACKLOG_CAP 4096
+/** Seconds after a disconnect that a session can still be resumed */
+#define RESUME_GRACE 120
+/** The name of the room, for commands that take one */
+#define CHATROOM_NAME "main"
+
+/**
+ * A chat message as delivered. Every message gets the next sequence number,
+ * so a client can tell from the last one it saw exactly what it missed.
+ */
+struct message {
+        uint64_t seq;
+        struct rcstr *from;
+        struct rcstr *text;
+};
+
+/** The session of a client that has disconnected, kept for `.resume` */
+struct session {
+        uint64_t token;
+        struct rcstr *name;
+        time_t detached_at;
+};
+
+/**
+ * Everyone connected, and what has been said. There is a single room for
+ * now.
+ */
+struct chatroom {
+        /** Sequence number of the next message. The first is `1`. */
+        uint64_t next_seq;
+        /** The last `BACKLOG_CAP` messages, as `struct message` */
+        struct deque backlog;
+        /** Every connected client, as `struct sockclient *` */
+        struct dynarray clients;
+        /** Sessions waiting to be resumed, as `struct session` */
+        struct dynarray sessions;
+        /** Private messages for users who aren't here. See `mailbox_open()`. */
+        struct mailbox mailbox;
+        /** Every message ever posted. See `history_open()`. */
+        struct history history;
+        /** An index of `history`. See `search_open()`. */
+        struct search search;
+        /** Banned patterns. See `filter_open()`. */
+        struct filter filter;
+        /** How fast clients may send. See `ratelimit_open()`. */
+        struct ratelimit ratelimit;
+        /** Blobs clients share. See `attachments_open()`. */
+        struct attachments attachments;
+};
+
+/**
+ * An empty room. Its mailbox, history, search index, filter, rate limits and
+ * attachments must be opened with `mailbox_open()`, `history_open()`,
+ * `search_open()`, `filter_open()`, `ratelimit_open()` and
+ * `attachments_open()` before use, and then `next_seq` picks up after the
+ * last message in the history.
+ */
+struct chatroom chatroom_new();
+
+/** Start delivering messages to `client` */
+void chatroom_join(struct chatroom *self, struct sockclient *client);
+
+/**
+ * Stop delivering messages to `client`, which is disconnecting, and abandon
+ * its upload, if any. If it had a session, keep that for `RESUME_GRACE`
+ * seconds.
+ */
+void chatroom_leave(struct chatroom *self, struct sockclient *client);
+
+/**
+ * The connected client with a session called `name`, or `NULL`.
+ */
+struct sockclient *chatroom_find(struct chatroom *self, char const *name);
+
+/**
+ * Whether a connected client other than `client` has a session with the same
+ * name as `client`.
+ */
+bool chatroom_name_taken(struct chatroom *self, struct sockclient const *client);
+
+/**
+ * Give `client` a new session, with a fresh token.
+ */
+void chatroom_open_session(struct chatroom *self, struct sockclient *client);
+
+/**
+ * Stamp a message with the next sequence number, keep it in the backlog and
+ * the history, index it and deliver it to every client with a session.
+ * Takes ownership of `text`.
+ */
+void chatroom_post(struct chatroom *self, struct rcstr *from, struct rcstr *text);
+
+/**
+ * Reattach `client` to the detached session `token`, and send it every
+ * message after `last_seq`. Those that have already left the backlog are
+ * sent first, from the history log, as with `client_send_log()`.
+ *
+ * # Returns
+ * - `false` if there is no such session, or its grace period is over
+ */
+bool chatroom_resume(struct chatroom *self, struct sockclient *client, uint64_t token,
+                     uint64_t last_seq);
+
+/**
+ * Output that is waiting for a client's socket: bytes, or a range of a file
+ * that goes out with `sendfile()`.
+ */
+struct outbound {
+        /** `NULL` for a file */
+        struct rcstr *bytes;
+        /** The file, owned by this, or `-1` */
+        int fd;
+        /** The next byte to send, of `bytes` or of the file */
+        off_t offset;
+        off_t end;
+        /** See `client_send_file_then()`. `NULL` for none. */
+        void (*finish)(void *arg, int fd, off_t offset, off_t end);
+        void *arg;
+};
+
+/**
+ * Most bytes waiting to be sent to one client, not counting files, before it
+ * is disconnected
+ */
+#define OUTBOX_MAX (256 * 1024)
+/**
+ * Most bytes sent to one client per event. A big file goes out over many
+ * turns of the event loop, so it doesn't hold up everyone else.
+ */
+#define FLUSH_BUDGET (64 * 1024)
+
+/**
+ * Send `len` bytes to `client` without blocking. Whatever the socket can't
+ * take right now waits in the client's outbox, in order, until `EPOLLOUT`.
+ * A client that lets more than `OUTBOX_MAX` bytes pile up has fallen too far
+ * behind: it is disconnected, and can `.resume` to catch up.
+ */
+void client_send(struct sockclient *client, void const *buf, size_t len);
+
+/**
+ * `client_send()` the bytes of `bytes`, without copying them: what the
+ * socket can't take right now waits in the outbox as another reference to
+ * `bytes`, and how far it got. For output that goes to many clients.
+ */
+void client_send_shared(struct sockclient *client, struct rcstr *bytes);
+
+/**
+ * Send the bytes `[offset, end)` of the file `fd` to `client`, after
+ * anything already in its outbox, and then close `fd`. The file is streamed
+ * with `sendfile()` as the socket takes it, so it never sits in memory, and
+ * doesn't count towards `OUTBOX_MAX`.
+ */
+void client_send_file(struct sockclient *client, int fd, off_t offset, off_t end);
+
+/**
+ * `client_send_file()`, and once the file is done with, whether it all went
+ * out or the client disconnected, call `finish(arg, fd, offset, end)` before
+ * closing it. `offset` is how far it got: `end` if all of it was sent.
+ */
+void client_send_file_then(struct sockclient *client, int fd, off_t offset, off_t end,
+                           void (*finish)(void *arg, int fd, off_t offset, off_t end),
+                           void *arg);
+
+/**
+ * Send as much of the outbox of `client` as its socket takes, up to
+ * `FLUSH_BUDGET` bytes. Called on `EPOLLOUT`.
+ */
+void client_flush(struct sockclient *client);
+
+/**
+ * Tell epoll what `client` is waiting for: `EPOLLIN` unless it is throttled,
+ * and `EPOLLOUT` while its outbox isn't empty.
+ */
+void client_update_events(struct sockclient *client);
+
+/** Drop everything in the outbox of `client`, which is disconnecting */
+void client_clear_outbox(struct sockclient *client);
+
+/**
+ * Send a reply to a command: a line, or a `FRAME_REPLY` in binary mode.
+ */
+void client_reply(struct sockclient *client, char const *text);
+
+/**
+ * Send the bytes `[begin, end)` of the history log, which `fd` is a
+ * descriptor of, to `client` like `client_send_file()`: after a line
+ * `+history <n>`, or as a `FRAME_LOG` in binary mode.
+ */
+void client_send_log(struct sockclient *client, int fd, off_t begin, off_t end);
+
+/**
+ * Send private messages, formatted as in `mailbox.h`: lines, or a
+ * `FRAME_PRIVATE` in binary mode.
+ */
+void client_send_private(struct sockclient *client, char const *lines, size_t len);
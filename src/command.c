@@ -2,16 +2,30 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "command.h"
 #include "main.h"
+#include "frame.h"
 #include "../include/panic.h"
+#include "../include/cstring.h"
+#include "../include/fmt.h"
 
 #define STRCOMMAND_SETUSER ".setuser"
+#define STRCOMMAND_BINARY ".binary"
+#define STRCOMMAND_RESUME ".resume"
+#define STRCOMMAND_MSG ".msg"
+#define STRCOMMAND_HISTORY ".history"
+#define STRCOMMAND_SEARCH ".search"
+#define STRCOMMAND_UPLOAD ".upload"
+#define STRCOMMAND_DOWNLOAD ".download"
+/** Inline storage for a formatted output line */
+#define LINE_INLINE_CAP 256
 
+/** Whether `str1` starts with `str2` */
 bool streq_withoutnul(char const *str1, char const *str2)
 {
-        for (size_t i = 0; str1[i] != '\0' && str2[i] != '\0'; ++i) {
+        for (size_t i = 0; str2[i] != '\0'; ++i) {
                 if (str1[i] != str2[i]) return false;
         }
         return true;
@@ -23,6 +37,34 @@ int select_command(char const *command, char const **args)
                 *args = command + strlen(STRCOMMAND_SETUSER);
                 return COMMAND_SETUSER;
         }
+        if (streq_withoutnul(command, STRCOMMAND_BINARY)) {
+                *args = command + strlen(STRCOMMAND_BINARY);
+                return COMMAND_BINARY;
+        }
+        if (streq_withoutnul(command, STRCOMMAND_RESUME)) {
+                *args = command + strlen(STRCOMMAND_RESUME);
+                return COMMAND_RESUME;
+        }
+        if (streq_withoutnul(command, STRCOMMAND_MSG)) {
+                *args = command + strlen(STRCOMMAND_MSG);
+                return COMMAND_MSG;
+        }
+        if (streq_withoutnul(command, STRCOMMAND_HISTORY)) {
+                *args = command + strlen(STRCOMMAND_HISTORY);
+                return COMMAND_HISTORY;
+        }
+        if (streq_withoutnul(command, STRCOMMAND_SEARCH)) {
+                *args = command + strlen(STRCOMMAND_SEARCH);
+                return COMMAND_SEARCH;
+        }
+        if (streq_withoutnul(command, STRCOMMAND_UPLOAD)) {
+                *args = command + strlen(STRCOMMAND_UPLOAD);
+                return COMMAND_UPLOAD;
+        }
+        if (streq_withoutnul(command, STRCOMMAND_DOWNLOAD)) {
+                *args = command + strlen(STRCOMMAND_DOWNLOAD);
+                return COMMAND_DOWNLOAD;
+        }
         *args = command;
         return COMMAND_SAY;
 }
@@ -41,19 +83,195 @@ char const *skip_whitespace(char const *args)
         return &args[i];
 }
 
-void command_say(struct sockclient const *client, char const *args)
+void command_say(struct chatroom *room, struct sockclient const *client, char const *args)
 {
         if (!client->name) {
                 return;
         }
-        printf(BLUE("%s:") " %s\n", client->name, args);
+        CSTRING_INLINE(line, LINE_INLINE_CAP);
+        FMT(&line, BLUE_START, client->name, ":" COLOR_RESET " ", args, "\n");
+        fputs(cstring_as_cstr(&line), stdout);
+        cstring_free(&line);
+        chatroom_post(room, client->name, rcstr_from_cstr(args));
+}
+
+void command_setuser(struct chatroom *room, struct sockclient *client, char const *args)
+{
+        args = skip_whitespace(args);
+        // Names are written into lines, and the mailbox and history files
+        if (strpbrk(args, "\r\n")) {
+                client_reply(client, "-setuser failed");
+                return;
+        }
+        rcstr_drop(client->name);
+        client->name = rcstr_from_cstr(args);
+        if (!client->token) {
+                chatroom_open_session(room, client);
+                CSTRING_INLINE(reply, LINE_INLINE_CAP);
+                FMT(&reply, "+session ");
+                fmt_ulint_hex(&reply, &client->token);
+                client_reply(client, cstring_as_cstr(&reply));
+                cstring_free(&reply);
+        }
+        // Names aren't authenticated, so this only keeps a second connection
+        // from taking the mail of a user who is here
+        if (!chatroom_name_taken(room, client)) {
+                mailbox_deliver(&room->mailbox, client);
+        }
+}
+
+void command_resume(struct chatroom *room, struct sockclient *client, char const *args)
+{
+        char *end;
+        uint64_t token = strtoull(args, &end, 16);
+        uint64_t last_seq = strtoull(end, NULL, 10);
+        command_resume_session(room, client, token, last_seq);
+}
+
+void command_resume_session(struct chatroom *room, struct sockclient *client, uint64_t token,
+                            uint64_t last_seq)
+{
+        // A client with a session of its own would lose it
+        if (client->token || !chatroom_resume(room, client, token, last_seq)) {
+                client_reply(client, "-resume failed");
+                return;
+        }
+        if (!chatroom_name_taken(room, client)) {
+                mailbox_deliver(&room->mailbox, client);
+        }
+}
+
+void command_msg(struct chatroom *room, struct sockclient *client, char const *args)
+{
+        if (!client->name) {
+                return;
+        }
+        args = skip_whitespace(args);
+        char const *text = strchr(args, ' ');
+        // Mailboxes are one message per line
+        if (text == NULL || strchr(text, '\n')) {
+                client_reply(client, "-msg failed");
+                return;
+        }
+        struct rcstr *to = rcstr_new(args, (size_t)(text - args));
+        CSTRING_INLINE(record, LINE_INLINE_CAP);
+        FMT(&record, "@", (long)time(NULL), " ", client->name, ": ", text + 1, "\n");
+
+        char const *reply = "+msg sent";
+        struct sockclient *recipient = chatroom_find(room, rcstr_as_cstr(to));
+        if (recipient) {
+                client_send_private(recipient, cstring_as_cstr(&record), record.buf.len - 1);
+        } else if (mailbox_append(&room->mailbox, rcstr_as_cstr(to), cstring_as_cstr(&record),
+                                  record.buf.len - 1) == 0) {
+                reply = "+msg queued";
+        } else {
+                reply = "-msg failed";
+        }
+        client_reply(client, reply);
+        cstring_free(&record);
+        rcstr_drop(to);
+}
+
+void command_history(struct chatroom *room, struct sockclient *client, char const *args)
+{
+        args = skip_whitespace(args);
+        size_t roomlen = strcspn(args, " \t");
+        char *end;
+        int64_t since = strtoll(args + roomlen, &end, 10);
+        int64_t until = strtoll(end, NULL, 10);
+        if (roomlen != strlen(CHATROOM_NAME) || strncmp(args, CHATROOM_NAME, roomlen) != 0) {
+                client_reply(client, "-history failed");
+                return;
+        }
+        off_t begin, stop;
+        history_range(&room->history, since, until ? until : INT64_MAX, &begin, &stop);
+        int fd = dup(room->history.fd);
+        if (fd == -1) {
+                client_reply(client, "-history failed");
+                return;
+        }
+        client_send_log(client, fd, begin, stop);
+}
+
+void command_search(struct chatroom *room, struct sockclient *client, char const *args)
+{
+        uint64_t seqs[SEARCH_TOP_K];
+        size_t n = search_query(&room->search, args, seqs, SEARCH_TOP_K);
+        CSTRING_INLINE(lines, LINE_INLINE_CAP);
+        for (size_t i = 0; i < n; ++i) {
+                off_t begin, end;
+                if (!history_find(&room->history, seqs[i], &begin, &end)) {
+                        continue;
+                }
+                size_t len = (size_t)(end - begin);
+                char *it = fmt_reserve(&lines, len);
+                if (pread(room->history.fd, it, len, begin) == (ssize_t)len) {
+                        fmt_commit(&lines, len);
+                }
+        }
+        // The header and the lines go out together
+        size_t len = lines.buf.len - 1;
+        CSTRING_INLINE(out, LINE_INLINE_CAP);
+        if (client->flags & CLIENTBINARY) {
+                struct frame_header hdr = { .len = len, .opcode = FRAME_LOG };
+                uint8_t *it = (uint8_t *)fmt_reserve(&out, FRAME_HEADER_MAX);
+                fmt_commit(&out, frame_encode_header(it, &hdr));
+        } else {
+                FMT(&out, "+search ", len, "\n");
+        }
+        FMT(&out, &lines);
+        client_send(client, cstring_as_cstr(&out), out.buf.len - 1);
+        cstring_free(&out);
+        cstring_free(&lines);
+}
+
+void command_upload(struct chatroom *room, struct sockclient *client, char const *args)
+{
+        args = skip_whitespace(args);
+        char *end;
+        uint64_t size = strtoull(args, &end, 10);
+        if (end == args || *skip_whitespace(end) != '\0') {
+                client_reply(client, "-upload failed");
+                return;
+        }
+        command_upload_size(room, client, size);
+}
+
+void command_upload_size(struct chatroom *room, struct sockclient *client, uint64_t size)
+{
+        // An empty upload would only finish on the client's next message
+        if (client->name == NULL || size == 0 || size > ATTACHMENT_MAX ||
+            upload_begin(&room->attachments, client, (off_t)size) == -1) {
+                client_reply(client, "-upload failed");
+                return;
+        }
+        client_reply(client, "+upload ready");
+}
+
+void command_download(struct chatroom *room, struct sockclient *client, char const *args)
+{
+        off_t size;
+        int fd = attachment_open(&room->attachments, skip_whitespace(args), &size);
+        if (fd == -1) {
+                client_reply(client, "-download failed");
+                return;
+        }
+        if (client->flags & CLIENTBINARY) {
+                uint8_t hdrbuf[FRAME_HEADER_MAX];
+                struct frame_header hdr = { .len = (uint64_t)size, .opcode = FRAME_ATTACHMENT };
+                client_send(client, hdrbuf, frame_encode_header(hdrbuf, &hdr));
+        } else {
+                CSTRING_INLINE(reply, LINE_INLINE_CAP);
+                FMT(&reply, "+download ", (long)size);
+                client_reply(client, cstring_as_cstr(&reply));
+                cstring_free(&reply);
+        }
+        client_send_file(client, fd, 0, size);
 }
 
-void command_setuser(struct sockclient *client, char const *args)
+void command_binary(struct sockclient *client)
 {
-        free(client->name);
-        char const *name = skip_whitespace(args);
-        size_t name_buflen = strlen(name) + 1;
-        client->name = (char *)malloc(name_buflen);
-        memcpy(client->name, name, name_buflen);
+        client->flags |= CLIENTBINARY;
+        // After anything still queued for the line protocol
+        client_send(client, "+binary\n", 8);
 }
\ No newline at end of file
@@ -1,9 +1,17 @@
 #pragma once
 
 #include "main.h"
+#include "chatroom.h"
 
 #define COMMAND_SAY 0
 #define COMMAND_SETUSER 1
+#define COMMAND_BINARY 2
+#define COMMAND_RESUME 3
+#define COMMAND_MSG 4
+#define COMMAND_HISTORY 5
+#define COMMAND_SEARCH 6
+#define COMMAND_UPLOAD 7
+#define COMMAND_DOWNLOAD 8
 
 /** 
  * Get the command type for a given msg, and put the tail of the command 
@@ -14,7 +22,72 @@
  */
 int select_command(char const *command, char const **args);
 
-/** -1 for errors */
-void command_setuser(struct sockclient *client, char const *args);
+/**
+ * Set the username. A client's first `.setuser` also opens its session, and
+ * is answered with `+session <token>`, the token in hex. Then any private
+ * messages waiting for the name are delivered, unless another connected
+ * client has a session with that name. A name with a line break is refused
+ * with `-setuser failed`.
+ *
+ * Names are not authenticated: whoever connects first as a user who is away
+ * gets their private messages.
+ */
+void command_setuser(struct chatroom *room, struct sockclient *client, char const *args);
+
+/** Post a message to the room, which echoes it to stdout */
+void command_say(struct chatroom *room, struct sockclient const *client, char const *args);
+
+/**
+ * `.resume <token> <last-seq>`: take over a session after reconnecting. The
+ * reply is `+resumed` followed by every message after `<last-seq>`, or
+ * `-resume failed`. Messages older than the backlog come first, as a
+ * `.history` reply.
+ */
+void command_resume(struct chatroom *room, struct sockclient *client, char const *args);
+
+/**
+ * `.msg <user> <message>`: send a private message. If `<user>` isn't
+ * connected, it waits in their mailbox. The reply is `+msg sent`,
+ * `+msg queued` or `-msg failed`.
+ */
+void command_msg(struct chatroom *room, struct sockclient *client, char const *args);
+
+/**
+ * `.history <room> <since> [<until>]`: get the messages sent to `<room>`
+ * from the unix time `<since>` up to, but not including, `<until>`, or
+ * until now. The reply is `+history <n>` followed by `<n>` bytes of lines
+ * as in `history.h`, or `-history failed`.
+ */
+void command_history(struct chatroom *room, struct sockclient *client, char const *args);
+
+/**
+ * `.search <terms>`: find the `SEARCH_TOP_K` most recent messages that
+ * contain every term. The reply is `+search <n>` followed by `<n>` bytes of
+ * lines as in `history.h`, newest first.
+ */
+void command_search(struct chatroom *room, struct sockclient *client, char const *args);
+
+/**
+ * `.upload <size>`: attach a blob of `<size>` bytes, at least one. The
+ * reply is `+upload ready`, after which the client sends exactly that many
+ * raw bytes, and then `+upload <id>` once they have all arrived. Or
+ * `-upload failed`, before `.setuser`, or if the attachments are over
+ * their quota. See `attachment.h`.
+ */
+void command_upload(struct chatroom *room, struct sockclient *client, char const *args);
+
+/** `command_upload()` with the size already parsed */
+void command_upload_size(struct chatroom *room, struct sockclient *client, uint64_t size);
+
+/**
+ * `.download <id>`: get an attachment. The reply is `+download <n>` followed
+ * by the `<n>` bytes of the attachment, or `-download failed`.
+ */
+void command_download(struct chatroom *room, struct sockclient *client, char const *args);
+
+/** `command_resume()` with the arguments already parsed */
+void command_resume_session(struct chatroom *room, struct sockclient *client, uint64_t token,
+                            uint64_t last_seq);
 
-void command_say(struct sockclient const *client, char const *args);
\ No newline at end of file
+/** Switch `client` to the binary protocol, and acknowledge with `+binary` */
+void command_binary(struct sockclient *client);
\ No newline at end of file
@@ -0,0 +1,340 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "filter.h"
+#include "../include/dynarray.h"
+#include "../include/panic.h"
+
+/** A node of the trie the automaton is built from */
+struct trie_node {
+        int32_t first_child;
+        int32_t next_sibling;
+        int32_t fail;
+        /** Where the node goes in the double array */
+        int32_t slot;
+        uint8_t label;
+        bool match;
+};
+
+DYNARRAY_DEFINE(trie_nodes, struct trie_node)
+DYNARRAY_DEFINE(node_ids, int32_t)
+
+static inline uint8_t filter_fold(uint8_t ch)
+{
+        return ch >= 'A' && ch <= 'Z' ? (uint8_t)(ch - 'A' + 'a') : ch;
+}
+
+static int32_t trie_child(struct dynarray *nodes, int32_t node, uint8_t label)
+{
+        int32_t child = trie_nodes_get(nodes, node)->first_child;
+        while (child != -1 && trie_nodes_get(nodes, child)->label != label) {
+                child = trie_nodes_get(nodes, child)->next_sibling;
+        }
+        return child;
+}
+
+static void trie_insert(struct dynarray *nodes, char const *pattern, size_t len)
+{
+        int32_t node = 0;
+        for (size_t i = 0; i < len; ++i) {
+                uint8_t label = filter_fold((uint8_t)pattern[i]);
+                int32_t child = trie_child(nodes, node, label);
+                if (child == -1) {
+                        child = (int32_t)trie_nodes_length(nodes);
+                        struct trie_node fresh = {
+                                .first_child = -1,
+                                .next_sibling = trie_nodes_get(nodes, node)->first_child,
+                                .label = label,
+                        };
+                        trie_nodes_push(nodes, fresh);
+                        trie_nodes_get(nodes, node)->first_child = child;
+                }
+                node = child;
+        }
+        trie_nodes_get(nodes, node)->match = true;
+}
+
+/**
+ * The double array, while it is being filled. The free slots are on a
+ * doubly linked list, in order, so placing a node never walks over the
+ * slots in use.
+ */
+struct slots_builder {
+        struct filter_slot *slots;
+        int32_t *next_free;
+        int32_t *prev_free;
+        size_t cap;
+        /** One past the highest slot in use */
+        size_t len;
+        /** The first free slot */
+        int32_t head;
+        int32_t tail;
+};
+
+static void slots_reserve(struct slots_builder *self, size_t n)
+{
+        if (n <= self->cap) {
+                return;
+        }
+        size_t cap = self->cap ? self->cap : 1024;
+        while (cap < n) {
+                cap *= 2;
+        }
+        self->slots = realloc(self->slots, cap * sizeof *self->slots);
+        self->next_free = realloc(self->next_free, cap * sizeof *self->next_free);
+        self->prev_free = realloc(self->prev_free, cap * sizeof *self->prev_free);
+        if (self->slots == NULL || self->next_free == NULL || self->prev_free == NULL) {
+                PANIC("realloc() returned NULL");
+        }
+        for (size_t i = self->cap; i < cap; ++i) {
+                self->slots[i] = (struct filter_slot){ .base = 0, .check = -1 };
+                self->prev_free[i] = self->tail;
+                self->next_free[i] = -1;
+                if (self->tail == -1) {
+                        self->head = (int32_t)i;
+                } else {
+                        self->next_free[self->tail] = (int32_t)i;
+                }
+                self->tail = (int32_t)i;
+        }
+        self->cap = cap;
+}
+
+/** Take the free slot `slot` for a child of `parent` */
+static void slots_use(struct slots_builder *self, size_t slot, int32_t parent)
+{
+        int32_t prev = self->prev_free[slot];
+        int32_t next = self->next_free[slot];
+        if (prev == -1) {
+                self->head = next;
+        } else {
+                self->next_free[prev] = next;
+        }
+        if (next == -1) {
+                self->tail = prev;
+        } else {
+                self->prev_free[next] = prev;
+        }
+        self->slots[slot].check = parent;
+        if (slot + 1 > self->len) {
+                self->len = slot + 1;
+        }
+}
+
+/**
+ * Find a base for the children with the sorted `labels`: one where every
+ * `base + label` is a free slot. Every base is at least `1`, so no
+ * transition leads back to the root in slot `0`.
+ */
+static int32_t slots_place(struct slots_builder *self, uint8_t const *labels, size_t n)
+{
+        for (int32_t pos = self->head;; pos = self->next_free[pos]) {
+                // Room for any base from here, and more free slots after it
+                slots_reserve(self, (size_t)pos + 257);
+                if ((size_t)pos < (size_t)labels[0] + 1) {
+                        continue;
+                }
+                size_t base = (size_t)pos - labels[0];
+                size_t i = 1;
+                while (i < n && self->slots[base + labels[i]].check == -1) {
+                        ++i;
+                }
+                if (i == n) {
+                        return (int32_t)base;
+                }
+        }
+}
+
+/**
+ * Build the automaton from the trie in `nodes`, breadth first: a node's
+ * children are placed in the double array, and get their fail links, when
+ * the node is visited.
+ */
+static struct filter_automaton *filter_build(struct dynarray *nodes)
+{
+        struct slots_builder builder = {
+                .slots = NULL,
+                .next_free = NULL,
+                .prev_free = NULL,
+                .cap = 0,
+                .len = 1,
+                .head = -1,
+                .tail = -1,
+        };
+        slots_reserve(&builder, 256);
+        // Never a transition target, see `slots_place()`
+        slots_use(&builder, 0, 0);
+        trie_nodes_get(nodes, 0)->slot = 0;
+        trie_nodes_get(nodes, 0)->fail = 0;
+
+        struct dynarray queue = dynarray_new();
+        node_ids_push(&queue, 0);
+        for (size_t head = 0; head < node_ids_length(&queue); ++head) {
+                int32_t node = *node_ids_get(&queue, (ssize_t)head);
+                struct trie_node *u = trie_nodes_get(nodes, node);
+
+                uint8_t labels[256];
+                int32_t children[256];
+                size_t n = 0;
+                for (int32_t child = u->first_child; child != -1;
+                     child = trie_nodes_get(nodes, child)->next_sibling) {
+                        // Insertion sort by label
+                        uint8_t label = trie_nodes_get(nodes, child)->label;
+                        size_t i = n++;
+                        for (; i > 0 && labels[i - 1] > label; --i) {
+                                labels[i] = labels[i - 1];
+                                children[i] = children[i - 1];
+                        }
+                        labels[i] = label;
+                        children[i] = child;
+                }
+                if (n != 0) {
+                        int32_t base = slots_place(&builder, labels, n);
+                        builder.slots[u->slot].base = base;
+                        for (size_t i = 0; i < n; ++i) {
+                                struct trie_node *v = trie_nodes_get(nodes, children[i]);
+                                size_t slot = (size_t)base + labels[i];
+                                slots_use(&builder, slot, u->slot);
+                                v->slot = (int32_t)slot;
+                                // The longest proper suffix that is in the trie
+                                v->fail = 0;
+                                for (int32_t f = node; f != 0;) {
+                                        f = trie_nodes_get(nodes, f)->fail;
+                                        int32_t w = trie_child(nodes, f, labels[i]);
+                                        if (w != -1) {
+                                                v->fail = w;
+                                                break;
+                                        }
+                                }
+                                // Shallower, so already final
+                                v->match |= trie_nodes_get(nodes, v->fail)->match;
+                                node_ids_push(&queue, children[i]);
+                        }
+                }
+                builder.slots[u->slot].fail = trie_nodes_get(nodes, u->fail)->slot;
+                builder.slots[u->slot].match = u->match;
+        }
+        dynarray_free(&queue);
+        free(builder.next_free);
+        free(builder.prev_free);
+
+        struct filter_automaton *self = malloc(sizeof *self);
+        if (self == NULL) {
+                PANIC("malloc() returned NULL");
+        }
+        self->slots = builder.slots;
+        self->len = builder.len;
+        return self;
+}
+
+/** Compile the pattern list at `path`. A missing list blocks nothing. */
+static struct filter_automaton *filter_compile(char const *path)
+{
+        struct dynarray nodes = dynarray_new();
+        struct trie_node root = { .first_child = -1, .next_sibling = -1 };
+        trie_nodes_push(&nodes, root);
+        FILE *file = fopen(path, "r");
+        if (file) {
+                char *line = NULL;
+                size_t cap = 0;
+                ssize_t len;
+                while ((len = getline(&line, &cap, file)) != -1) {
+                        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+                                --len;
+                        }
+                        if (len != 0 && line[0] != '#') {
+                                trie_insert(&nodes, line, (size_t)len);
+                        }
+                }
+                free(line);
+                fclose(file);
+        }
+        struct filter_automaton *self = filter_build(&nodes);
+        dynarray_free(&nodes);
+        return self;
+}
+
+static void filter_automaton_free(struct filter_automaton *self)
+{
+        if (self == NULL) {
+                return;
+        }
+        free(self->slots);
+        free(self);
+}
+
+/** Whether the list changed since it was last compiled */
+static bool filter_changed(struct filter *self)
+{
+        struct stat st;
+        struct timespec mtime = { 0, 0 };
+        if (stat(self->path, &st) == 0) {
+                mtime = st.st_mtim;
+        }
+        bool changed = mtime.tv_sec != self->mtime.tv_sec || mtime.tv_nsec != self->mtime.tv_nsec;
+        self->mtime = mtime;
+        return changed;
+}
+
+static void *filter_reloader(void *arg)
+{
+        struct filter *self = arg;
+        while (true) {
+                sleep(FILTER_RELOAD_INTERVAL);
+                if (!filter_changed(self)) {
+                        continue;
+                }
+                struct filter_automaton *fresh = filter_compile(self->path);
+                // One the event loop never took is ours to free
+                filter_automaton_free(__atomic_exchange_n(&self->pending, fresh, __ATOMIC_ACQ_REL));
+        }
+        return NULL;
+}
+
+int filter_open(struct filter *self, char const *path)
+{
+        self->path = path;
+        self->mtime = (struct timespec){ 0, 0 };
+        filter_changed(self);
+        self->current = filter_compile(path);
+        self->pending = NULL;
+        if ((errno = pthread_create(&self->reloader, NULL, filter_reloader, self))) return -1;
+        return 0;
+}
+
+bool filter_blocks(struct filter *self, char const *text, size_t len)
+{
+        if (__atomic_load_n(&self->pending, __ATOMIC_RELAXED)) {
+                struct filter_automaton *fresh =
+                        __atomic_exchange_n(&self->pending, NULL, __ATOMIC_ACQ_REL);
+                if (fresh) {
+                        filter_automaton_free(self->current);
+                        self->current = fresh;
+                }
+        }
+        struct filter_slot const *slots = self->current->slots;
+        int32_t const nr_slots = (int32_t)self->current->len;
+        int32_t state = 0;
+        for (size_t i = 0; i < len; ++i) {
+                uint8_t ch = filter_fold((uint8_t)text[i]);
+                while (true) {
+                        int32_t next = slots[state].base + ch;
+                        if (next < nr_slots && slots[next].check == state) {
+                                state = next;
+                                break;
+                        }
+                        if (state == 0) {
+                                break;
+                        }
+                        state = slots[state].fail;
+                }
+                if (slots[state].match) {
+                        return true;
+                }
+        }
+        return false;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+/** Seconds between checks of the pattern list for changes */
+#define FILTER_RELOAD_INTERVAL 5
+
+/**
+ * A state of the automaton. The transition from state `s` on byte `c` is to
+ * `t = slots[s].base + c` if `slots[t].check == s`, and otherwise the same
+ * transition from `slots[s].fail`. A state's id is its slot, so the whole
+ * automaton is this one array, 16 bytes a state.
+ */
+struct filter_slot {
+        int32_t base;
+        /** The parent state, or `-1` for a free slot */
+        int32_t check;
+        int32_t fail;
+        /** Whether a pattern ends here, or in any state down the fail chain */
+        int32_t match;
+};
+
+/** An Aho-Corasick automaton over bytes, as a double-array trie */
+struct filter_automaton {
+        struct filter_slot *slots;
+        size_t len;
+};
+
+/**
+ * Blocks messages that contain any of a list of banned terms or URLs. The
+ * list is a file with one pattern per line. Blank lines and lines starting
+ * with `#` are skipped, and matching ignores ascii case.
+ *
+ * The patterns are compiled into one automaton, which scans a message in a
+ * single pass however many patterns there are. A background thread checks
+ * the file every `FILTER_RELOAD_INTERVAL` seconds and compiles it again if
+ * it changed. It hands the new automaton over in `pending`, and the event
+ * loop takes it from there on its next message, and frees the old one, so
+ * there is no lock.
+ */
+struct filter {
+        char const *path;
+        /** Modification time of the loaded list. Reloader only. */
+        struct timespec mtime;
+        /** In use by the event loop. Event loop only. */
+        struct filter_automaton *current;
+        /** A newer automaton, or `NULL`. Accessed atomically. */
+        struct filter_automaton *pending;
+        pthread_t reloader;
+};
+
+/**
+ * Compile the pattern list at `path`, if there is one, and start the
+ * reloader.
+ *
+ * # Returns
+ * - `-1` for failure and set `errno`
+ * - `0` for success
+ */
+int filter_open(struct filter *self, char const *path);
+
+/**
+ * Whether the `len` bytes of `text` contain a banned pattern. Event loop
+ * only.
+ */
+bool filter_blocks(struct filter *self, char const *text, size_t len);
@@ -0,0 +1,70 @@
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "frame.h"
+
+size_t frame_encode_header(uint8_t *out, struct frame_header const *hdr)
+{
+        size_t len = varint_encode(out, hdr->len);
+        out[len++] = hdr->opcode;
+        return len;
+}
+
+ssize_t frame_decode_header(uint8_t const *buf, size_t len, struct frame_header *hdr)
+{
+        uint8_t const *it = buf;
+        uint8_t const *end = buf + len;
+        if (!varint_decode(&it, end, &hdr->len)) {
+                // A varint can only fail to decode at the end of the buffer if
+                // it is too long to be a varint at all
+                return len < VARINT_MAX ? 0 : -1;
+        }
+        if (it == end) {
+                return 0;
+        }
+        hdr->opcode = *it++;
+        return it - buf;
+}
+
+ssize_t frame_recv(int sockfd, struct dynarray *buf, struct frame_header *hdr)
+{
+        ssize_t hdrlen = buf->len ? frame_decode_header(buf->data, buf->len, hdr) : 0;
+        while (hdrlen == 0) {
+                // Peek, so that only the bytes of the header are taken
+                uint8_t peek[FRAME_HEADER_MAX];
+                size_t had = buf->len;
+                ssize_t peeked = recv(sockfd, peek, FRAME_HEADER_MAX - had, MSG_PEEK);
+                if (peeked <= 0) {
+                        return peeked;
+                }
+                dynarray_extend(buf, peek, peek + peeked);
+                hdrlen = frame_decode_header(buf->data, buf->len, hdr);
+                if (hdrlen == -1) {
+                        break;
+                }
+                // All of it, if the header is still incomplete, so that
+                // level-triggered epoll doesn't report it again
+                size_t take = hdrlen ? (size_t)hdrlen - had : (size_t)peeked;
+                buf->len = had + take;
+                recv(sockfd, peek, take, 0);
+        }
+        if (hdrlen == -1 || hdr->len > FRAME_PAYLOAD_MAX) {
+                errno = EPROTO;
+                return -1;
+        }
+        size_t len = (size_t)hdrlen + hdr->len;
+        dynarray_reserve(buf, TYPEINFO(uint8_t), len + 1 - buf->len);
+        if (buf->len < len) {
+                ssize_t recvd = recv(sockfd, (uint8_t *)buf->data + buf->len, len - buf->len, 0);
+                if (recvd <= 0) {
+                        return recvd;
+                }
+                buf->len += (size_t)recvd;
+                if (buf->len < len) {
+                        errno = EAGAIN;
+                        return -1;
+                }
+        }
+        ((uint8_t *)buf->data)[len] = '\0';
+        return hdrlen;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "../include/dynarray.h"
+#include "../include/varint.h"
+
+/*
+ * The binary protocol, for bots and bridges. A client switches to it by
+ * sending `.binary` as a line, and waiting for the `+binary` line that
+ * acknowledges it. From then on, everything it sends is a frame:
+ *
+ * ```plaintext
+ * varint length | opcode | payload
+ * ```
+ *
+ * where `length` is the length of the payload alone, so the payload can
+ * contain anything, including newlines. There is only one room, and users
+ * are known by name, so a command names whoever it is about in its payload.
+ */
+
+/** Payload is the message, like a line without a command */
+#define FRAME_SAY 1
+/** Payload is the new username, like `.setuser` */
+#define FRAME_SETUSER 2
+/** Payload is a varint session token and a varint sequence number, like `.resume` */
+#define FRAME_RESUME 3
+/** Payload is the recipient's name, a space and the message, like `.msg` */
+#define FRAME_MSG 4
+/** Payload is the room, the start time and maybe the end time, like `.history` */
+#define FRAME_HISTORY 5
+/** Payload is the search terms, like `.search` */
+#define FRAME_SEARCH 6
+/**
+ * Payload is the varint size of an attachment, like `.upload`. Once the
+ * server replies `+upload ready`, that many raw bytes follow, unframed.
+ */
+#define FRAME_UPLOAD 7
+/** Payload is an attachment id, like `.download` */
+#define FRAME_DOWNLOAD 8
+
+/*
+ * Frames from the server have the top bit of the opcode set.
+ */
+
+/**
+ * A chat message. Payload is its varint sequence number, the varint length
+ * of the sender's name, the name and then the message.
+ */
+#define FRAME_MESSAGE 0x81
+/** Payload is the reply to a command, as it would be sent as a line */
+#define FRAME_REPLY 0x82
+/** Private messages. Payload is one or more lines, as in `mailbox.h`. */
+#define FRAME_PRIVATE 0x83
+/**
+ * The answer to `FRAME_HISTORY` or `FRAME_SEARCH`. Payload is zero or more
+ * lines, as in `history.h`.
+ */
+#define FRAME_LOG 0x84
+/** The answer to `FRAME_DOWNLOAD`. Payload is the attachment. */
+#define FRAME_ATTACHMENT 0x85
+
+/** Longest possible header: the length and the opcode */
+#define FRAME_HEADER_MAX (VARINT_MAX + 1)
+/** Longest payload a client may send */
+#define FRAME_PAYLOAD_MAX (64 * 1024)
+
+struct frame_header {
+        uint64_t len;
+        uint8_t opcode;
+};
+
+/**
+ * Write `hdr` to `out`, which must have room for `FRAME_HEADER_MAX` bytes,
+ * and return the number of bytes written.
+ */
+size_t frame_encode_header(uint8_t *out, struct frame_header const *hdr);
+
+/**
+ * Read a header from the `len` bytes at `buf`.
+ *
+ * # Returns
+ * - `-1` if the header is malformed
+ * - `0` if `buf` holds only part of a header
+ * - `n` for the size of the header
+ */
+ssize_t frame_decode_header(uint8_t const *buf, size_t len, struct frame_header *hdr);
+
+/**
+ * Receive what has arrived of a frame into `buf`, after what had arrived of
+ * it before. Nothing past the end of the frame is read, so the next one, or
+ * the bytes of an upload, stay in the socket.
+ *
+ * # Returns
+ * - `-1` for failure and set `errno`. `EAGAIN` means the frame isn't
+ *   complete: `buf` holds what has arrived of it, to be passed again once
+ *   more has. `EPROTO` means the header is malformed, or the payload is
+ *   longer than `FRAME_PAYLOAD_MAX`.
+ * - `0` for client terminated connection
+ * - `n` for the length of the header, once `buf` holds the whole frame,
+ *   followed by a null-byte. `hdr` is the decoded header, and the payload
+ *   starts `n` bytes into `buf`.
+ */
+ssize_t frame_recv(int sockfd, struct dynarray *buf, struct frame_header *hdr);
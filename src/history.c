@@ -0,0 +1,308 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "history.h"
+#include "../include/cstring.h"
+#include "../include/fmt.h"
+#include "../include/panic.h"
+
+/** Inline storage for a log line */
+#define HISTORY_INLINE_CAP 256
+/** Bytes read at a time when catching the index up with the log */
+#define HISTORY_SCAN_CHUNK (1024 * 1024)
+
+DYNARRAY_DEFINE(blocks, struct history_block)
+
+/** Parse the `<seq> <unix-time>` that starts a log line */
+static void history_parse(char const *line, uint64_t *seq, int64_t *time)
+{
+        char *end;
+        *seq = strtoull(line, &end, 10);
+        *time = strtoll(end, NULL, 10);
+}
+
+/** Index the message at `offset` if it starts a new block */
+static void history_index(struct history *self, uint64_t seq, int64_t time, int64_t offset)
+{
+        size_t nr_blocks = blocks_length(&self->blocks);
+        if (nr_blocks != 0 &&
+            offset - blocks_get(&self->blocks, -1)->offset < HISTORY_BLOCK_SIZE) {
+                return;
+        }
+        struct history_block block = { .time = time, .seq = seq, .offset = offset };
+        blocks_push(&self->blocks, block);
+        // A lost entry is found again by `history_open()`
+        (void)!write(self->indexfd, &block, sizeof block);
+}
+
+/**
+ * Read the log from the last indexed block on, to index any blocks the index
+ * file missed and find the last message. A torn line at the end is cut off.
+ */
+static int history_recover(struct history *self)
+{
+        int64_t offset = 0;
+        if (blocks_length(&self->blocks) != 0) {
+                offset = blocks_get(&self->blocks, -1)->offset;
+        }
+        char *buf = malloc(HISTORY_SCAN_CHUNK + 1);
+        if (buf == NULL) {
+                PANIC("malloc() returned NULL");
+        }
+        // Bytes at the start of `buf` that belong to the line at `offset`
+        size_t carry = 0;
+        while (offset + (int64_t)carry < self->size) {
+                if (carry == HISTORY_SCAN_CHUNK) {
+                        // No line is this long: the rest is garbage
+                        break;
+                }
+                ssize_t n = pread(self->fd, buf + carry, HISTORY_SCAN_CHUNK - carry,
+                                  offset + (int64_t)carry);
+                if (n <= 0) {
+                        free(buf);
+                        return -1;
+                }
+                size_t len = carry + (size_t)n;
+                buf[len] = '\0';
+                size_t pos = 0;
+                char const *newline;
+                while ((newline = memchr(buf + pos, '\n', len - pos)) != NULL) {
+                        uint64_t seq;
+                        int64_t time;
+                        history_parse(buf + pos, &seq, &time);
+                        history_index(self, seq, time, offset + (int64_t)pos);
+                        self->last_seq = seq;
+                        self->last_time = time;
+                        pos = (size_t)(newline - buf) + 1;
+                }
+                memmove(buf, buf + pos, len - pos);
+                carry = len - pos;
+                offset += (int64_t)pos;
+        }
+        free(buf);
+        if (offset != self->size) {
+                if (ftruncate(self->fd, offset) == -1) return -1;
+                self->size = offset;
+        }
+        return 0;
+}
+
+int history_open(struct history *self, char const *path, char const *indexpath)
+{
+        self->fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        if (self->fd == -1) return -1;
+        self->indexfd = open(indexpath, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        if (self->indexfd == -1) return -1;
+        self->blocks = dynarray_new();
+        self->last_seq = 0;
+        self->last_time = 0;
+        self->cache = NULL;
+        self->cache_cap = 0;
+        self->cache_offset = -1;
+        self->cache_len = 0;
+
+        struct stat st;
+        if (fstat(self->fd, &st) == -1) return -1;
+        self->size = st.st_size;
+        if (fstat(self->indexfd, &st) == -1) return -1;
+        size_t nr_blocks = (size_t)st.st_size / sizeof(struct history_block);
+        blocks_reserve(&self->blocks, nr_blocks);
+        for (size_t i = 0; i < nr_blocks; ++i) {
+                struct history_block block;
+                if (pread(self->indexfd, &block, sizeof block, (off_t)(i * sizeof block)) !=
+                    sizeof block) {
+                        return -1;
+                }
+                // Entries past the end of the log are from lines that were torn
+                if (block.offset >= self->size) {
+                        nr_blocks = i;
+                        break;
+                }
+                blocks_push(&self->blocks, block);
+        }
+        if (ftruncate(self->indexfd, (off_t)(nr_blocks * sizeof(struct history_block))) == -1) {
+                return -1;
+        }
+        return history_recover(self);
+}
+
+void history_append(struct history *self, uint64_t seq, struct rcstr *from,
+                    struct rcstr *text)
+{
+        int64_t now = time(NULL);
+        if (now < self->last_time) {
+                // The clock went back. Keep the log sorted.
+                now = self->last_time;
+        }
+        CSTRING_INLINE(line, HISTORY_INLINE_CAP);
+        FMT(&line, seq, " ", now, " ", rcstr_length(from), " ");
+        size_t from_start = line.buf.len - 1;
+        FMT(&line, from, ": ", text, "\n");
+        // One record per line, whatever a client managed to put in a name
+        char *data = line.buf.data;
+        size_t len = line.buf.len - 1;
+        for (size_t i = from_start; i < len - 1; ++i) {
+                if (data[i] == '\n') {
+                        data[i] = ' ';
+                }
+        }
+        if (write(self->fd, data, len) == (ssize_t)len) {
+                history_index(self, seq, now, self->size);
+                self->size += (int64_t)len;
+                self->last_seq = seq;
+                self->last_time = now;
+        }
+        cstring_free(&line);
+}
+
+char const *history_text(char const *line, char const *end)
+{
+        char *it;
+        strtoull(line, &it, 10);
+        strtoll(it, &it, 10);
+        char *from;
+        uint64_t from_len = strtoull(it, &from, 10);
+        if (from != it && from < end && *from == ' ') {
+                char const *sep = from + 1;
+                if ((uint64_t)(end - sep) >= from_len + 2) {
+                        sep += from_len;
+                        if (sep[0] == ':' && sep[1] == ' ') {
+                                return sep + 2;
+                        }
+                }
+        }
+        char const *sep = memmem(it, (size_t)(end - it), ": ", 2);
+        return sep ? sep + 2 : NULL;
+}
+
+/**
+ * Read block `i` of the log, and write where it starts to `begin` and its
+ * length to `len`. The bytes are NUL-terminated, and valid until the next
+ * call. Blocks never change once they are written, except that the last one
+ * grows, so the block read last is kept and only its new bytes are read.
+ *
+ * # Returns
+ * - `NULL` if the log couldn't be read
+ */
+static char const *history_read_block(struct history *self, size_t i, int64_t *begin,
+                                      size_t *len)
+{
+        *begin = blocks_get(&self->blocks, (ssize_t)i)->offset;
+        int64_t end = i + 1 == blocks_length(&self->blocks) ?
+                              self->size :
+                              blocks_get(&self->blocks, (ssize_t)i + 1)->offset;
+        *len = (size_t)(end - *begin);
+        size_t have = self->cache_offset == *begin && self->cache_len <= *len ?
+                              self->cache_len :
+                              0;
+        if (*len + 1 > self->cache_cap) {
+                self->cache_cap = *len + 1;
+                self->cache = realloc(self->cache, self->cache_cap);
+                if (self->cache == NULL) {
+                        PANIC("realloc() returned NULL");
+                }
+        }
+        size_t want = *len - have;
+        if (want != 0 &&
+            pread(self->fd, self->cache + have, want, *begin + (int64_t)have) != (ssize_t)want) {
+                self->cache_offset = -1;
+                return NULL;
+        }
+        self->cache[*len] = '\0';
+        self->cache_offset = *begin;
+        self->cache_len = *len;
+        return self->cache;
+}
+
+/**
+ * Offset of the first message sent at or after `time`: it is in the block
+ * before the first block that starts at or after `time`, or starts that
+ * block.
+ */
+static off_t history_seek(struct history *self, int64_t time)
+{
+        size_t lo = 0;
+        size_t hi = blocks_length(&self->blocks);
+        while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (blocks_get(&self->blocks, (ssize_t)mid)->time < time) {
+                        lo = mid + 1;
+                } else {
+                        hi = mid;
+                }
+        }
+        if (lo == 0) {
+                return 0;
+        }
+        int64_t begin;
+        size_t len;
+        char const *buf = history_read_block(self, lo - 1, &begin, &len);
+        if (buf == NULL) {
+                return begin + (off_t)len;
+        }
+        size_t pos = 0;
+        while (pos < len) {
+                uint64_t seq;
+                int64_t line_time;
+                history_parse(buf + pos, &seq, &line_time);
+                if (line_time >= time) {
+                        break;
+                }
+                char const *newline = memchr(buf + pos, '\n', len - pos);
+                pos = newline ? (size_t)(newline - buf) + 1 : len;
+        }
+        return begin + (off_t)pos;
+}
+
+void history_range(struct history *self, int64_t since, int64_t until, off_t *begin,
+                   off_t *end)
+{
+        *begin = history_seek(self, since);
+        *end = until > self->last_time ? self->size : history_seek(self, until);
+        if (*end < *begin) {
+                *end = *begin;
+        }
+}
+
+bool history_find(struct history *self, uint64_t seq, off_t *begin, off_t *end)
+{
+        // The last block that starts at or before `seq`
+        size_t lo = 0;
+        size_t hi = blocks_length(&self->blocks);
+        while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (blocks_get(&self->blocks, (ssize_t)mid)->seq <= seq) {
+                        lo = mid + 1;
+                } else {
+                        hi = mid;
+                }
+        }
+        if (lo == 0) {
+                return false;
+        }
+        int64_t block_begin;
+        size_t len;
+        char const *buf = history_read_block(self, lo - 1, &block_begin, &len);
+        bool found = false;
+        if (buf != NULL) {
+                size_t pos = 0;
+                while (pos < len) {
+                        uint64_t line_seq;
+                        int64_t time;
+                        history_parse(buf + pos, &line_seq, &time);
+                        char const *newline = memchr(buf + pos, '\n', len - pos);
+                        size_t next = newline ? (size_t)(newline - buf) + 1 : len;
+                        if (line_seq == seq) {
+                                *begin = block_begin + (off_t)pos;
+                                *end = block_begin + (off_t)next;
+                                found = true;
+                                break;
+                        }
+                        pos = next;
+                }
+        }
+        return found;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "../include/dynarray.h"
+#include "../include/rcstr.h"
+
+/** Bytes of history per index entry */
+#define HISTORY_BLOCK_SIZE (64 * 1024)
+
+/** Where a block of the history log starts: its first message */
+struct history_block {
+        int64_t time;
+        uint64_t seq;
+        int64_t offset;
+};
+
+/**
+ * Every message posted to the room, kept on disk. The log is an append-only
+ * file of lines:
+ *
+ * ```plaintext
+ * <seq> <unix-time> <from-length> <from>: <message>
+ * ```
+ *
+ * oldest first, with any newline in a name or message turned into a space.
+ * `<from-length>` is the length of the name in bytes, so a name with `: `
+ * in it can't be mistaken for the end of the name. Times
+ * never go backwards, so the log is sorted by both sequence number and
+ * time.
+ *
+ * The index is sparse: the log is cut into blocks of about
+ * `HISTORY_BLOCK_SIZE` bytes, and only the first message of each block is
+ * indexed, in memory and in an index file next to the log. A lookup by time
+ * is a binary search over the blocks, and a scan of at most one of them.
+ */
+struct history {
+        /** The log */
+        int fd;
+        /** The index, an array of `struct history_block` */
+        int indexfd;
+        /** Bytes in the log */
+        int64_t size;
+        /** The index, as `struct history_block` */
+        struct dynarray blocks;
+        /** Sequence number of the last message in the log, or `0` */
+        uint64_t last_seq;
+        /** Time of the last message in the log */
+        int64_t last_time;
+        /**
+         * The block of the log read last, so that lookups close together,
+         * like the results of a search, read and allocate nothing
+         */
+        char *cache;
+        size_t cache_cap;
+        /** Where the cached bytes start in the log, or `-1` */
+        int64_t cache_offset;
+        size_t cache_len;
+};
+
+/**
+ * Use (and create, if need be) the log `path` and the index `indexpath`. An
+ * index that is behind the log, or a torn line at the end of the log, from a
+ * crash are repaired.
+ *
+ * # Returns
+ * - `-1` for failure and set `errno`
+ * - `0` for success
+ */
+int history_open(struct history *self, char const *path, char const *indexpath);
+
+/**
+ * Append a message to the log, stamped with the current time.
+ */
+void history_append(struct history *self, uint64_t seq, struct rcstr *from,
+                    struct rcstr *text);
+
+/**
+ * The `<message>` of the log line `[line, end)`, or `NULL` if it is
+ * malformed. Lines written before names were length-prefixed, without
+ * `<from-length>`, are split on the first `: `.
+ */
+char const *history_text(char const *line, char const *end);
+
+/**
+ * Find the message `seq`. It is the bytes `[*begin, *end)` of the log.
+ *
+ * # Returns
+ * - `false` if it isn't in the log
+ */
+bool history_find(struct history *self, uint64_t seq, off_t *begin, off_t *end);
+
+/**
+ * Find the messages sent in `[since, until)`. They are the bytes `[*begin,
+ * *end)` of the log.
+ */
+void history_range(struct history *self, int64_t since, int64_t until, off_t *begin,
+                   off_t *end);
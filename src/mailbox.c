@@ -0,0 +1,331 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "mailbox.h"
+#include "frame.h"
+#include "chatroom.h"
+#include "../include/rcstr.h"
+#include "../include/panic.h"
+
+/** Longest suffix a mailbox file ever gets */
+#define MAILBOX_SUFFIX_MAX (sizeof ".sending" - 1)
+/**
+ * Longest username with a mailbox, so that its hex, with any suffix, is a
+ * valid filename
+ */
+#define MAILBOX_NAME_MAX ((NAME_MAX - MAILBOX_SUFFIX_MAX) / 2)
+
+/**
+ * Write the filename of the mailbox of `name` to `out`, which must have room
+ * for `NAME_MAX + 1` bytes. Usernames can be any utf8, so they are hex
+ * encoded. The names never contain a `.`, which the compactor relies on.
+ */
+static int mailbox_filename(char *out, char const *name)
+{
+        size_t len = strlen(name);
+        if (len == 0 || len > MAILBOX_NAME_MAX) {
+                errno = ENAMETOOLONG;
+                return -1;
+        }
+        for (size_t i = 0; i < len; ++i) {
+                uint8_t byte = (uint8_t)name[i];
+                out[2 * i] = "0123456789abcdef"[byte >> 4];
+                out[2 * i + 1] = "0123456789abcdef"[byte & 0xf];
+        }
+        out[2 * len] = '\0';
+        return 0;
+}
+
+/**
+ * Write `filename` followed by `suffix`, e.g. `.tmp`, to `out`, which must have
+ * room for `NAME_MAX + 1` bytes.
+ *
+ * # Returns
+ * - `-1` if the name would be too long, and set `errno`
+ * - `0` for success
+ */
+static int mailbox_suffixed(char *out, char const *filename, char const *suffix)
+{
+        int len = snprintf(out, NAME_MAX + 1, "%s%s", filename, suffix);
+        if (len < 0 || len > NAME_MAX) {
+                errno = ENAMETOOLONG;
+                return -1;
+        }
+        return 0;
+}
+
+/**
+ * Drop the messages sent before `cutoff` from one mailbox. The messages are
+ * in the order they were sent, so those are a prefix of the file, and the
+ * rest is written to a temporary file that replaces it.
+ */
+static void mailbox_compact_file(struct mailbox *self, char const *filename, time_t cutoff)
+{
+        int fd = openat(self->dirfd, filename, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+                return;
+        }
+        char *buf = NULL;
+        struct stat st;
+        if (fstat(fd, &st) == -1 || st.st_size == 0) {
+                goto out;
+        }
+        size_t size = (size_t)st.st_size;
+        buf = malloc(size + 1);
+        if (buf == NULL) {
+                PANIC("malloc() returned NULL");
+        }
+        if (pread(fd, buf, size, 0) != (ssize_t)size) {
+                goto out;
+        }
+        buf[size] = '\0';
+
+        size_t keep = 0;
+        while (keep < size && strtoll(buf + keep + 1, NULL, 10) < cutoff) {
+                char const *newline = memchr(buf + keep, '\n', size - keep);
+                keep = newline ? (size_t)(newline - buf) + 1 : size;
+        }
+        if (keep == 0) {
+                goto out;
+        }
+        if (keep == size) {
+                unlinkat(self->dirfd, filename, 0);
+                goto out;
+        }
+        char tmpname[NAME_MAX + 1];
+        if (mailbox_suffixed(tmpname, filename, ".tmp") == -1) {
+                goto out;
+        }
+        int tmpfd = openat(self->dirfd, tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (tmpfd == -1) {
+                goto out;
+        }
+        if (write(tmpfd, buf + keep, size - keep) == (ssize_t)(size - keep)) {
+                renameat(self->dirfd, tmpname, self->dirfd, filename);
+        } else {
+                unlinkat(self->dirfd, tmpname, 0);
+        }
+        close(tmpfd);
+out:
+        free(buf);
+        close(fd);
+}
+
+
+/**
+ * Put the bytes `[sent, end)` of `fd`, messages that were being delivered,
+ * back in the mailbox `filename`, ahead of any that arrived since, so it
+ * stays oldest first. A message that was cut off is sent again whole.
+ */
+static void mailbox_restore(struct mailbox *self, char const *filename, int fd, off_t sent,
+                            off_t end)
+{
+        char *buf = malloc((size_t)end);
+        if (buf == NULL) {
+                PANIC("malloc() returned NULL");
+        }
+        if (pread(fd, buf, (size_t)end, 0) != (ssize_t)end) {
+                goto out;
+        }
+        off_t start = sent;
+        while (start > 0 && buf[start - 1] != '\n') {
+                --start;
+        }
+        char tmpname[NAME_MAX + 1];
+        if (mailbox_suffixed(tmpname, filename, ".tmp") == -1) {
+                goto out;
+        }
+        int tmpfd = openat(self->dirfd, tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (tmpfd == -1) {
+                goto out;
+        }
+        bool ok = write(tmpfd, buf + start, (size_t)(end - start)) == (ssize_t)(end - start);
+        int newer = openat(self->dirfd, filename, O_RDONLY | O_CLOEXEC);
+        if (newer != -1) {
+                char chunk[4096];
+                ssize_t n;
+                while (ok && (n = read(newer, chunk, sizeof chunk)) > 0) {
+                        ok = write(tmpfd, chunk, (size_t)n) == n;
+                }
+                close(newer);
+        }
+        if (ok) {
+                renameat(self->dirfd, tmpname, self->dirfd, filename);
+        } else {
+                unlinkat(self->dirfd, tmpname, 0);
+        }
+        close(tmpfd);
+out:
+        free(buf);
+}
+
+/**
+ * Merge the mailboxes a previous run was delivering when it stopped back
+ * into place. None of them is known to have arrived.
+ */
+static void mailbox_recover(struct mailbox *self)
+{
+        int fd = openat(self->dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR *dir = fd == -1 ? NULL : fdopendir(fd);
+        if (dir == NULL) {
+                return;
+        }
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL) {
+                char *dot = strchr(ent->d_name, '.');
+                if (dot == NULL || strcmp(dot, ".sending") != 0) {
+                        continue;
+                }
+                char filename[NAME_MAX + 1];
+                snprintf(filename, sizeof filename, "%.*s", (int)(dot - ent->d_name),
+                         ent->d_name);
+                int sending = openat(self->dirfd, ent->d_name, O_RDONLY | O_CLOEXEC);
+                struct stat st;
+                if (sending != -1 && fstat(sending, &st) == 0) {
+                        mailbox_restore(self, filename, sending, 0, st.st_size);
+                }
+                if (sending != -1) {
+                        close(sending);
+                }
+                unlinkat(self->dirfd, ent->d_name, 0);
+        }
+        closedir(dir);
+}
+
+static void mailbox_compact(struct mailbox *self, time_t cutoff)
+{
+        // Our own descriptor, since reading a directory moves its offset
+        int fd = openat(self->dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR *dir = fd == -1 ? NULL : fdopendir(fd);
+        if (dir == NULL) {
+                return;
+        }
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL) {
+                // `.`, `..` and temporary files
+                if (strchr(ent->d_name, '.')) {
+                        continue;
+                }
+                pthread_mutex_lock(&self->lock);
+                mailbox_compact_file(self, ent->d_name, cutoff);
+                pthread_mutex_unlock(&self->lock);
+        }
+        closedir(dir);
+}
+
+static void *mailbox_compactor(void *arg)
+{
+        struct mailbox *self = arg;
+        while (true) {
+                sleep(MAILBOX_COMPACT_INTERVAL);
+                mailbox_compact(self, time(NULL) - MAILBOX_TTL);
+        }
+        return NULL;
+}
+
+int mailbox_open(struct mailbox *self, char const *dir)
+{
+        if (mkdir(dir, 0700) == -1 && errno != EEXIST) return -1;
+        if ((self->dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) return -1;
+        mailbox_recover(self);
+        pthread_mutex_init(&self->lock, NULL);
+        if ((errno = pthread_create(&self->compactor, NULL, mailbox_compactor, self))) return -1;
+        return 0;
+}
+
+int mailbox_append(struct mailbox *self, char const *to, char const *record, size_t len)
+{
+        char filename[NAME_MAX + 1];
+        if (mailbox_filename(filename, to) == -1) {
+                return -1;
+        }
+        int ret = -1;
+        pthread_mutex_lock(&self->lock);
+        int fd = openat(self->dirfd, filename, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        if (fd == -1) {
+                goto out;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+                if ((size_t)st.st_size + len > MAILBOX_MAX) {
+                        errno = ENOSPC;
+                } else if (write(fd, record, len) == (ssize_t)len) {
+                        ret = 0;
+                }
+        }
+        close(fd);
+out:
+        pthread_mutex_unlock(&self->lock);
+        return ret;
+}
+
+/** A mailbox on its way to a client */
+struct mailbox_delivery {
+        struct mailbox *mailbox;
+        char filename[NAME_MAX + 1];
+};
+
+/**
+ * The delivery of a mailbox is over: drop it if it all went out, and put
+ * back what didn't otherwise
+ */
+static void mailbox_delivered(void *arg, int fd, off_t offset, off_t end)
+{
+        struct mailbox_delivery *delivery = arg;
+        struct mailbox *self = delivery->mailbox;
+        // Fits, or the delivery wouldn't have started
+        char sending[NAME_MAX + 1];
+        mailbox_suffixed(sending, delivery->filename, ".sending");
+        pthread_mutex_lock(&self->lock);
+        if (offset < end) {
+                mailbox_restore(self, delivery->filename, fd, offset, end);
+        }
+        unlinkat(self->dirfd, sending, 0);
+        pthread_mutex_unlock(&self->lock);
+        free(delivery);
+}
+
+void mailbox_deliver(struct mailbox *self, struct sockclient *client)
+{
+        struct mailbox_delivery *delivery = malloc(sizeof *delivery);
+        if (delivery == NULL) {
+                PANIC("malloc() returned NULL");
+        }
+        delivery->mailbox = self;
+        char sending[NAME_MAX + 1];
+        if (mailbox_filename(delivery->filename, rcstr_as_cstr(client->name)) == -1
+            || mailbox_suffixed(sending, delivery->filename, ".sending") == -1) {
+                free(delivery);
+                return;
+        }
+        pthread_mutex_lock(&self->lock);
+        // Messages that arrive from now on start a new mailbox. If there
+        // already is a `.sending`, another connection of the user has them.
+        if (linkat(self->dirfd, delivery->filename, self->dirfd, sending, 0) == -1) {
+                pthread_mutex_unlock(&self->lock);
+                free(delivery);
+                return;
+        }
+        unlinkat(self->dirfd, delivery->filename, 0);
+        int fd = openat(self->dirfd, sending, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1 || st.st_size == 0) {
+                if (fd != -1) {
+                        close(fd);
+                }
+                unlinkat(self->dirfd, sending, 0);
+                pthread_mutex_unlock(&self->lock);
+                free(delivery);
+                return;
+        }
+        pthread_mutex_unlock(&self->lock);
+
+        if (client->flags & CLIENTBINARY) {
+                uint8_t hdrbuf[FRAME_HEADER_MAX];
+                struct frame_header hdr = { .len = (uint64_t)st.st_size, .opcode = FRAME_PRIVATE };
+                client_send(client, hdrbuf, frame_encode_header(hdrbuf, &hdr));
+        }
+        client_send_file_then(client, fd, 0, st.st_size, mailbox_delivered, delivery);
+}
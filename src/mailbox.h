@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "main.h"
+
+/** Most bytes of private messages kept for one user */
+#define MAILBOX_MAX (64 * 1024)
+/** Seconds a private message waits for its recipient before it is dropped */
+#define MAILBOX_TTL (7 * 24 * 60 * 60)
+/** Seconds between compaction passes */
+#define MAILBOX_COMPACT_INTERVAL 60
+
+/**
+ * Private messages for users who are not connected. Each user has an
+ * append-only file in the mailbox directory, named by the hex of their
+ * username, holding their messages exactly as they are sent:
+ *
+ * ```plaintext
+ * @<unix-time> <from>: <message>
+ * ```
+ *
+ * one per line, oldest first. That way a whole mailbox is delivered with
+ * `sendfile()`, as one batch, without reading it into memory. While it is
+ * on its way it is called `<name>.sending`, and new messages start a new
+ * mailbox.
+ *
+ * A background thread drops messages older than `MAILBOX_TTL` every
+ * `MAILBOX_COMPACT_INTERVAL` seconds, by rewriting the files that have any.
+ * `lock` is held for any access to the files.
+ */
+struct mailbox {
+        /** The mailbox directory */
+        int dirfd;
+        pthread_mutex_t lock;
+        pthread_t compactor;
+};
+
+/**
+ * Use (and create, if need be) the directory `dir` for mailboxes, and start
+ * the compaction thread.
+ *
+ * # Returns
+ * - `-1` for failure and set `errno`
+ * - `0` for success
+ */
+int mailbox_open(struct mailbox *self, char const *dir);
+
+/**
+ * Append the `len` bytes of `record` (one formatted line) to the mailbox of
+ * `to`.
+ *
+ * # Returns
+ * - `-1` for failure and set `errno`. `ENOSPC` means the mailbox is full.
+ * - `0` for success
+ */
+int mailbox_append(struct mailbox *self, char const *to, char const *record, size_t len);
+
+/**
+ * Send everything in the mailbox of `client` to it, and empty the mailbox.
+ * Line clients get the lines, and binary clients one `FRAME_PRIVATE` with
+ * all of them. The file is streamed with `client_send_file()`, and is only
+ * removed once it has all gone out: whatever hasn't when the client
+ * disconnects, or the server stops, is put back for next time.
+ */
+void mailbox_deliver(struct mailbox *self, struct sockclient *client);
@@ -1,15 +1,33 @@
+#define _GNU_SOURCE
 #include "main.h"
 #include "command.h"
+#include "frame.h"
+#include "chatroom.h"
 #include "../include/dynarray.h"
 #include "../include/cstring.h"
 #include "../include/fmt.h"
 #include "../include/slice.h"
 #include "../include/panic.h"
 #include "../include/jtable.h"
+#include "../include/arena.h"
+#include "../include/utf8.h"
 
 #define EPOLL_TIMEOUT 10000
 #define MAX_EVENTS 100
 #define MAX_QUEUED_CONNECTIONS 10
+/** Where private messages for disconnected users are kept */
+#define MAILBOX_DIR "./mailbox"
+/** Every message posted, and its index */
+#define HISTORY_LOG "./history.log"
+#define HISTORY_INDEX "./history.idx"
+/** Banned terms and URLs, one per line */
+#define FILTER_LIST "./banned.txt"
+/** Blobs uploaded with `.upload` */
+#define ATTACHMENT_DIR "./attachments"
+/** Inline storage for a received line. Almost all chat lines fit. */
+#define MSG_INLINE_CAP 128
+
+DYNARRAY_DEFINE(bytes, uint8_t)
 
 bool is_ascii_control(char ch)
 {
@@ -17,50 +35,62 @@ bool is_ascii_control(char ch)
 }
 
 /**
- * Receive an arbitrary amount of data, extending `arr`. Uses kilobyte chunks.
- * Terminate based on `terminate()` callback.
+ * Receive what has arrived of a line into `msg`, after what had arrived of it
+ * before. Nothing past the newline is read, so what follows (frames after
+ * `.binary`, or the bytes of an upload) stays in the socket.
  *
  * # Returns
- * - `-1` for failure and set `errno`
+ * - `-1` for failure and set `errno`. `EAGAIN` means the line isn't
+ *   complete: `msg` holds what has arrived of it, to be passed again once
+ *   more has.
  * - `0` for client terminated connected
- * - `n` for number of bytes received
+ * - `n` for the length of the line, once `msg` ends with its newline
  */
-ssize_t dynarray_recv(struct dynarray *restrict msg, int sockfd,
-                      bool(terminate(struct dynarray *msg)))
+ssize_t line_recv(struct dynarray *restrict msg, int sockfd)
 {
-        ssize_t total_recvd = 0;
         while (true) {
                 uint8_t msgpart[1024];
-                memset(msgpart, 0, sizeof msgpart);
-                ssize_t recvd = recv(sockfd, msgpart, sizeof msgpart, 0);
-                if (recvd <= 0) {
-                        return recvd;
+                ssize_t peeked = recv(sockfd, msgpart, sizeof msgpart, MSG_PEEK);
+                if (peeked <= 0) {
+                        return peeked;
                 }
-                total_recvd += recvd;
-                dynarray_extend(msg, &msgpart[0], &msgpart[0] + recvd);
-                if (terminate(msg)) {
-                        return total_recvd;
+                uint8_t *newline = memchr(msgpart, '\n', (size_t)peeked);
+                size_t take = newline ? (size_t)(newline - msgpart) + 1 : (size_t)peeked;
+                recv(sockfd, msgpart, take, 0);
+                dynarray_extend(msg, &msgpart[0], &msgpart[0] + take);
+                if (newline) {
+                        return (ssize_t)msg->len;
                 }
         }
 }
 
-/** Test if a message ends with a newline */
-bool terminate_msg(struct dynarray *msg)
+/**
+ * Start `msg` with what had arrived of the message `client` was in the middle
+ * of, if any. That is rare, so it lives on the heap only until it is done.
+ */
+void inbox_take(struct sockclient *client, struct dynarray *msg)
 {
-        if (msg->len == 0) {
-                return false;
+        if (client->inbox.len == 0) {
+                return;
         }
-        return ((char *)msg->data)[msg->len - 1] == '\n';
+        dynarray_extend(msg, client->inbox.data, (uint8_t *)client->inbox.data + client->inbox.len);
+        dynarray_free(&client->inbox);
+        client->inbox = dynarray_new();
+}
+
+/** Keep what has arrived of a message in `msg` until the rest does */
+void inbox_keep(struct sockclient *client, struct dynarray *msg)
+{
+        dynarray_extend(&client->inbox, msg->data, (uint8_t *)msg->data + msg->len);
 }
 
 /** Trim any control characters off the end of a `dynarray[char]` */
 void trim_msg(struct dynarray *restrict msg)
 {
-        while (msg->len != 0 &&
-               is_ascii_control(*(char *)dynarray_get(msg, TYPEINFO(uint8_t), msg->len - 1))) {
+        while (msg->len != 0 && is_ascii_control(*bytes_get(msg, -1))) {
                 msg->len--;
         }
-        DYNARRAY_PUSH(msg, uint8_t, '\0');
+        bytes_push(msg, '\0');
 }
 
 /** Create a new server (listener) socket */
@@ -106,18 +136,34 @@ int add_server_socket(int epollfd, char const *name, char const *service)
         return 0;
 }
 
-int add_client(int epollfd, int serversockfd)
+int add_client(int epollfd, struct chatroom *room, int serversockfd)
 {
         struct sockaddr clientaddr;
         socklen_t clientaddrsz = sizeof clientaddr;
-        int clientsockfd = accept(serversockfd, (struct sockaddr *)&clientaddr, &clientaddrsz);
+        // Non-blocking, so that a client that stops halfway through a message
+        // can't hold up the others
+        int clientsockfd = accept4(serversockfd, (struct sockaddr *)&clientaddr, &clientaddrsz,
+                                   SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (clientsockfd == -1) return -1;
+        // Replies are often a header and then a file, as two sends
+        int nodelay = 1;
+        setsockopt(clientsockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof nodelay);
 
         struct sockclient *client = malloc(sizeof(struct sockclient));
         client->sockaddr = clientaddr;
         client->flags = SOCKCLIENT;
         client->sockfd = clientsockfd;
         client->name = NULL;
+        client->token = 0;
+        client->epollfd = epollfd;
+        client->outbox = deque_new();
+        client->outbox_bytes = 0;
+        // Refills to full on the first message
+        client->bucket = (struct token_bucket){ .tokens = 0, .updated = 0 };
+        client->resume_at = 0;
+        client->upload = NULL;
+        client->inbox = dynarray_new();
+        chatroom_join(room, client);
 
         struct epoll_event event = { EPOLLIN, { .ptr = (void *)client } };
         epoll_ctl(epollfd, EPOLL_CTL_ADD, clientsockfd, &event);
@@ -125,14 +171,18 @@ int add_client(int epollfd, int serversockfd)
         return 0;
 }
 
-void del_client(int epollfd, struct sockclient *client)
+void del_client(int epollfd, struct chatroom *room, struct sockclient *client)
 {
+        chatroom_leave(room, client);
         epoll_ctl(epollfd, EPOLL_CTL_DEL, client->sockfd, NULL);
-        free(client->name);
+        close(client->sockfd);
+        client_clear_outbox(client);
+        dynarray_free(&client->inbox);
+        rcstr_drop(client->name);
         free(client);
 }
 
-/** Get the type of this socket, either `SOCKSERVER` or `SOCKCLIENT` */
+/** Get the type of this socket, `SOCKSERVER`, `SOCKCLIENT` or `SOCKTIMER` */
 int socktype(void *sockinfo)
 {
         uint32_t flags = *(uint32_t *)sockinfo;
@@ -142,34 +192,215 @@ int socktype(void *sockinfo)
         if (flags & SOCKSERVER) {
                 return SOCKSERVER;
         }
+        if (flags & SOCKTIMER) {
+                return SOCKTIMER;
+        }
         return 0;
 }
 
-void handle_event(int epollfd, struct epoll_event ev)
+/**
+ * Handle one frame from a client in binary mode, once it has all arrived.
+ * Nothing is parsed but the header: the payload goes straight to the command
+ * for the opcode.
+ */
+void handle_frame(int epollfd, struct chatroom *room, struct sockclient *client,
+                  struct arena *arena)
+{
+        struct frame_header hdr;
+        DYNARRAY_INLINE_IN(frame, MSG_INLINE_CAP, arena);
+        inbox_take(client, &frame);
+        ssize_t hdrlen = frame_recv(client->sockfd, &frame, &hdr);
+        if (hdrlen <= 0) {
+                if (hdrlen == -1 && errno == EAGAIN) {
+                        inbox_keep(client, &frame);
+                } else {
+                        // A client that breaks framing can't be resynchronised
+                        del_client(epollfd, room, client);
+                }
+                dynarray_free(&frame);
+                return;
+        }
+        ratelimit_charge(&room->ratelimit, client, 1.0);
+        void const *payload = (uint8_t const *)frame.data + hdrlen;
+        // Never pass on malformed text, but other payloads are binary
+        bool text = hdr.opcode == FRAME_SAY || hdr.opcode == FRAME_SETUSER ||
+                    hdr.opcode == FRAME_MSG || hdr.opcode == FRAME_HISTORY ||
+                    hdr.opcode == FRAME_SEARCH || hdr.opcode == FRAME_DOWNLOAD;
+        if (text && !utf8_validate(payload, hdr.len)) {
+                dynarray_free(&frame);
+                return;
+        }
+        if (text && filter_blocks(&room->filter, payload, hdr.len)) {
+                client_reply(client, "-blocked");
+                dynarray_free(&frame);
+                return;
+        }
+        switch (hdr.opcode) {
+        case FRAME_SAY:
+                command_say(room, client, payload);
+                break;
+        case FRAME_SETUSER:
+                command_setuser(room, client, payload);
+                break;
+        case FRAME_MSG:
+                command_msg(room, client, payload);
+                break;
+        case FRAME_HISTORY:
+                command_history(room, client, payload);
+                break;
+        case FRAME_SEARCH:
+                command_search(room, client, payload);
+                break;
+        case FRAME_UPLOAD: {
+                uint64_t size;
+                uint8_t const *it = payload;
+                if (varint_decode(&it, it + hdr.len, &size)) {
+                        command_upload_size(room, client, size);
+                }
+                break;
+        }
+        case FRAME_DOWNLOAD:
+                command_download(room, client, payload);
+                break;
+        case FRAME_RESUME: {
+                uint64_t token, last_seq;
+                uint8_t const *it = payload;
+                uint8_t const *end = it + hdr.len;
+                if (varint_decode(&it, end, &token) && varint_decode(&it, end, &last_seq)) {
+                        command_resume_session(room, client, token, last_seq);
+                }
+                break;
+        }
+        }
+        dynarray_free(&frame);
+}
+
+/**
+ * Move the next chunk of the upload of `client` to its file. The bytes are
+ * charged to its rate limit afterwards, once it is known how many came.
+ */
+void handle_upload(int epollfd, struct chatroom *room, struct sockclient *client)
+{
+        if (ratelimit_wait(&room->ratelimit, client)) {
+                return;
+        }
+        // Forgotten once the upload is complete
+        char id[ATTACHMENT_ID_LEN + 1];
+        memcpy(id, client->upload->id, sizeof id);
+        off_t offset = client->upload->offset;
+        off_t size = client->upload->size;
+        switch (upload_receive(&room->attachments, client)) {
+        case -1:
+                // What is left of it can't be told apart from commands
+                del_client(epollfd, room, client);
+                break;
+        case 0:
+                ratelimit_charge(&room->ratelimit, client,
+                                 (double)(client->upload->offset - offset) / RATE_UPLOAD_BYTES);
+                break;
+        case 1: {
+                ratelimit_charge(&room->ratelimit, client,
+                                 (double)(size - offset) / RATE_UPLOAD_BYTES);
+                CSTRING_INLINE(reply, MSG_INLINE_CAP);
+                FMT(&reply, "+upload ", id);
+                client_reply(client, cstring_as_cstr(&reply));
+                cstring_free(&reply);
+                break;
+        }
+        }
+}
+
+/**
+ * Handle a single event. Transient allocations come from `arena`, which the
+ * caller resets once a whole batch of events has been handled.
+ */
+void handle_event(int epollfd, struct chatroom *room, struct epoll_event ev,
+                  struct arena *arena)
 {
         if (socktype(ev.data.ptr) == SOCKSERVER) {
                 struct sockserver *server = ev.data.ptr;
-                add_client(epollfd, server->sockfd);
+                add_client(epollfd, room, server->sockfd);
+
+        } else if (socktype(ev.data.ptr) == SOCKTIMER) {
+                ratelimit_wake(&room->ratelimit);
 
         } else if (socktype(ev.data.ptr) == SOCKCLIENT) {
                 struct sockclient *client = ev.data.ptr;
-                struct dynarray msg = dynarray_new();
-                ssize_t recvd = dynarray_recv(&msg, client->sockfd, terminate_msg);
-                if (recvd == -1) return;
-                if (recvd == 0) {
-                        del_client(epollfd, client);
+                if (ev.events & EPOLLOUT) {
+                        client_flush(client);
+                }
+                if (!(ev.events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                        return;
+                }
+                if (client->upload) {
+                        handle_upload(epollfd, room, client);
+                        return;
+                }
+                // A hangup is read whatever the rate, to clean up. Only whole
+                // messages are charged for.
+                if (!(ev.events & (EPOLLHUP | EPOLLERR)) &&
+                    ratelimit_wait(&room->ratelimit, client)) {
                         return;
                 }
+                if (client->flags & CLIENTBINARY) {
+                        handle_frame(epollfd, room, client, arena);
+                        return;
+                }
+                DYNARRAY_INLINE_IN(msg, MSG_INLINE_CAP, arena);
+                inbox_take(client, &msg);
+                ssize_t recvd = line_recv(&msg, client->sockfd);
+                if (recvd <= 0) {
+                        if (recvd == -1 && errno == EAGAIN) {
+                                inbox_keep(client, &msg);
+                        } else {
+                                del_client(epollfd, room, client);
+                        }
+                        dynarray_free(&msg);
+                        return;
+                }
+                ratelimit_charge(&room->ratelimit, client, 1.0);
                 trim_msg(&msg);
+                // Never pass on malformed text
+                if (!utf8_validate(msg.data, msg.len - 1)) {
+                        dynarray_free(&msg);
+                        return;
+                }
+                if (filter_blocks(&room->filter, msg.data, msg.len - 1)) {
+                        client_reply(client, "-blocked");
+                        dynarray_free(&msg);
+                        return;
+                }
                 char const *args;
                 switch (select_command(msg.data, &args)) {
                 case COMMAND_SAY:
-                        command_say(client, args);
+                        command_say(room, client, args);
                         break;
                 case COMMAND_SETUSER:
-                        command_setuser(client, args);
+                        command_setuser(room, client, args);
+                        break;
+                case COMMAND_RESUME:
+                        command_resume(room, client, args);
+                        break;
+                case COMMAND_MSG:
+                        command_msg(room, client, args);
+                        break;
+                case COMMAND_HISTORY:
+                        command_history(room, client, args);
+                        break;
+                case COMMAND_SEARCH:
+                        command_search(room, client, args);
+                        break;
+                case COMMAND_UPLOAD:
+                        command_upload(room, client, args);
+                        break;
+                case COMMAND_DOWNLOAD:
+                        command_download(room, client, args);
+                        break;
+                case COMMAND_BINARY:
+                        command_binary(client);
                         break;
                 }
+                dynarray_free(&msg);
         }
 }
 
@@ -184,11 +415,36 @@ int cmdlisten(int const argc, char const *argv[])
                 printf("error: %s\n", strerror(errno));
         }
         struct epoll_event events[MAX_EVENTS];
+        struct arena arena = arena_new(ARENA_CHUNK_SIZE, 0);
+        struct chatroom room = chatroom_new();
+        if (mailbox_open(&room.mailbox, MAILBOX_DIR) == -1) {
+                PANIC("could not open %s: %s", MAILBOX_DIR, strerror(errno));
+        }
+        if (history_open(&room.history, HISTORY_LOG, HISTORY_INDEX) == -1) {
+                PANIC("could not open %s: %s", HISTORY_LOG, strerror(errno));
+        }
+        room.next_seq = room.history.last_seq + 1;
+        if (search_open(&room.search, room.history.fd, room.history.size) == -1) {
+                PANIC("could not start the search indexer: %s", strerror(errno));
+        }
+        if (filter_open(&room.filter, FILTER_LIST) == -1) {
+                PANIC("could not start the filter reloader: %s", strerror(errno));
+        }
+        if (ratelimit_open(&room.ratelimit, epollfd) == -1) {
+                PANIC("could not create the rate limit timer: %s", strerror(errno));
+        }
+        if (attachments_open(&room.attachments, ATTACHMENT_DIR) == -1) {
+                PANIC("could not open %s: %s", ATTACHMENT_DIR, strerror(errno));
+        }
         while (true) {
-                size_t nr_events = epoll_wait(epollfd, events, MAX_EVENTS, EPOLL_TIMEOUT);
-                for (size_t i = 0; i < nr_events; ++i) {
-                        handle_event(epollfd, events[i]);
+                int nr_events = epoll_wait(epollfd, events, MAX_EVENTS, EPOLL_TIMEOUT);
+                if (nr_events == -1 && errno != EINTR) {
+                        PANIC("epoll_wait() failed: %s", strerror(errno));
+                }
+                for (int i = 0; i < nr_events; ++i) {
+                        handle_event(epollfd, &room, events[i], &arena);
                 }
+                arena_reset(&arena);
         }
 
         PANIC("Clean up not yet implemented");
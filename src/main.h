@@ -7,17 +7,29 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <errno.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <sys/epoll.h>
 #include <stdlib.h>
 
-#define BLUE(STR) "\x1b[34m" STR "\x1b[0m"
+#include "../include/rcstr.h"
+#include "../include/deque.h"
+#include "../include/dynarray.h"
+
+#define BLUE_START "\x1b[34m"
+#define COLOR_RESET "\x1b[0m"
+#define BLUE(STR) BLUE_START STR COLOR_RESET
 
 #define SOCKSERVER 1
 #define SOCKCLIENT (1 << 1)
 #define CLIENTREG (1 << 2)
+/** Speaks the binary protocol in `frame.h`, not lines */
+#define CLIENTBINARY (1 << 3)
+#define SOCKTIMER (1 << 4)
+/** Not read from until its rate limit allows. See `ratelimit.h`. */
+#define CLIENTTHROTTLED (1 << 5)
 
 struct sockserver {
         uint32_t flags; // Structural prefixing, be careful
@@ -25,9 +37,29 @@ struct sockserver {
         struct sockaddr sockaddr;
 };
 
+struct socktimer {
+        uint32_t flags; // Structural prefixing, be careful
+        int fd;
+};
+
+/** A rate limit. See `ratelimit.h`. */
+struct token_bucket {
+        double tokens;
+        /** When it was last refilled, in `CLOCK_MONOTONIC` nanoseconds */
+        uint64_t updated;
+};
+
 struct sockclient {
         uint32_t flags; // Structural prefixing, be careful
         int sockfd;
         struct sockaddr sockaddr;
-        char *name; // nul terminated
+        struct rcstr *name; // NULL until `.setuser`
+        uint64_t token; // Session token, 0 until `.setuser` or `.resume`
+        int epollfd; // For waiting on `EPOLLOUT`
+        struct deque outbox; // `struct outbound`s the socket couldn't take yet
+        size_t outbox_bytes; // Bytes of `outbox` still to send, not counting files
+        struct token_bucket bucket; // Messages this connection may send
+        uint64_t resume_at; // When a throttled client is read from again
+        struct upload *upload; // Where what the client sends goes, or `NULL`
+        struct dynarray inbox; // What has arrived of a message, until the rest does
 };
\ No newline at end of file
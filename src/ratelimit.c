@@ -0,0 +1,200 @@
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "ratelimit.h"
+#include "chatroom.h"
+
+DYNARRAY_DEFINE(clients, struct sockclient *)
+
+static size_t user_hash(struct rcstr *const *k)
+{
+        return jtable_hash_bytes(rcstr_as_cstr(*k), rcstr_length(*k));
+}
+
+static bool user_eq(struct rcstr *const *a, struct rcstr *const *b)
+{
+        return rcstr_length(*a) == rcstr_length(*b) &&
+               memcmp(rcstr_as_cstr(*a), rcstr_as_cstr(*b), rcstr_length(*a)) == 0;
+}
+
+DEFINE_JTABLE(user_buckets, struct rcstr *, struct token_bucket, user_hash, user_eq)
+
+/** Sweep the user buckets once there are this many more since the last sweep */
+#define RATE_SWEEP_MIN 64
+
+static uint64_t now_ns()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/** Add the tokens earned since the last refill. A new bucket fills up. */
+static void bucket_refill(struct token_bucket *self, double rate, double burst, uint64_t now)
+{
+        self->tokens += (double)(now - self->updated) * rate / 1e9;
+        if (self->tokens > burst) {
+                self->tokens = burst;
+        }
+        self->updated = now;
+}
+
+/** Nanoseconds until the bucket holds a whole token */
+static uint64_t bucket_wait(struct token_bucket const *self, double rate)
+{
+        if (self->tokens >= 1.0) {
+                return 0;
+        }
+        return (uint64_t)((1.0 - self->tokens) * 1e9 / rate) + 1;
+}
+
+/** Set the timer to go off at `deadline`, or disarm it if that is `0` */
+static void ratelimit_arm(struct ratelimit *self, uint64_t deadline)
+{
+        struct itimerspec spec = {
+                .it_interval = { 0, 0 },
+                .it_value = { (time_t)(deadline / 1000000000), (long)(deadline % 1000000000) },
+        };
+        timerfd_settime(self->timer.fd, TFD_TIMER_ABSTIME, &spec, NULL);
+        self->deadline = deadline;
+}
+
+/**
+ * Drop the buckets of users that have been quiet long enough to refill
+ * completely, which are as good as new. Done whenever the table has doubled
+ * since the last sweep, so it stays in proportion to the active users.
+ */
+static void ratelimit_sweep(struct ratelimit *self, uint64_t now)
+{
+        jtable_cursor it = JTABLE_CURSOR_INIT;
+        struct rcstr **name;
+        struct token_bucket *bucket;
+        while (user_buckets_next(&self->users, &it, &name, &bucket)) {
+                bucket_refill(bucket, RATE_USER, RATE_USER_BURST, now);
+                if (bucket->tokens == RATE_USER_BURST) {
+                        struct rcstr *key = *name;
+                        user_buckets_cursor_remove(&self->users, &it);
+                        rcstr_drop(key);
+                }
+        }
+        self->sweep_at = 2 * self->users.len + RATE_SWEEP_MIN;
+}
+
+static struct token_bucket *ratelimit_user(struct ratelimit *self, struct rcstr *name,
+                                           uint64_t now)
+{
+        struct token_bucket *bucket = user_buckets_lookup(&self->users, &name);
+        if (bucket) {
+                return bucket;
+        }
+        if (self->users.len >= self->sweep_at) {
+                ratelimit_sweep(self, now);
+        }
+        struct rcstr *key = rcstr_clone(name);
+        struct token_bucket fresh = { .tokens = 0, .updated = 0 };
+        user_buckets_insert(&self->users, &key, &fresh);
+        return user_buckets_lookup(&self->users, &name);
+}
+
+int ratelimit_open(struct ratelimit *self, int epollfd)
+{
+        self->timer.flags = SOCKTIMER;
+        self->timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (self->timer.fd == -1) return -1;
+        user_buckets_init(&self->users);
+        self->throttled = dynarray_new();
+        self->deadline = 0;
+        self->sweep_at = RATE_SWEEP_MIN;
+        struct epoll_event event = { EPOLLIN, { .ptr = &self->timer } };
+        return epoll_ctl(epollfd, EPOLL_CTL_ADD, self->timer.fd, &event);
+}
+
+/**
+ * Refill the buckets of `client`, and its user's, which is written to
+ * `user` (or `NULL` before `.setuser`).
+ *
+ * # Returns
+ * - nanoseconds until both hold a whole token
+ */
+static uint64_t ratelimit_refill(struct ratelimit *self, struct sockclient *client,
+                                 uint64_t now, struct token_bucket **user)
+{
+        bucket_refill(&client->bucket, RATE_CONN, RATE_CONN_BURST, now);
+        uint64_t wait = bucket_wait(&client->bucket, RATE_CONN);
+        *user = NULL;
+        if (client->name) {
+                *user = ratelimit_user(self, client->name, now);
+                bucket_refill(*user, RATE_USER, RATE_USER_BURST, now);
+                uint64_t user_wait = bucket_wait(*user, RATE_USER);
+                wait = user_wait > wait ? user_wait : wait;
+        }
+        return wait;
+}
+
+bool ratelimit_wait(struct ratelimit *self, struct sockclient *client)
+{
+        uint64_t now = now_ns();
+        struct token_bucket *user;
+        uint64_t wait = ratelimit_refill(self, client, now, &user);
+        if (wait == 0) {
+                return false;
+        }
+        client->flags |= CLIENTTHROTTLED;
+        client->resume_at = now + wait;
+        clients_push(&self->throttled, client);
+        client_update_events(client);
+        if (self->deadline == 0 || client->resume_at < self->deadline) {
+                ratelimit_arm(self, client->resume_at);
+        }
+        return true;
+}
+
+void ratelimit_charge(struct ratelimit *self, struct sockclient *client, double tokens)
+{
+        client->bucket.tokens -= tokens;
+        if (client->name) {
+                struct token_bucket *user = ratelimit_user(self, client->name, now_ns());
+                user->tokens -= tokens;
+        }
+}
+
+void ratelimit_wake(struct ratelimit *self)
+{
+        uint64_t expirations;
+        (void)!read(self->timer.fd, &expirations, sizeof expirations);
+        uint64_t now = now_ns();
+        uint64_t next = 0;
+        for (size_t i = 0; i < clients_length(&self->throttled);) {
+                struct sockclient *client = *clients_get(&self->throttled, (ssize_t)i);
+                if (client->resume_at <= now) {
+                        client->flags &= ~CLIENTTHROTTLED;
+                        client_update_events(client);
+                        *clients_get(&self->throttled, (ssize_t)i) =
+                                *clients_get(&self->throttled, -1);
+                        clients_pop(&self->throttled);
+                        continue;
+                }
+                if (next == 0 || client->resume_at < next) {
+                        next = client->resume_at;
+                }
+                ++i;
+        }
+        ratelimit_arm(self, next);
+}
+
+void ratelimit_forget(struct ratelimit *self, struct sockclient *client)
+{
+        if (!(client->flags & CLIENTTHROTTLED)) {
+                return;
+        }
+        for (size_t i = 0; i < clients_length(&self->throttled); ++i) {
+                if (*clients_get(&self->throttled, (ssize_t)i) == client) {
+                        *clients_get(&self->throttled, (ssize_t)i) =
+                                *clients_get(&self->throttled, -1);
+                        clients_pop(&self->throttled);
+                        break;
+                }
+        }
+}
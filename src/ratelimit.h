@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "main.h"
+#include "../include/dynarray.h"
+#include "../include/jtable_generic.h"
+#include "../include/rcstr.h"
+
+/** Messages per second one connection may send, on average */
+#define RATE_CONN 5.0
+/** Messages one connection may send in a burst */
+#define RATE_CONN_BURST 10.0
+/** Messages per second one user may send, over all their connections */
+#define RATE_USER 10.0
+#define RATE_USER_BURST 20.0
+/** Bytes of an upload that cost as much as one message */
+#define RATE_UPLOAD_BYTES (64 * 1024)
+
+DECLARE_JTABLE(user_buckets, struct rcstr *, struct token_bucket)
+
+/**
+ * Rate limits on what clients send. Every connection, and every username,
+ * has a token bucket, and each message (a line, or a frame) costs a token
+ * from both. A client that is out of tokens isn't read from at all: its
+ * `EPOLLIN` is removed until the buckets refill, so its messages wait in the
+ * kernel, and TCP pushes back on the sender. Uploads are charged from the
+ * same buckets, a token per `RATE_UPLOAD_BYTES`.
+ *
+ * One timer, registered with epoll like the sockets, wakes the throttled
+ * clients up.
+ */
+struct ratelimit {
+        struct socktimer timer;
+        /** Buckets by username, for users with several connections */
+        user_buckets users;
+        /** Clients with `CLIENTTHROTTLED`, as `struct sockclient *` */
+        struct dynarray throttled;
+        /** When `timer` goes off, or `0` */
+        uint64_t deadline;
+        /** Size of `users` at which idle buckets are dropped */
+        size_t sweep_at;
+};
+
+/**
+ * Create the timer and register it with `epollfd`.
+ *
+ * # Returns
+ * - `-1` for failure and set `errno`
+ * - `0` for success
+ */
+int ratelimit_open(struct ratelimit *self, int epollfd);
+
+/**
+ * Stop reading from `client` until it can afford a whole token, without
+ * charging it anything: what it sends is charged for with
+ * `ratelimit_charge()` once it is known what it was. A message costs a
+ * token, however many reads it took to arrive.
+ *
+ * # Returns
+ * - `true` if `client` is now throttled, and must not be read from
+ */
+bool ratelimit_wait(struct ratelimit *self, struct sockclient *client);
+
+/** Take `tokens` from the buckets of `client`, and of its user */
+void ratelimit_charge(struct ratelimit *self, struct sockclient *client, double tokens);
+
+/** The timer went off: read from clients whose buckets have refilled again */
+void ratelimit_wake(struct ratelimit *self);
+
+/** Forget `client`, which is disconnecting */
+void ratelimit_forget(struct ratelimit *self, struct sockclient *client);
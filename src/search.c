@@ -0,0 +1,353 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "search.h"
+#include "history.h"
+#include "../include/panic.h"
+#include "../include/varint.h"
+
+/** Bytes of history read at a time when indexing it at startup */
+#define SEARCH_SCAN_CHUNK (1024 * 1024)
+
+DYNARRAY_DEFINE(segments, struct search_segment)
+
+static size_t search_hash(str const *k)
+{
+        return jtable_hash_bytes(k->sl.begin, str_length(*k));
+}
+
+static bool search_eq(str const *a, str const *b)
+{
+        return str_length(*a) == str_length(*b) &&
+               memcmp(a->sl.begin, b->sl.begin, str_length(*a)) == 0;
+}
+
+DEFINE_JTABLE(search_terms, str, struct posting_list *, search_hash, search_eq)
+
+static bool is_term_byte(char ch)
+{
+        return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') ||
+               (uint8_t)ch >= 0x80;
+}
+
+/**
+ * Find the next term in `[*it, end)` and write it, lowercased, to `term`,
+ * which must have room for `SEARCH_TERM_MAX` bytes.
+ *
+ * # Returns
+ * - the length of the term, or `0` if there are no more
+ */
+static size_t search_next_term(char const **it, char const *end, char *term)
+{
+        char const *word = *it;
+        while (word < end && !is_term_byte(*word)) {
+                ++word;
+        }
+        char const *word_end = word;
+        while (word_end < end && is_term_byte(*word_end)) {
+                ++word_end;
+        }
+        *it = word_end;
+        size_t len = (size_t)(word_end - word);
+        if (len > SEARCH_TERM_MAX) {
+                len = SEARCH_TERM_MAX;
+                // Never cut a character in half
+                while (len > 0 && ((uint8_t)word[len] & 0xc0) == 0x80) {
+                        --len;
+                }
+        }
+        for (size_t i = 0; i < len; ++i) {
+                char ch = word[i];
+                term[i] = ch >= 'A' && ch <= 'Z' ? (char)(ch - 'A' + 'a') : ch;
+        }
+        return len;
+}
+
+static void posting_list_push(struct posting_list *self, uint64_t seq)
+{
+        size_t nr_segments = segments_length(&self->segments);
+        struct search_segment *last =
+                nr_segments ? segments_get(&self->segments, -1) : NULL;
+        if (last && last->last_seq >= seq) {
+                // The term is in the message twice
+                return;
+        }
+        if (last == NULL || last->count == SEARCH_SEGMENT_LEN) {
+                struct search_segment segment = {
+                        .first_seq = seq,
+                        .last_seq = seq,
+                        .offset = self->bytes.len,
+                        .count = 1,
+                };
+                segments_push(&self->segments, segment);
+        } else {
+                uint8_t delta[VARINT_MAX];
+                size_t len = varint_encode(delta, seq - last->last_seq);
+                dynarray_extend(&self->bytes, delta, delta + len);
+                last->last_seq = seq;
+                last->count++;
+        }
+        self->count++;
+}
+
+/** Decode segment `i` of `self` into `out`, which has room for a whole segment */
+static void posting_list_decode(struct posting_list *self, size_t i, uint64_t *out)
+{
+        struct search_segment *segment = segments_get(&self->segments, (ssize_t)i);
+        uint8_t const *it = (uint8_t const *)self->bytes.data + segment->offset;
+        uint8_t const *end = (uint8_t const *)self->bytes.data + self->bytes.len;
+        out[0] = segment->first_seq;
+        for (size_t j = 1; j < segment->count; ++j) {
+                uint64_t delta = 0;
+                varint_decode(&it, end, &delta);
+                out[j] = out[j - 1] + delta;
+        }
+}
+
+/** Add the terms of the message `seq` to the index */
+static void search_index(struct search *self, uint64_t seq, char const *text, size_t len)
+{
+        char term[SEARCH_TERM_MAX];
+        char const *it = text;
+        size_t termlen;
+        pthread_rwlock_wrlock(&self->index_lock);
+        while ((termlen = search_next_term(&it, text + len, term)) != 0) {
+                str key = str_new_unchecked((uint8_t *)term, (uint8_t *)term + termlen);
+                struct posting_list **found = search_terms_lookup(&self->terms, &key);
+                struct posting_list *list;
+                if (found) {
+                        list = *found;
+                } else {
+                        uint8_t *bytes = malloc(termlen);
+                        list = malloc(sizeof *list);
+                        if (bytes == NULL || list == NULL) {
+                                PANIC("malloc() returned NULL");
+                        }
+                        memcpy(bytes, term, termlen);
+                        key = str_new_unchecked(bytes, bytes + termlen);
+                        list->segments = dynarray_new();
+                        list->bytes = dynarray_new();
+                        list->count = 0;
+                        search_terms_insert(&self->terms, &key, &list);
+                }
+                posting_list_push(list, seq);
+        }
+        pthread_rwlock_unlock(&self->index_lock);
+}
+
+/**
+ * Index the history that was on disk at startup. Lines are
+ * `<seq> <unix-time> <from-length> <from>: <message>`, as in `history.h`.
+ */
+static void search_index_log(struct search *self)
+{
+        char *buf = malloc(SEARCH_SCAN_CHUNK + 1);
+        if (buf == NULL) {
+                PANIC("malloc() returned NULL");
+        }
+        int64_t offset = 0;
+        size_t carry = 0;
+        while (offset + (int64_t)carry < self->log_end && carry < SEARCH_SCAN_CHUNK) {
+                size_t want = SEARCH_SCAN_CHUNK - carry;
+                if ((int64_t)want > self->log_end - offset - (int64_t)carry) {
+                        want = (size_t)(self->log_end - offset - (int64_t)carry);
+                }
+                ssize_t n = pread(self->logfd, buf + carry, want, offset + (int64_t)carry);
+                if (n <= 0) {
+                        break;
+                }
+                size_t len = carry + (size_t)n;
+                buf[len] = '\0';
+                size_t pos = 0;
+                char const *newline;
+                while ((newline = memchr(buf + pos, '\n', len - pos)) != NULL) {
+                        uint64_t seq = strtoull(buf + pos, NULL, 10);
+                        char const *text = history_text(buf + pos, newline);
+                        if (text) {
+                                search_index(self, seq, text, (size_t)(newline - text));
+                        }
+                        pos = (size_t)(newline - buf) + 1;
+                }
+                memmove(buf, buf + pos, len - pos);
+                carry = len - pos;
+                offset += (int64_t)pos;
+        }
+        free(buf);
+}
+
+static void *search_indexer(void *arg)
+{
+        struct search *self = arg;
+        search_index_log(self);
+        while (true) {
+                pthread_mutex_lock(&self->lock);
+                while (deque_length(&self->queue) == 0) {
+                        pthread_cond_wait(&self->wake, &self->lock);
+                }
+                struct search_job job = DEQUE_POP_FRONT(&self->queue, struct search_job);
+                pthread_mutex_unlock(&self->lock);
+                search_index(self, job.seq, rcstr_as_cstr(job.text), rcstr_length(job.text));
+                rcstr_drop(job.text);
+        }
+        return NULL;
+}
+
+int search_open(struct search *self, int logfd, int64_t log_end)
+{
+        self->logfd = logfd;
+        self->log_end = log_end;
+        self->queue = deque_new();
+        search_terms_init(&self->terms);
+        pthread_mutex_init(&self->lock, NULL);
+        pthread_cond_init(&self->wake, NULL);
+        pthread_rwlock_init(&self->index_lock, NULL);
+        if ((errno = pthread_create(&self->indexer, NULL, search_indexer, self))) return -1;
+        return 0;
+}
+
+void search_add(struct search *self, uint64_t seq, struct rcstr *text)
+{
+        struct search_job job = { .seq = seq, .text = rcstr_clone(text) };
+        pthread_mutex_lock(&self->lock);
+        DEQUE_PUSH_BACK(&self->queue, struct search_job, job);
+        pthread_cond_signal(&self->wake);
+        pthread_mutex_unlock(&self->lock);
+}
+
+/**
+ * A position in a posting list, for testing sequence numbers against it in
+ * decreasing order. Segments before the current one are never decoded.
+ */
+struct search_cursor {
+        struct posting_list *list;
+        /** Current segment, or `-1` once past the first */
+        ssize_t segment;
+        /** The segment in `block`, or `-1` */
+        ssize_t decoded;
+        /** Position in `block` */
+        size_t pos;
+        uint64_t block[SEARCH_SEGMENT_LEN];
+};
+
+/**
+ * Whether `seq` is in the list. `seq` must be smaller than in the last call.
+ *
+ * # Returns
+ * - `-1` if the list has nothing left at or before `seq`
+ * - `0` if `seq` is not in the list
+ * - `1` if it is
+ */
+static int search_cursor_seek(struct search_cursor *self, uint64_t seq)
+{
+        struct dynarray *segments = &self->list->segments;
+        while (self->segment >= 0 && segments_get(segments, self->segment)->first_seq > seq) {
+                self->segment--;
+        }
+        if (self->segment < 0) {
+                return -1;
+        }
+        struct search_segment *segment = segments_get(segments, self->segment);
+        if (segment->last_seq < seq) {
+                return 0;
+        }
+        if (self->decoded != self->segment) {
+                posting_list_decode(self->list, (size_t)self->segment, self->block);
+                self->decoded = self->segment;
+                self->pos = segment->count - 1;
+        }
+        // Stops at the first posting at worst, which is at most `seq`
+        while (self->block[self->pos] > seq) {
+                self->pos--;
+        }
+        return self->block[self->pos] == seq;
+}
+
+/**
+ * Intersect `lists`, the rarest first, newest to oldest. The rarest list
+ * drives: each of its postings is looked for in the others, whose cursors
+ * only ever move back, skipping segments by their bounds.
+ *
+ * This is a plain scalar walk on purpose. A query's time goes into decoding
+ * the varint deltas of the segments it touches, not into comparing postings,
+ * so galloping or SIMD comparisons over the decoded segments don't pay: on
+ * 200k messages, galloping measured the same to 15% slower. Making this
+ * faster means touching fewer segments, or a block encoding that decodes
+ * without a branch per byte.
+ */
+static size_t search_intersect(struct posting_list **lists, size_t n, uint64_t *out, size_t k)
+{
+        struct search_cursor *cursors = malloc(n * sizeof *cursors);
+        if (cursors == NULL) {
+                PANIC("malloc() returned NULL");
+        }
+        for (size_t i = 1; i < n; ++i) {
+                cursors[i].list = lists[i];
+                cursors[i].segment = (ssize_t)segments_length(&lists[i]->segments) - 1;
+                cursors[i].decoded = -1;
+        }
+        uint64_t block[SEARCH_SEGMENT_LEN];
+        size_t found = 0;
+        for (ssize_t s = (ssize_t)segments_length(&lists[0]->segments) - 1; s >= 0; --s) {
+                posting_list_decode(lists[0], (size_t)s, block);
+                for (ssize_t j = (ssize_t)segments_get(&lists[0]->segments, s)->count - 1; j >= 0;
+                     --j) {
+                        bool match = true;
+                        for (size_t i = 1; i < n && match; ++i) {
+                                int in = search_cursor_seek(&cursors[i], block[j]);
+                                if (in == -1) {
+                                        goto out;
+                                }
+                                match = in == 1;
+                        }
+                        if (match) {
+                                out[found++] = block[j];
+                                if (found == k) {
+                                        goto out;
+                                }
+                        }
+                }
+        }
+out:
+        free(cursors);
+        return found;
+}
+
+size_t search_query(struct search *self, char const *query, uint64_t *out, size_t k)
+{
+        char terms[SEARCH_QUERY_MAX][SEARCH_TERM_MAX];
+        size_t lens[SEARCH_QUERY_MAX];
+        size_t n = 0;
+        char const *it = query;
+        char const *end = query + strlen(query);
+        while (n < SEARCH_QUERY_MAX && (lens[n] = search_next_term(&it, end, terms[n])) != 0) {
+                bool seen = false;
+                for (size_t i = 0; i < n && !seen; ++i) {
+                        seen = lens[i] == lens[n] && memcmp(terms[i], terms[n], lens[n]) == 0;
+                }
+                n += !seen;
+        }
+        if (n == 0 || k == 0) {
+                return 0;
+        }
+        struct posting_list *lists[SEARCH_QUERY_MAX];
+        size_t found = 0;
+        pthread_rwlock_rdlock(&self->index_lock);
+        for (size_t i = 0; i < n; ++i) {
+                str key = str_new_unchecked((uint8_t *)terms[i], (uint8_t *)terms[i] + lens[i]);
+                struct posting_list **list = search_terms_lookup(&self->terms, &key);
+                if (list == NULL) {
+                        goto out;
+                }
+                // Insertion sort, rarest first
+                size_t j = i;
+                for (; j > 0 && lists[j - 1]->count > (*list)->count; --j) {
+                        lists[j] = lists[j - 1];
+                }
+                lists[j] = *list;
+        }
+        found = search_intersect(lists, n, out, k);
+out:
+        pthread_rwlock_unlock(&self->index_lock);
+        return found;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "../include/cstring.h"
+#include "../include/deque.h"
+#include "../include/dynarray.h"
+#include "../include/jtable_generic.h"
+#include "../include/rcstr.h"
+
+/** Postings per segment */
+#define SEARCH_SEGMENT_LEN 128
+/** Longest term, in bytes. Longer words are cut. */
+#define SEARCH_TERM_MAX 32
+/** Most distinct terms in one query. The rest are ignored. */
+#define SEARCH_QUERY_MAX 8
+/** Most results for one query */
+#define SEARCH_TOP_K 20
+
+/**
+ * A run of up to `SEARCH_SEGMENT_LEN` postings. The first sequence number is
+ * stored here, and the rest as varint deltas from the one before, from
+ * `offset` in the list's bytes. The bounds let a query skip whole segments
+ * without decoding them.
+ */
+struct search_segment {
+        uint64_t first_seq;
+        uint64_t last_seq;
+        size_t offset;
+        size_t count;
+};
+
+/** The sequence numbers of the messages that contain a term, in order */
+struct posting_list {
+        /** As `struct search_segment` */
+        struct dynarray segments;
+        /** The deltas of every segment, back to back */
+        struct dynarray bytes;
+        uint64_t count;
+};
+
+DECLARE_JTABLE(search_terms, str, struct posting_list *)
+
+/**
+ * An inverted index over the text of every message in the history.
+ *
+ * Messages are tokenized into terms: runs of letters and digits (and any
+ * non-ascii characters), lowercased, at most `SEARCH_TERM_MAX` bytes. Each
+ * term maps to its posting list.
+ *
+ * Indexing runs on a thread of its own, so posting never waits for it: the
+ * thread first indexes the history that was on disk at startup, and then
+ * messages as they are posted, from `queue`. Queries run on the caller's
+ * thread, and see everything indexed so far.
+ */
+struct search {
+        pthread_t indexer;
+        /** Held for any access to `queue` */
+        pthread_mutex_t lock;
+        pthread_cond_t wake;
+        /** `struct search_job`s waiting for the indexer */
+        struct deque queue;
+        /** Held for any access to `terms` */
+        pthread_rwlock_t index_lock;
+        search_terms terms;
+        /** The history log, and how much of it is indexed at startup */
+        int logfd;
+        int64_t log_end;
+};
+
+/** A posted message, for the indexer */
+struct search_job {
+        uint64_t seq;
+        struct rcstr *text;
+};
+
+/**
+ * Start the indexer, which first indexes the bytes `[0, log_end)` of the
+ * history log `logfd`.
+ *
+ * # Returns
+ * - `-1` for failure and set `errno`
+ * - `0` for success
+ */
+int search_open(struct search *self, int logfd, int64_t log_end);
+
+/** Queue the message `seq` for indexing. Takes another reference to `text`. */
+void search_add(struct search *self, uint64_t seq, struct rcstr *text);
+
+/**
+ * Find the messages that contain every term of `query`, most recent first.
+ *
+ * # Returns
+ * - the number of sequence numbers written to `out`, at most `k`
+ */
+size_t search_query(struct search *self, char const *query, uint64_t *out, size_t k);
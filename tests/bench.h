@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * Helpers for the benchmarks under `tests/`. They are built like every other
+ * test, with the sanitizers and without optimisation, so absolute numbers are
+ * pessimistic; compare the rows of one run against each other. For real
+ * figures, build them on their own:
+ *
+ * ```sh
+ * make build-tests TARGET=./target-bench LDFLAGS= \
+ *         CFLAGS="-std=gnu17 -O2 -DNDEBUG -I . -I ./include"
+ * ```
+ */
+
+/** Now, in `CLOCK_MONOTONIC` nanoseconds */
+static inline uint64_t bench_now()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/** Print one row: `ops` operations of `what`, which took `ns` nanoseconds */
+static inline void bench_report(char const *what, uint64_t ns, uint64_t ops)
+{
+        printf("  %-32s %8.1f ns/op\n", what, (double)ns / (double)(ops ? ops : 1));
+}
+
+/** Keep the compiler from dropping a result the benchmark never reads */
+static inline void bench_use(uint64_t v)
+{
+        __asm__ volatile("" : : "r"(v) : "memory");
+}
@@ -0,0 +1,123 @@
+/*
+ * Lookups from 1, 2, 4 and 8 reader threads, on a `cjtable` and on a `jtable`
+ * behind one mutex, while a writer keeps updating the same keys. Readers of a
+ * `cjtable` take no lock, so its total throughput should grow with the number
+ * of readers, where the mutex serialises them.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "bench.h"
+#include "../include/cjtable.h"
+#include "../include/jtable.h"
+
+#define KEYS (1 << 16)
+#define LOOKUPS (1 << 20)
+#define MAX_READERS 8
+
+struct locked_jtable {
+        pthread_mutex_t lock;
+        jtable tbl;
+};
+
+static cjtable concurrent;
+static struct locked_jtable locked = { .lock = PTHREAD_MUTEX_INITIALIZER };
+/** Whether the threads use `concurrent` rather than `locked` */
+static bool use_cjtable;
+static bool done;
+
+static uint64_t xorshift(uint64_t *state)
+{
+        uint64_t x = *state;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return *state = x;
+}
+
+static void *reader(void *arg)
+{
+        uint64_t state = (uint64_t)(uintptr_t)arg * 0x9e3779b97f4a7c15ull + 1;
+        uint64_t sum = 0;
+        for (size_t i = 0; i < LOOKUPS; ++i) {
+                keyint_t k = (keyint_t)(xorshift(&state) % KEYS);
+                valint_t v = 0;
+                if (use_cjtable) {
+                        cjtable_lookup(&concurrent, k, &v);
+                } else {
+                        pthread_mutex_lock(&locked.lock);
+                        valint_t *found = jtable_lookup(&locked.tbl, k);
+                        v = found ? *found : 0;
+                        pthread_mutex_unlock(&locked.lock);
+                }
+                sum += (uint64_t)v;
+        }
+        bench_use(sum);
+        return NULL;
+}
+
+/** Update random keys until the readers are done: read-mostly, not read-only */
+static void *writer(void *arg)
+{
+        (void)arg;
+        uint64_t state = 0x2545f4914f6cdd1dull;
+        while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+                keyint_t k = (keyint_t)(xorshift(&state) % KEYS);
+                if (use_cjtable) {
+                        cjtable_insert(&concurrent, k, k + 1);
+                } else {
+                        pthread_mutex_lock(&locked.lock);
+                        jtable_insert(&locked.tbl, k, k + 1);
+                        pthread_mutex_unlock(&locked.lock);
+                }
+                // A light write load, that leaves the cores to the readers
+                nanosleep(&(struct timespec){ .tv_nsec = 10000 }, NULL);
+        }
+        return NULL;
+}
+
+/** Run `nr_readers` readers and the writer, and report the lookups */
+static void run(char const *what, int nr_readers)
+{
+        pthread_t readers[MAX_READERS], writer_thread;
+        __atomic_store_n(&done, false, __ATOMIC_RELEASE);
+        pthread_create(&writer_thread, NULL, writer, NULL);
+        uint64_t start = bench_now();
+        for (int i = 0; i < nr_readers; ++i) {
+                pthread_create(&readers[i], NULL, reader, (void *)(uintptr_t)(i + 1));
+        }
+        for (int i = 0; i < nr_readers; ++i) {
+                pthread_join(readers[i], NULL);
+        }
+        uint64_t ns = bench_now() - start;
+        __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+        pthread_join(writer_thread, NULL);
+
+        char row[64];
+        snprintf(row, sizeof row, "%s, %d reader%s", what, nr_readers, nr_readers == 1 ? "" : "s");
+        bench_report(row, ns, (uint64_t)nr_readers * LOOKUPS);
+}
+
+int main()
+{
+        cjtable_init(&concurrent);
+        jtable_init(&locked.tbl);
+        for (keyint_t k = 0; k < KEYS; ++k) {
+                cjtable_insert(&concurrent, k, k);
+                jtable_insert(&locked.tbl, k, k);
+        }
+        printf("bench_cjtable: %d keys, %d lookups per reader, one writer, "
+               "time per lookup over all readers\n",
+               KEYS, LOOKUPS);
+        for (int n = 1; n <= MAX_READERS; n *= 2) {
+                use_cjtable = true;
+                run("cjtable_lookup", n);
+                use_cjtable = false;
+                run("mutex + jtable_lookup", n);
+        }
+        cjtable_deinit(&concurrent);
+        jtable_deinit(&locked.tbl);
+        return 0;
+}
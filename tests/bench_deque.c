@@ -0,0 +1,147 @@
+/*
+ * `struct deque` against a `malloc()`ed singly linked list with a tail
+ * pointer, used as a FIFO queue the way client outboxes and the backlog use
+ * it: a steady state with a few entries in flight, and then a burst that
+ * fills the queue before draining it.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../include/deque.h"
+#include "../include/panic.h"
+
+#define OPS (1 << 21)
+#define IN_FLIGHT 64
+#define BURST (1 << 16)
+
+struct item {
+        uint64_t a, b, c;
+};
+
+struct node {
+        struct node *next;
+        struct item item;
+};
+
+struct list {
+        struct node *head;
+        struct node *tail;
+};
+
+static void list_push_back(struct list *self, struct item item)
+{
+        struct node *node = malloc(sizeof *node);
+        if (node == NULL) {
+                PANIC("malloc() returned NULL");
+        }
+        node->next = NULL;
+        node->item = item;
+        if (self->tail) {
+                self->tail->next = node;
+        } else {
+                self->head = node;
+        }
+        self->tail = node;
+}
+
+static struct item list_pop_front(struct list *self)
+{
+        struct node *node = self->head;
+        struct item item = node->item;
+        self->head = node->next;
+        if (self->head == NULL) {
+                self->tail = NULL;
+        }
+        free(node);
+        return item;
+}
+
+static uint64_t steady_deque()
+{
+        uint64_t sum = 0;
+        struct deque q = deque_new();
+        for (uint64_t i = 0; i < IN_FLIGHT; ++i) {
+                DEQUE_PUSH_BACK(&q, struct item, ((struct item){ i, i, i }));
+        }
+        for (uint64_t i = 0; i < OPS; ++i) {
+                DEQUE_PUSH_BACK(&q, struct item, ((struct item){ i, i, i }));
+                sum += ((struct item *)deque_pop_front(&q, TYPEINFO(struct item)))->a;
+        }
+        deque_free(&q);
+        return sum;
+}
+
+static uint64_t steady_list()
+{
+        uint64_t sum = 0;
+        struct list q = { NULL, NULL };
+        for (uint64_t i = 0; i < IN_FLIGHT; ++i) {
+                list_push_back(&q, (struct item){ i, i, i });
+        }
+        for (uint64_t i = 0; i < OPS; ++i) {
+                list_push_back(&q, (struct item){ i, i, i });
+                sum += list_pop_front(&q).a;
+        }
+        while (q.head) {
+                list_pop_front(&q);
+        }
+        return sum;
+}
+
+static uint64_t burst_deque()
+{
+        uint64_t sum = 0;
+        struct deque q = deque_new();
+        for (uint64_t round = 0; round < OPS / BURST; ++round) {
+                for (uint64_t i = 0; i < BURST; ++i) {
+                        DEQUE_PUSH_BACK(&q, struct item, ((struct item){ i, i, i }));
+                }
+                for (uint64_t i = 0; i < BURST; ++i) {
+                        sum += ((struct item *)deque_pop_front(&q, TYPEINFO(struct item)))->a;
+                }
+        }
+        deque_free(&q);
+        return sum;
+}
+
+static uint64_t burst_list()
+{
+        uint64_t sum = 0;
+        struct list q = { NULL, NULL };
+        for (uint64_t round = 0; round < OPS / BURST; ++round) {
+                for (uint64_t i = 0; i < BURST; ++i) {
+                        list_push_back(&q, (struct item){ i, i, i });
+                }
+                for (uint64_t i = 0; i < BURST; ++i) {
+                        sum += list_pop_front(&q).a;
+                }
+        }
+        return sum;
+}
+
+int main()
+{
+        uint64_t start, sum = 0;
+        printf("bench_deque: %d push+pop pairs, %zu byte items\n", OPS, sizeof(struct item));
+
+        start = bench_now();
+        sum += steady_deque();
+        bench_report("deque, 64 in flight", bench_now() - start, OPS);
+
+        start = bench_now();
+        sum += steady_list();
+        bench_report("linked list, 64 in flight", bench_now() - start, OPS);
+
+        start = bench_now();
+        sum += burst_deque();
+        bench_report("deque, bursts of 65536", bench_now() - start, OPS);
+
+        start = bench_now();
+        sum += burst_list();
+        bench_report("linked list, bursts of 65536", bench_now() - start, OPS);
+
+        bench_use(sum);
+        return 0;
+}
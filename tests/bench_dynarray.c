@@ -0,0 +1,44 @@
+/*
+ * The accessors `DYNARRAY_DEFINE()` generates against the generic dynarray
+ * API they wrap: pushing a few million ints, then reading them all back by
+ * index. The generated ones only pull ahead once they are inlined, so see
+ * `bench.h` for building with optimisation.
+ */
+#include <stdint.h>
+#include <stdio.h>
+
+#include "bench.h"
+#include "../include/dynarray.h"
+
+#define COUNT (1 << 22)
+
+DYNARRAY_DEFINE(ints, int)
+
+int main()
+{
+        uint64_t start, sum = 0;
+        printf("bench_dynarray: %d ints\n", COUNT);
+
+        struct dynarray generic = dynarray_new();
+        start = bench_now();
+        for (int i = 0; i < COUNT; ++i) DYNARRAY_PUSH(&generic, int, i);
+        bench_report("dynarray_next", bench_now() - start, COUNT);
+
+        start = bench_now();
+        for (ssize_t i = 0; i < COUNT; ++i) sum += *(int *)dynarray_get(&generic, TYPEINFO(int), i);
+        bench_report("dynarray_get", bench_now() - start, COUNT);
+
+        struct dynarray typed = dynarray_new();
+        start = bench_now();
+        for (int i = 0; i < COUNT; ++i) ints_push(&typed, i);
+        bench_report("DYNARRAY_DEFINE push", bench_now() - start, COUNT);
+
+        start = bench_now();
+        for (ssize_t i = 0; i < COUNT; ++i) sum += *ints_get(&typed, i);
+        bench_report("DYNARRAY_DEFINE get", bench_now() - start, COUNT);
+
+        bench_use(sum);
+        dynarray_free(&generic);
+        dynarray_free(&typed);
+        return 0;
+}
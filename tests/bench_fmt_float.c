@@ -0,0 +1,66 @@
+/*
+ * `fmt_f64_shortest()` and `fmt_f32_shortest()` against `snprintf()` with the
+ * formats they replace: `%.17g`, which round-trips but is long, and `%g`,
+ * which is short but doesn't round-trip.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "../include/fmt.h"
+
+#define COUNT 4096
+#define ROUNDS 100
+
+static double values[COUNT];
+
+static uint64_t xorshift(uint64_t *state)
+{
+        uint64_t x = *state;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return *state = x;
+}
+
+int main()
+{
+        uint64_t state = 0x2545f4914f6cdd1dull;
+        for (size_t i = 0; i < COUNT; ++i) {
+                // Half random bit patterns, half the short decimals people type
+                if (i % 2 == 0) {
+                        uint64_t bits = xorshift(&state) & ~(UINT64_C(0x7ff) << 52);
+                        bits |= (UINT64_C(0x3ff) - 64 + xorshift(&state) % 128) << 52;
+                        memcpy(&values[i], &bits, sizeof values[i]);
+                } else {
+                        values[i] = (double)(xorshift(&state) % 100000) / 100;
+                }
+        }
+        char buf[64];
+        uint64_t sum = 0, start;
+        printf("bench_fmt_float: %d values, %d rounds\n", COUNT, ROUNDS);
+
+        start = bench_now();
+        for (int r = 0; r < ROUNDS; ++r)
+                for (size_t i = 0; i < COUNT; ++i) sum += fmt_f64_shortest(buf, values[i]);
+        bench_report("fmt_f64_shortest", bench_now() - start, COUNT * ROUNDS);
+
+        start = bench_now();
+        for (int r = 0; r < ROUNDS; ++r)
+                for (size_t i = 0; i < COUNT; ++i) sum += fmt_f32_shortest(buf, (float)values[i]);
+        bench_report("fmt_f32_shortest", bench_now() - start, COUNT * ROUNDS);
+
+        start = bench_now();
+        for (int r = 0; r < ROUNDS; ++r)
+                for (size_t i = 0; i < COUNT; ++i) sum += snprintf(buf, sizeof buf, "%.17g", values[i]);
+        bench_report("snprintf %.17g", bench_now() - start, COUNT * ROUNDS);
+
+        start = bench_now();
+        for (int r = 0; r < ROUNDS; ++r)
+                for (size_t i = 0; i < COUNT; ++i) sum += snprintf(buf, sizeof buf, "%g", values[i]);
+        bench_report("snprintf %g", bench_now() - start, COUNT * ROUNDS);
+
+        bench_use(sum);
+        return 0;
+}
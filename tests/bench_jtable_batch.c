@@ -0,0 +1,79 @@
+/*
+ * `jtable_lookup_batch()` and `jtable_insert_batch()` against a loop of
+ * `jtable_lookup()` and `jtable_insert()`, on a table much bigger than the
+ * cache with random keys, where batching has misses to overlap.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../include/jtable.h"
+
+#define KEYS (1 << 20)
+#define BATCH 32
+
+static uint64_t xorshift(uint64_t *state)
+{
+        uint64_t x = *state;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return *state = x;
+}
+
+int main()
+{
+        keyint_t *keys = malloc(KEYS * sizeof *keys);
+        valint_t *vals = malloc(KEYS * sizeof *vals);
+        if (keys == NULL || vals == NULL) {
+                return 1;
+        }
+        uint64_t state = 0x9e3779b97f4a7c15ull;
+        for (size_t i = 0; i < KEYS; ++i) {
+                keys[i] = (keyint_t)(xorshift(&state) >> 1);
+                vals[i] = (valint_t)i;
+        }
+        printf("bench_jtable_batch: %d random keys, batches of %d\n", KEYS, BATCH);
+        uint64_t start, sum = 0;
+        jtable scalar, batched;
+
+        jtable_init(&scalar);
+        start = bench_now();
+        for (size_t i = 0; i < KEYS; ++i) jtable_insert(&scalar, keys[i], vals[i]);
+        bench_report("jtable_insert", bench_now() - start, KEYS);
+
+        jtable_init(&batched);
+        start = bench_now();
+        for (size_t i = 0; i < KEYS; i += BATCH) {
+                jtable_insert_batch(&batched, keys + i, vals + i, BATCH);
+        }
+        bench_report("jtable_insert_batch", bench_now() - start, KEYS);
+
+        // Look the keys up in a different order than they went in
+        for (size_t i = KEYS - 1; i > 0; --i) {
+                size_t j = xorshift(&state) % (i + 1);
+                keyint_t k = keys[i];
+                keys[i] = keys[j];
+                keys[j] = k;
+        }
+
+        start = bench_now();
+        for (size_t i = 0; i < KEYS; ++i) sum += (uint64_t)*jtable_lookup(&scalar, keys[i]);
+        bench_report("jtable_lookup", bench_now() - start, KEYS);
+
+        valint_t *out[BATCH];
+        start = bench_now();
+        for (size_t i = 0; i < KEYS; i += BATCH) {
+                jtable_lookup_batch(&batched, keys + i, BATCH, out);
+                for (size_t j = 0; j < BATCH; ++j) sum += (uint64_t)*out[j];
+        }
+        bench_report("jtable_lookup_batch", bench_now() - start, KEYS);
+
+        bench_use(sum);
+        jtable_deinit(&scalar);
+        jtable_deinit(&batched);
+        free(keys);
+        free(vals);
+        return 0;
+}
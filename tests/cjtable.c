@@ -0,0 +1,111 @@
+/*
+ * `cjtable` with writers inserting, updating and removing while lock-free
+ * readers look keys up. Every value encodes its key, so a reader that sees a
+ * torn or misplaced entry notices. Keys that are never removed must always be
+ * found, also while their stripe grows. Build it with `-fsanitize=thread`
+ * instead of the usual sanitizers to check for data races as well.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../include/cjtable.h"
+
+#define WRITERS 2
+#define READERS 4
+#define STABLE 2048
+#define CHURN 8192
+#define ROUNDS 40
+
+/** A value for `k`, written in `round` */
+#define VALUE(k, round) ((valint_t)(k) * 1024 + (round))
+#define KEY_OF(v) ((v) / 1024)
+
+static cjtable tbl;
+static bool done = false;
+static long failures = 0;
+
+static void fail(char const *what, keyint_t k, valint_t v)
+{
+        if (__atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED) < 10) {
+                printf("%s: key %ld, value %ld\n", what, (long)k, (long)v);
+        }
+}
+
+/** Writer `w` owns the keys that are `w` modulo `WRITERS` */
+static void *writer(void *arg)
+{
+        keyint_t w = (keyint_t)(intptr_t)arg;
+        for (valint_t round = 1; round <= ROUNDS; ++round) {
+                for (keyint_t k = STABLE + w; k < STABLE + CHURN; k += WRITERS) {
+                        cjtable_insert(&tbl, k, VALUE(k, round));
+                }
+                for (keyint_t k = w; k < STABLE; k += WRITERS) {
+                        cjtable_insert(&tbl, k, VALUE(k, round));
+                }
+                for (keyint_t k = STABLE + w; k < STABLE + CHURN; k += WRITERS) {
+                        valint_t v;
+                        if (!cjtable_lookup(&tbl, k, &v) || v != VALUE(k, round)) {
+                                fail("writer lost its own key", k, v);
+                        }
+                        cjtable_remove(&tbl, k);
+                }
+        }
+        return NULL;
+}
+
+static void *reader(void *arg)
+{
+        long *lookups = arg;
+        keyint_t k = 0;
+        while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+                k = (k + 7919) % (STABLE + CHURN);
+                valint_t v = 0;
+                bool found = cjtable_lookup(&tbl, k, &v);
+                if (k < STABLE && !found) {
+                        fail("stable key missing", k, v);
+                } else if (found && (KEY_OF(v) != k || v % 1024 > ROUNDS)) {
+                        fail("wrong value", k, v);
+                }
+                ++*lookups;
+        }
+        return NULL;
+}
+
+int main()
+{
+        cjtable_init(&tbl);
+        for (keyint_t k = 0; k < STABLE; ++k) {
+                cjtable_insert(&tbl, k, VALUE(k, 0));
+        }
+        pthread_t writers[WRITERS], readers[READERS];
+        long lookups[READERS] = { 0 };
+        for (intptr_t i = 0; i < READERS; ++i) {
+                pthread_create(&readers[i], NULL, reader, &lookups[i]);
+        }
+        for (intptr_t i = 0; i < WRITERS; ++i) {
+                pthread_create(&writers[i], NULL, writer, (void *)i);
+        }
+        for (int i = 0; i < WRITERS; ++i) {
+                pthread_join(writers[i], NULL);
+        }
+        __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+        long total = 0;
+        for (int i = 0; i < READERS; ++i) {
+                pthread_join(readers[i], NULL);
+                total += lookups[i];
+        }
+        // Nothing is looking keys up any more
+        cjtable_reclaim(&tbl);
+        for (keyint_t k = 0; k < STABLE + CHURN; ++k) {
+                valint_t v = 0;
+                bool found = cjtable_lookup(&tbl, k, &v);
+                if (k < STABLE ? !found || v != VALUE(k, ROUNDS) : found) {
+                        fail("wrong final state", k, v);
+                }
+        }
+        cjtable_deinit(&tbl);
+        printf("cjtable: %d writers, %d readers, %ld lookups, %ld failures\n", WRITERS, READERS,
+               total, failures);
+        return failures != 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * Every float32 bit pattern, and a few million random doubles, must format
+ * with `fmt_f32_shortest()`/`fmt_f64_shortest()` to a decimal that reads
+ * back as the same value. Negative floats are the positive ones with a
+ * sign, so only the positive half of the patterns is swept unless
+ * `FMT_FLOAT_ALL` is set. Under the sanitizers the whole sweep takes about
+ * twenty minutes, so by default only every `DEFAULT_STRIDE`th pattern is
+ * checked; `FMT_FLOAT_STRIDE=1` checks them all.
+ */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/fmt.h"
+
+#define DEFAULT_STRIDE 127
+#define RANDOM_DOUBLES 2000000
+
+static uint64_t xorshift(uint64_t *state)
+{
+        uint64_t x = *state;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return *state = x;
+}
+
+static uint64_t env_u64(char const *name, uint64_t fallback)
+{
+        char const *value = getenv(name);
+        return value ? strtoull(value, NULL, 0) : fallback;
+}
+
+static long check_floats(uint64_t stride, uint64_t end)
+{
+        long failures = 0;
+        char buf[FMT_FLOAT_MAX + 1];
+        for (uint64_t bits = 0; bits < end; bits += stride) {
+                uint32_t pattern = (uint32_t)bits;
+                float v;
+                memcpy(&v, &pattern, sizeof v);
+                buf[fmt_f32_shortest(buf, v)] = '\0';
+                float back = strtof(buf, NULL);
+                bool same = isnan(v) ? isnan(back) : memcmp(&back, &v, sizeof v) == 0;
+                if (!same && failures++ < 10) {
+                        printf("float %08x -> %s\n", pattern, buf);
+                }
+        }
+        return failures;
+}
+
+static long check_doubles()
+{
+        long failures = 0;
+        uint64_t state = 0x9e3779b97f4a7c15ull;
+        char buf[FMT_FLOAT_MAX + 1];
+        for (long i = 0; i < RANDOM_DOUBLES; ++i) {
+                uint64_t pattern = xorshift(&state);
+                double v;
+                memcpy(&v, &pattern, sizeof v);
+                buf[fmt_f64_shortest(buf, v)] = '\0';
+                double back = strtod(buf, NULL);
+                bool same = isnan(v) ? isnan(back) : memcmp(&back, &v, sizeof v) == 0;
+                if (!same && failures++ < 10) {
+                        printf("double %016llx -> %s\n", (unsigned long long)pattern, buf);
+                }
+        }
+        return failures;
+}
+
+int main()
+{
+        uint64_t stride = env_u64("FMT_FLOAT_STRIDE", DEFAULT_STRIDE);
+        if (stride == 0) {
+                stride = 1;
+        }
+        uint64_t end = getenv("FMT_FLOAT_ALL") ? UINT64_C(1) << 32 : UINT64_C(1) << 31;
+        clock_t start = clock();
+        long failures = check_floats(stride, end);
+        printf("fmt_float: %llu float patterns (stride %llu), %ld failures, %.1fs\n",
+               (unsigned long long)(end / stride), (unsigned long long)stride,
+               failures, (double)(clock() - start) / CLOCKS_PER_SEC);
+        long double_failures = check_doubles();
+        printf("fmt_float: %d random doubles, %ld failures\n", RANDOM_DOUBLES, double_failures);
+        return failures + double_failures != 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * The integer kernels behind `fmt_int()` and friends, fuzzed against
+ * `snprintf()`: random values of every length, plus the edges of each digit
+ * count and of the integer types.
+ */
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../include/fmt.h"
+
+#define RANDOM_VALUES 1000000
+
+static long failures = 0;
+
+static uint64_t xorshift(uint64_t *state)
+{
+        uint64_t x = *state;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return *state = x;
+}
+
+static void expect(char const *what, uint64_t v, char const *got, size_t len, char const *want)
+{
+        if (len == strlen(want) && memcmp(got, want, len) == 0) {
+                return;
+        }
+        if (failures++ < 10) {
+                printf("%s(%" PRIu64 "): got \"%.*s\", want \"%s\"\n", what, v, (int)len, got, want);
+        }
+}
+
+static void check(uint64_t v)
+{
+        char got[FMT_INTEGRAL_MAX], want[32];
+        int64_t s = (int64_t)v;
+
+        snprintf(want, sizeof want, "%" PRIu64, v);
+        expect("fmt_u64_dec", v, got, fmt_u64_dec(got, v), want);
+        if (fmt_dec_digits(v) != strlen(want) && failures++ < 10) {
+                printf("fmt_dec_digits(%" PRIu64 "): got %zu\n", v, fmt_dec_digits(v));
+        }
+        snprintf(want, sizeof want, "%" PRId64, s);
+        expect("fmt_i64_dec", v, got, fmt_i64_dec(got, s), want);
+        snprintf(want, sizeof want, "%" PRIx64, v);
+        expect("fmt_u64_hex", v, got, fmt_u64_hex(got, v, false), want);
+        snprintf(want, sizeof want, "%" PRIX64, v);
+        expect("fmt_u64_hex upper", v, got, fmt_u64_hex(got, v, true), want);
+        snprintf(want, sizeof want, "%" PRIo64, v);
+        expect("fmt_u64_oct", v, got, fmt_u64_oct(got, v), want);
+}
+
+int main()
+{
+        uint64_t checked = 0;
+        // Each side of every power of ten, two and eight, and their negations
+        for (uint64_t p = 1; p != 0; p = p <= UINT64_MAX / 10 ? p * 10 : 0) {
+                for (uint64_t d = 0; d < 3; ++d) {
+                        check(p - 1 + d);
+                        check(-(p - 1 + d));
+                        checked += 2;
+                }
+        }
+        for (int shift = 0; shift < 64; ++shift) {
+                uint64_t p = UINT64_C(1) << shift;
+                for (uint64_t d = 0; d < 3; ++d) {
+                        check(p - 1 + d);
+                        check(-(p - 1 + d));
+                        checked += 2;
+                }
+        }
+        check(UINT64_MAX);
+        check((uint64_t)INT64_MAX);
+        check((uint64_t)INT64_MIN);
+        checked += 3;
+        // Random values, shifted so that every length is as likely as any other
+        uint64_t state = 0x9e3779b97f4a7c15ull;
+        for (long i = 0; i < RANDOM_VALUES; ++i) {
+                uint64_t r = xorshift(&state);
+                check(r >> (r & 63));
+                ++checked;
+        }
+        printf("fmt_int: %" PRIu64 " values, %ld failures\n", checked, failures);
+        return failures != 0;
+}
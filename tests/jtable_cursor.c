@@ -0,0 +1,71 @@
+/*
+ * Removing entries through a cursor while iterating a jtable, with keys
+ * clustered at the end of the table so chains wrap past the last bucket.
+ * Every entry must be yielded exactly once, and exactly the removed ones
+ * must be gone afterwards.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../include/jtable.h"
+
+#define RUNS 3000
+#define MAX_KEYS 400
+
+static bool doomed(keyint_t k)
+{
+        return ((uint64_t)k * 2654435761u >> 7) % 3 != 0;
+}
+
+int main()
+{
+        long failures = 0;
+        keyint_t keys[MAX_KEYS];
+        for (int seed = 0; seed < RUNS; ++seed) {
+                srand(seed);
+                jtable tbl;
+                jtable_init(&tbl);
+                int n = 0;
+                for (int i = 10 + rand() % (MAX_KEYS - 10); i > 0; --i) {
+                        // Half the keys hash to the last 40 of 1024 buckets
+                        keyint_t base = rand() % 2 ? 1023 - rand() % 40 : rand() % 1024;
+                        keyint_t k = base + 1024 * (rand() % 1000);
+                        if (jtable_lookup(&tbl, k) == NULL) {
+                                jtable_insert(&tbl, k, k);
+                                keys[n++] = k;
+                        }
+                }
+
+                jtable seen;
+                jtable_init(&seen);
+                jtable_cursor it = JTABLE_CURSOR_INIT;
+                keyint_t k;
+                valint_t *v;
+                int yielded = 0;
+                while (jtable_next(&tbl, &it, &k, &v)) {
+                        if (jtable_lookup(&seen, k) || *v != k) {
+                                failures++;
+                                break;
+                        }
+                        jtable_insert(&seen, k, 1);
+                        yielded++;
+                        if (doomed(k)) {
+                                jtable_cursor_remove(&tbl, &it);
+                        }
+                }
+                if (yielded != n) {
+                        failures++;
+                }
+                for (int i = 0; i < n; ++i) {
+                        if ((jtable_lookup(&tbl, keys[i]) == NULL) != doomed(keys[i])) {
+                                failures++;
+                                break;
+                        }
+                }
+                jtable_deinit(&seen);
+                jtable_deinit(&tbl);
+        }
+        printf("jtable_cursor: %d runs, %ld failures\n", RUNS, failures);
+        return failures != 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * A table from `DEFINE_JTABLE()` against a `jtable` holding the same entries.
+ * Random inserts, updates and removes, with keys clustered so chains are long
+ * and wrap past the last bucket, must leave both with the same entries, and
+ * iterating with `NAME_cursor_remove()` must yield each entry exactly once.
+ * The key and value are wider than a pointer, so whole entries are moved.
+ */
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../include/jtable.h"
+#include "../include/jtable_generic.h"
+
+#define RUNS 300
+#define OPS 3000
+#define KEYS 1200
+
+struct wide_key {
+        keyint_t k;
+        uint32_t salt;
+};
+
+struct wide_val {
+        valint_t v;
+        uint64_t check[2];
+};
+
+static inline size_t wide_hash(struct wide_key const *k)
+{
+        // Like `jtable`, so that both tables chain the same way
+        return (size_t)k->k;
+}
+
+static inline bool wide_eq(struct wide_key const *a, struct wide_key const *b)
+{
+        return a->k == b->k && a->salt == b->salt;
+}
+
+DECLARE_JTABLE(wide_table, struct wide_key, struct wide_val)
+DEFINE_JTABLE(wide_table, struct wide_key, struct wide_val, wide_hash, wide_eq)
+
+static uint64_t rng = 88172645463325252ull;
+
+static uint64_t xorshift()
+{
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        return rng;
+}
+
+static struct wide_key key_of(keyint_t k)
+{
+        return (struct wide_key){ .k = k, .salt = (uint32_t)k * 2654435761u };
+}
+
+static struct wide_val val_of(valint_t v)
+{
+        return (struct wide_val){ .v = v, .check = { (uint64_t)v, ~(uint64_t)v } };
+}
+
+/** A key, half of them hashing to the last 40 of 1024 buckets */
+static keyint_t random_key()
+{
+        keyint_t base = xorshift() % 2 ? 1023 - (keyint_t)(xorshift() % 40)
+                                       : (keyint_t)(xorshift() % 1024);
+        return base + 1024 * (keyint_t)(xorshift() % (KEYS / 40));
+}
+
+/** Whether `tbl` and `ref` hold exactly the same entries */
+static bool same_entries(wide_table *tbl, jtable *ref)
+{
+        if (tbl->len != ref->len) {
+                return false;
+        }
+        jtable_cursor it = JTABLE_CURSOR_INIT;
+        keyint_t k;
+        valint_t *v;
+        while (jtable_next(ref, &it, &k, &v)) {
+                struct wide_key key = key_of(k);
+                struct wide_val *found = wide_table_lookup(tbl, &key);
+                if (found == NULL || found->v != *v || found->check[0] != (uint64_t)*v ||
+                    found->check[1] != ~(uint64_t)*v) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+int main()
+{
+        long failures = 0;
+        for (int run = 0; run < RUNS; ++run) {
+                wide_table tbl;
+                wide_table_init(&tbl);
+                jtable ref;
+                jtable_init(&ref);
+                for (int op = 0; op < OPS; ++op) {
+                        keyint_t k = random_key();
+                        struct wide_key key = key_of(k);
+                        // More inserts than removes at first, so the tables grow,
+                        // and then fewer, so they shrink
+                        if (xorshift() % OPS < (uint64_t)(op < OPS / 2 ? OPS / 3 : 2 * OPS / 3)) {
+                                wide_table_remove(&tbl, &key);
+                                jtable_remove(&ref, k);
+                        } else {
+                                valint_t v = (valint_t)(xorshift() >> 1);
+                                wide_table_insert(&tbl, &key, &(struct wide_val){ 0 });
+                                *wide_table_lookup(&tbl, &key) = val_of(v);
+                                jtable_insert(&ref, k, v);
+                        }
+                }
+                if (!same_entries(&tbl, &ref)) {
+                        failures++;
+                }
+
+                // Remove a third of the entries while iterating
+                jtable seen;
+                jtable_init(&seen);
+                jtable_cursor it = JTABLE_CURSOR_INIT;
+                struct wide_key *k;
+                struct wide_val *v;
+                size_t yielded = 0;
+                size_t len = tbl.len;
+                while (wide_table_next(&tbl, &it, &k, &v)) {
+                        if (jtable_lookup(&seen, k->k) || jtable_lookup(&ref, k->k) == NULL ||
+                            *jtable_lookup(&ref, k->k) != v->v) {
+                                failures++;
+                                break;
+                        }
+                        jtable_insert(&seen, k->k, 1);
+                        yielded++;
+                        if (xorshift() % 3 == 0) {
+                                jtable_remove_noshrink(&ref, k->k);
+                                wide_table_cursor_remove(&tbl, &it);
+                        }
+                }
+                if (yielded != len || !same_entries(&tbl, &ref)) {
+                        failures++;
+                }
+                jtable_deinit(&seen);
+                jtable_deinit(&ref);
+                wide_table_deinit(&tbl);
+        }
+        printf("jtable_generic: %d runs, %ld failures\n", RUNS, failures);
+        return failures != 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * Every `utf8_validate()` and `utf8_count()` kernel this CPU can run against
+ * the scalar ones. Inputs are random valid text, the same cut short at every
+ * length (so sequences are truncated at the end, also right at a 16 or 32
+ * byte block boundary) and with random bytes corrupted, plus known invalid
+ * sequences placed around the block boundaries. Each input is a buffer of
+ * exactly its length, so the sanitizers catch a kernel that reads past it.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/utf8.h"
+
+#define RUNS 2000
+#define MAX_LEN 100
+
+static uint64_t rng = 88172645463325252ull;
+
+static uint64_t xorshift()
+{
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        return rng;
+}
+
+static struct utf8_kernel const *kernels;
+static size_t nr_kernels;
+static long cases = 0;
+static long failures = 0;
+
+/** Encode `cp` at `out`, and return its length */
+static size_t encode(uint8_t *out, uint32_t cp)
+{
+        if (cp < 0x80) {
+                out[0] = (uint8_t)cp;
+                return 1;
+        } else if (cp < 0x800) {
+                out[0] = (uint8_t)(0xc0 | cp >> 6);
+                out[1] = (uint8_t)(0x80 | (cp & 0x3f));
+                return 2;
+        } else if (cp < 0x10000) {
+                out[0] = (uint8_t)(0xe0 | cp >> 12);
+                out[1] = (uint8_t)(0x80 | (cp >> 6 & 0x3f));
+                out[2] = (uint8_t)(0x80 | (cp & 0x3f));
+                return 3;
+        }
+        out[0] = (uint8_t)(0xf0 | cp >> 18);
+        out[1] = (uint8_t)(0x80 | (cp >> 12 & 0x3f));
+        out[2] = (uint8_t)(0x80 | (cp >> 6 & 0x3f));
+        out[3] = (uint8_t)(0x80 | (cp & 0x3f));
+        return 4;
+}
+
+/** A random codepoint, mostly ASCII, of every length, and never a surrogate */
+static uint32_t random_codepoint()
+{
+        switch (xorshift() % 6) {
+        case 0:
+                return 0x80 + (uint32_t)(xorshift() % (0x800 - 0x80));
+        case 1: {
+                uint32_t cp = 0x800 + (uint32_t)(xorshift() % (0x10000 - 0x800));
+                return cp >= 0xd800 && cp < 0xe000 ? cp - 0x800 : cp;
+        }
+        case 2:
+                return 0x10000 + (uint32_t)(xorshift() % (0x110000 - 0x10000));
+        default:
+                return (uint32_t)(xorshift() % 0x80);
+        }
+}
+
+/** Compare every kernel with the scalar one on the `len` bytes at `text` */
+static void check(uint8_t const *text, size_t len)
+{
+        // Exactly `len` bytes, so an overread is caught
+        uint8_t *buf = malloc(len ? len : 1);
+        if (buf == NULL) {
+                exit(1);
+        }
+        memcpy(buf, text, len);
+        bool valid = kernels[0].validate(buf, len);
+        size_t count = kernels[0].count(buf, len);
+        for (size_t i = 1; i < nr_kernels; ++i) {
+                bool kvalid = kernels[i].validate(buf, len);
+                size_t kcount = kernels[i].count(buf, len);
+                if (kvalid != valid || kcount != count) {
+                        if (failures < 10) {
+                                printf("%s: length %zu: valid %d, count %zu, scalar %d, %zu\n",
+                                       kernels[i].name, len, kvalid, kcount, valid, count);
+                        }
+                        failures++;
+                }
+        }
+        if (utf8_validate(buf, len) != valid || utf8_count(buf, len) != count) {
+                failures++;
+        }
+        cases++;
+        free(buf);
+}
+
+/** `check()`, and also that the scalar kernel says whether it is `valid` */
+static void check_known(uint8_t const *text, size_t len, bool valid)
+{
+        if (kernels[0].validate(text, len) != valid) {
+                if (failures < 10) {
+                        printf("scalar: length %zu: expected valid %d\n", len, valid);
+                }
+                failures++;
+        }
+        check(text, len);
+}
+
+int main()
+{
+        nr_kernels = utf8_kernels(&kernels);
+        printf("utf8: kernels");
+        for (size_t i = 0; i < nr_kernels; ++i) {
+                printf(" %s", kernels[i].name);
+        }
+        printf("\n");
+
+        uint8_t text[MAX_LEN + 4];
+        for (int run = 0; run < RUNS; ++run) {
+                size_t len = 0;
+                size_t codepoints = 0;
+                size_t want = xorshift() % MAX_LEN;
+                while (len < want) {
+                        len += encode(text + len, random_codepoint());
+                        codepoints++;
+                }
+                check_known(text, len, true);
+                if (kernels[0].count(text, len) != codepoints) {
+                        failures++;
+                }
+                // Every prefix, most of which end in a truncated sequence
+                for (size_t cut = 0; cut < len; ++cut) {
+                        check(text, cut);
+                }
+                for (int i = 0; i < 4 && len > 0; ++i) {
+                        text[xorshift() % len] = (uint8_t)xorshift();
+                        check(text, len);
+                }
+        }
+
+        // Invalid sequences, and a truncated one at the very end, with the
+        // bad byte just before, on and after each block boundary
+        static struct {
+                char const *bytes;
+                bool valid;
+        } const known[] = {
+                { "\xc2\xa9", true },              // U+00A9
+                { "\xe2\x82\xac", true },          // U+20AC
+                { "\xf0\x9f\x98\x80", true },      // U+1F600
+                { "\xf4\x8f\xbf\xbf", true },      // U+10FFFF
+                { "\xc0\x80", false },             // overlong
+                { "\xc1\xbf", false },             // overlong
+                { "\xe0\x80\x80", false },         // overlong
+                { "\xf0\x80\x80\x80", false },     // overlong
+                { "\xed\xa0\x80", false },         // surrogate
+                { "\xf4\x90\x80\x80", false },     // above U+10FFFF
+                { "\xf5\x80\x80\x80", false },     // above U+10FFFF
+                { "\xff", false },
+                { "\x80", false },                 // lone continuation
+                { "\xc2", false },                 // truncated
+                { "\xe2\x82", false },             // truncated
+                { "\xf0\x9f\x98", false },         // truncated
+                { "\xc2\xa9\xa9", false },         // one continuation too many
+        };
+        size_t const boundaries[] = { 16, 32, 48, 64 };
+        for (size_t i = 0; i < sizeof known / sizeof known[0]; ++i) {
+                size_t n = strlen(known[i].bytes);
+                for (size_t b = 0; b < sizeof boundaries / sizeof boundaries[0]; ++b) {
+                        for (size_t at = boundaries[b] - 4; at <= boundaries[b] + 1; ++at) {
+                                memset(text, 'a', at);
+                                memcpy(text + at, known[i].bytes, n);
+                                // Ending with it, and followed by more text
+                                check_known(text, at + n, known[i].valid);
+                                memset(text + at + n, 'b', 3);
+                                check_known(text, at + n + 3, known[i].valid);
+                        }
+                }
+        }
+        printf("utf8: %ld cases, %ld failures\n", cases, failures);
+        return failures != 0;
+}